@@ -1,15 +1,20 @@
 #version 330 core
 
+// per frame data, shared by every program (must match cgra::frame_uniforms)
+layout(std140) uniform FrameData {
+	mat4 uView;
+	mat4 uProjection;
+	mat4 uViewProjection;
+	vec4 uLightColor;
+	vec4 uSpecular; // w is the shininess
+	vec2 uViewport;
+	float uTime;
+};
+
 // uniform data
-uniform mat4 uProjectionMatrix;
-uniform mat4 uModelViewMatrix;
+uniform mat4 uModelMatrix;
 uniform vec3 uColor;
 
-//phong shading data
-uniform vec3 ulightcolor;
-uniform vec3 uspeccolor;
-uniform float ushininess;
-
 // viewspace data (this must match the output of the fragment shader)
 in VertexData {
 	vec3 position;
@@ -32,20 +37,20 @@ void main() {
     
     //ambient
     float ambientStrength = 0.3;
-    vec3 ambient = ambientStrength * ulightcolor;
+    vec3 ambient = ambientStrength * uLightColor.rgb;
     
     //diffuse
     vec3 norm = normalize(f_in.normal);
     vec3 lightDirection = normalize(-f_in.position);
     float diff = max(dot(norm, lightDirection),0.0);
-    vec3 diffuse = diff * ulightcolor;
+    vec3 diffuse = diff * uLightColor.rgb;
     
     //specular
     float specularStrength = 0.5;
     vec3 reflectDirection = reflect(-lightDirection, norm);
     vec3 viewDirection = lightDirection;
-    float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), ushininess);
-    vec3 specular = specularStrength * spec * uspeccolor;
+    float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), uSpecular.w);
+    vec3 specular = specularStrength * spec * uSpecular.rgb;
     
     //enable different functionalities to be toggled on and off
     vec3 result;
@@ -1,10 +1,25 @@
 #version 330 core
 
+// per frame data, shared by every program (must match cgra::frame_uniforms)
+layout(std140) uniform FrameData {
+	mat4 uView;
+	mat4 uProjection;
+	mat4 uViewProjection;
+	vec4 uLightColor;
+	vec4 uSpecular; // w is the shininess
+	vec2 uViewport;
+	float uTime;
+};
+
 // uniform data
-uniform mat4 uProjectionMatrix;
-uniform mat4 uModelViewMatrix;
+uniform mat4 uModelMatrix;
 uniform vec3 uColor;
 
+// instances made from gl_InstanceID instead of read from the instance attributes
+// (the same as procedural_ring_transform and procedural_ring_color, see cgra_procedural)
+uniform bool uProceduralInstances;
+uniform uint uInstanceSeed;
+
 // mesh data
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
@@ -12,6 +27,15 @@ layout(location = 2) in vec2 aTexCoord;
 layout(location = 3) in vec3 aInstanceColors;
 layout(location = 4) in mat4 transformations;
 
+// quantized vertex decoding (constant per mesh, see gl_mesh)
+// w > 0.5 means aNormal.xy holds an octahedral encoded normal
+layout(location = 8) in vec4 aPositionScale;
+layout(location = 9) in vec3 aPositionOffset;
+
+// how the instance transform is stored (constant per mesh, see instance_format)
+// 0 a mat4, 1 the top three rows of one, 2 translation and scale then a quaternion
+layout(location = 10) in float aInstanceFormat;
+
 // model data (this must match the input of the vertex shader)
 out VertexData {
 	vec3 position;
@@ -20,13 +44,77 @@ out VertexData {
     vec3 instanceColors;
 } v_out;
 
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+	return normalize(n);
+}
+
+mat4 instanceTransform() {
+	if (aInstanceFormat < 0.5) return transformations;
+	if (aInstanceFormat < 1.5) return transpose(transformations); // the fourth column is (0, 0, 0, 1)
+	vec4 q = transformations[1];
+	float s = transformations[0].w;
+	mat3 r = mat3(
+		1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y),
+		2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x),
+		2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y)
+	) * s;
+	return mat4(vec4(r[0], 0), vec4(r[1], 0), vec4(r[2], 0), vec4(transformations[0].xyz, 1));
+}
+
+uint ringHash(uint x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+float ringUnit(uint instance, uint k) {
+	return float(ringHash(instance ^ ringHash(uInstanceSeed + k * 0x9e3779b9u)) >> 8) / 16777216.0;
+}
+
+mat4 ringTransform(uint instance) {
+	if (instance == 0u) return mat4(1.0);
+	float angle = float(((instance - 1u) * 0x255ab960u) >> 8) * (6.28318531 / 16777216.0);
+	float s = sin(angle);
+	float c = cos(angle);
+	vec3 position = vec3(s, s / c, c) * 70.0 + (40.0 * ringUnit(instance, 0u) - 20.0);
+	float scale = 0.8 * ringUnit(instance, 1u);
+	float rotation = 6.28318531 * ringUnit(instance, 2u);
+
+	// about a fixed axis as glm::rotate does it
+	vec3 axis = normalize(vec3(0.4, 0.5, 0.6));
+	float rc = cos(rotation);
+	float rs = sin(rotation);
+	vec3 t = (1.0 - rc) * axis;
+	mat3 r = mat3(
+		rc + t.x * axis.x, t.x * axis.y + rs * axis.z, t.x * axis.z - rs * axis.y,
+		t.y * axis.x - rs * axis.z, rc + t.y * axis.y, t.y * axis.z + rs * axis.x,
+		t.z * axis.x + rs * axis.y, t.z * axis.y - rs * axis.x, rc + t.z * axis.z
+	) * scale;
+	return mat4(vec4(r[0], 0), vec4(r[1], 0), vec4(r[2], 0), vec4(position, 1));
+}
+
+vec3 ringColor(uint instance) {
+	if (instance == 0u) return vec3(0.8, 1, 1);
+	return vec3(ringUnit(instance, 3u), ringUnit(instance, 4u), ringUnit(instance, 5u));
+}
+
 void main() {
+	mat4 transform = uProceduralInstances ? ringTransform(uint(gl_InstanceID)) : instanceTransform();
+	vec3 position = aPositionOffset + aPositionScale.xyz * aPosition;
+	vec3 normal = aPositionScale.w > 0.5 ? octDecode(aNormal.xy) : aNormal;
+
 	// transform vertex data to viewspace
-	v_out.position = (uModelViewMatrix * transformations * vec4(aPosition, 1)).xyz;
-	v_out.normal = normalize((uModelViewMatrix * transformations * vec4(aNormal, 0)).xyz);
+	mat4 modelView = uView * uModelMatrix * transform;
+	v_out.position = (modelView * vec4(position, 1)).xyz;
+	v_out.normal = normalize((modelView * vec4(normal, 0)).xyz);
 	v_out.textureCoord = aTexCoord;
-    v_out.instanceColors = aInstanceColors;
+    v_out.instanceColors = uProceduralInstances ? ringColor(uint(gl_InstanceID)) : aInstanceColors;
 
 	// set the screenspace position (needed for converting to fragment data)
-	gl_Position = uProjectionMatrix * uModelViewMatrix * transformations * vec4(aPosition, 1);
+	gl_Position = uProjection * vec4(v_out.position, 1);
 }
@@ -1,5 +1,6 @@
 
 // std
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <chrono>
@@ -11,13 +12,19 @@
 
 // project
 #include "application.hpp"
-#include "bounding_box.hpp"
+#include "cgra/cgra_frame_uniforms.hpp"
 #include "cgra/cgra_geometry.hpp"
+#include "cgra/cgra_gl_state.hpp"
 #include "cgra/cgra_gui.hpp"
 #include "cgra/cgra_image.hpp"
 #include "cgra/cgra_shader.hpp"
+#include "cgra/cgra_simplify.hpp"
+#include "cgra/cgra_tmesh.hpp"
 #include "cgra/cgra_wavefront.hpp"
 #include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_meshlet.hpp"
+#include "cgra/cgra_render_queue.hpp"
+#include "cgra/cgra_resource.hpp"
 
 //to print vecs and mats (for testing)
 #define GLM_ENABLE_EXPERIMENTAL
@@ -30,64 +37,239 @@ using namespace glm;
 const float tau = glm::two_pi<float>();
 
 
+namespace {
+	// cpu side of the teapot, filled in on a loader thread and kept for the bounding boxes
+	struct teapot_data {
+		wavefront_stats stats;
+		mesh_builder mb;
+		vector<meshlet> meshlets;
+		vector<mesh_lod> lods;
+		vector<gl_mesh> lod_levels; // filled in as each level becomes resident
+		mesh_bvh bvh; // for picking
+		aabb box; // for the bounding boxes of the instances
+		vector<vec3> hull;
+		size_t lods_resident = 0;
+	};
+}
+
+
 Application::Application(GLFWwindow *window) : m_window(window) {
-    m_model.mesh.transformations.clear();
-    m_model.mesh.instanceColors.clear();
-    boundingBox_mesh.clear();
 	
-	// build the shader for the model
-	shader_builder color_sb;
-	color_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_vert.glsl"));
-	color_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_frag.glsl"));
-	GLuint color_shader = color_sb.build();
+	// build the shader for the model (shared with anything else that asks for the same files)
+	GLuint color_shader = resources().acquire_shader(CGRA_SRCDIR + std::string("//res//shaders//default_vert.glsl"),
+		CGRA_SRCDIR + std::string("//res//shaders//default_frag.glsl"));
 
-	// build the mesh for the model
-	mesh_builder teapot_mb = load_wavefront_data(CGRA_SRCDIR + std::string("//res//assets//teapot.obj"));
-	gl_mesh teapot_mesh = teapot_mb.build();
-
-	// put together an object
+	// put together an object, the mesh and texture are streamed in below
+	// and the model draws a box (with a white texture) until they arrive
 	m_model.shader = color_shader;
-	m_model.mesh = teapot_mesh;
 	m_model.color = glm::vec3(0.8, 1, 1);
 	m_model.modelTransform = glm::mat4(1);
-    //phong shading model variables
-    m_model.lightcolor = glm::vec3(0.8, 0.5, 1);
-    m_model.speccolor = glm::vec3(1, 1, 1);
-    m_model.shininess = 20;
-    
-    //bounding boxes
-    for(unsigned int i=0; i<m_model.mesh.transformations.size(); i++){
-        calculateBoundingBox(teapot_mb, i);
+
+	// texture
+	m_model.texture = m_assets.load_texture(CGRA_SRCDIR + std::string("//res//textures//checkerboard.jpg"),
+		[this](streamed_texture &tex) { m_model.texture = tex.texture; })->texture;
+
+	// a box stands in for the teapot, drawn with the instances, until it has streamed in. it is
+	// the size the teapot was when it was last cached (read before the loader can rewrite it)
+	const string teapot_filename = CGRA_SRCDIR + std::string("//res//assets//teapot.obj");
+	const string teapot_cache = tmesh_cache_path(teapot_filename);
+	aabb proxy = { vec3(-1), vec3(1) };
+	if (ifstream(teapot_cache).good()) {
+		try {
+			tmesh cached(teapot_cache);
+			proxy = { cached.bounds_min(), cached.bounds_max() };
+		}
+		catch (runtime_error &) { }
+	}
+	m_model.mesh = box_mesh(proxy).build();
+	rebuildInstances();
+
+	// build the mesh for the model on a loader thread
+	// (the parsed mesh is cached next to the .obj and reused until the .obj changes)
+	auto teapot = make_shared<teapot_data>();
+	m_assets.load_mesh([teapot, teapot_filename] {
+		wavefront_options teapot_options;
+		teapot_options.optimize = true;
+		tmesh teapot_tm = load_wavefront_cached(teapot_filename, teapot_options, &teapot->stats);
+		teapot->mb = teapot_tm.to_mesh_builder(); // cpu copy for meshlets, LODs and the bounding boxes
+		teapot->meshlets = build_meshlets(teapot->mb);
+		teapot->lods = generate_lod_chain(teapot->mb); // levels of detail for the instances
+		teapot->bvh.build(teapot->mb);
+		teapot->box = mesh_aabb(teapot->mb);
+		teapot->hull = convex_hull_vertices(teapot->mb);
+		const mesh_builder &mb = teapot->mb;
+		return pack_mesh(mb.vertices.data(), mb.vertices.size(), mb.indices.data(), mb.indices.size(), mb.mode, vertex_format::compact());
+	}, [this, teapot](streamed_mesh &sm) {
+		if (sm.failed) return;
+		const wavefront_stats &teapot_stats = teapot->stats;
+		cout << "Loaded teapot" << (teapot_stats.from_cache ? " from cache: " : ": ") << teapot_stats.triangles << " triangles, "
+			<< teapot_stats.corners << " corners welded to " << teapot_stats.vertices << " vertices ("
+			<< teapot_stats.vertex_reduction() << "x smaller vertex buffer) in "
+			<< teapot_stats.parse_ms << " ms parse + " << teapot_stats.build_ms << " ms build" << endl;
+		if (teapot_stats.optimized) {
+			cout << "Optimized teapot: ACMR " << teapot_stats.optimize.before.acmr << " -> " << teapot_stats.optimize.after.acmr
+				<< ", ATVR " << teapot_stats.optimize.before.atvr << " -> " << teapot_stats.optimize.after.atvr << endl;
+		}
+		cout << "Teapot LODs:";
+		for (const mesh_lod &lod : teapot->lods) {
+			cout << " " << lod.mesh.indices.size() / 3 << " (error " << lod.error << ")";
+		}
+		cout << endl;
+
+		// the teapot takes the place of the box (and its references to the instance buffers)
+		bool drawInstances = m_model.mesh.drawInstances;
+		m_model.mesh.destroy();
+		m_model.mesh = sm.mesh;
+		m_model.mesh.drawInstances = drawInstances;
+		m_model.meshlets = teapot->meshlets;
+		m_instanceBoxes.set_mesh(teapot->box, std::move(teapot->hull));
+		m_meshBvh = std::move(teapot->bvh);
+
+		//occluders are the coarsest level with enough triangles to hide things behind it
+		const mesh_builder *occluder = &teapot->mb;
+		for (const mesh_lod &lod : teapot->lods) {
+			if (lod.mesh.indices.size() / 3 >= 256) occluder = &lod.mesh;
+		}
+		m_model.occluderMesh = make_occluder_mesh(*occluder);
+
+		//instances and their bounding boxes
+		rebuildInstances();
+
+		// stream the levels of detail after the main mesh, the LOD
+		// mesh is put together once they have all arrived
+		teapot->lod_levels.resize(teapot->lods.size());
+		for (size_t l = 0; l < teapot->lods.size(); l++) {
+			m_assets.load_mesh([teapot, l] {
+				const mesh_builder &mb = teapot->lods[l].mesh;
+				return pack_mesh(mb.vertices.data(), mb.vertices.size(), mb.indices.data(), mb.indices.size(), mb.mode, vertex_format::compact());
+			}, [this, teapot, l](streamed_mesh &level) {
+				if (level.failed) return;
+				teapot->lod_levels[l] = level.mesh;
+				if (++teapot->lods_resident == teapot->lods.size()) {
+					m_model.lods = build_gl_lod_mesh(teapot->lods, teapot->lod_levels);
+				}
+			});
+		}
+	});
+}
+
+void Application::rebuildInstances(){
+    //same count and seed always give the same instances
+    instance_set generated = make_ring_instances(size_t(std::max(m_instanceCount, 1)), uint32_t(m_instanceSeed), "instances/model");
+    m_model.instances.transforms = std::move(generated.transforms);
+    m_model.instances.colors = std::move(generated.colors);
+    m_model.instances.name = generated.name;
+    m_model.instances.upload();
+    if (m_model.mesh.vao) m_model.instances.attach(m_model.mesh);
+    m_model.instancesCompacted = false;
+
+    //motions around where the instances start
+    m_motions = make_instance_motions(m_model.instances.transforms, uint32_t(m_instanceSeed));
+    m_animationTime = 0;
+
+    //picking (once the model has arrived)
+    m_picked = ray_hit();
+    if (m_meshBvh.triangles() > 0) m_instanceBvh.build(m_meshBvh, m_model.instances.transforms);
+    m_instancesMoved = false;
+    rebuildProceduralInstances();
+
+    //bounding boxes (only once the model has arrived)
+    const aabb &local = m_instanceBoxes.local_box();
+    if (local.empty()) return;
+
+    //bounding spheres of the instances for culling, from the sphere around the model's bounding box
+    //(the furthest point of the model from anywhere is on its hull)
+    vec3 center = local.center();
+    float radius = 0;
+    for (const vec3 &p : m_instanceBoxes.hull()) radius = std::max(radius, length(p - center));
+    m_model.boundsCenter = center;
+    m_model.boundsRadius = radius;
+    m_model.boundsBox = local;
+    updateInstanceBounds();
+
+    rebuildBoundingBoxes();
+}
+
+
+void Application::rebuildBoundingBoxes(){
+    if (m_instanceBoxes.local_box().empty()) return;
+
+    //world boxes of every instance, from the model's box (or hull) rather than all its vertices
+    m_instanceBoxes.update(m_model.instances.transforms);
+    m_boxBatch.upload(m_instanceBoxes.boxes());
+    m_boxesMoved = false;
+}
+
+
+void Application::updateInstanceBounds(){
+    compute_instance_bounds(m_model.instances, m_model.boundsCenter, m_model.boundsRadius, m_model.instanceBounds);
+    m_boundsMoved = false;
+}
+
+
+void Application::rebuildProceduralInstances(){
+    m_model.proceduralSeed = uint32_t(m_instanceSeed);
+    m_model.proceduralCount = uint32_t(m_proceduralCount);
+    m_picked = ray_hit();
+    m_proceduralBounds = aabb();
+    if (!m_model.useProceduralInstances || m_instanceBoxes.local_box().empty()) return;
+    m_proceduralBounds = procedural_ring_bounds(m_model.proceduralSeed, m_model.proceduralCount, m_instanceBoxes.local_box());
+}
+
+
+void Application::animateInstances(){
+    //time since the last frame, limited so a stall doesn't jump everything along
+    double now = glfwGetTime();
+    float dt = float(std::min(now - m_lastFrameTime, 0.1));
+    m_lastFrameTime = now;
+    if (!m_animate || m_model.useProceduralInstances || m_motions.size() != m_model.instances.size()) return;
+    m_animationTime += dt;
+
+    if (!m_animationPool || int(m_animationPool->size()) != m_animationThreads) {
+        m_animationPool.reset(new task_pool(unsigned(m_animationThreads)));
     }
+
+    //the cpu copy is still needed for culling, LOD and picking
+    instance_set &instances = m_model.instances;
+    void *mapped = instances.map_transforms();
+    animate_instances(m_motions, m_animationTime, instances.transforms.data(), mapped, instances.buffer_format, *m_animationPool, &m_animationStats);
+    //if the buffer couldn't be mapped (or lost its contents) the transforms just computed go up the usual way
+    const bool written = mapped && instances.unmap_transforms();
+    if (!written && !instances.transforms.empty()) instances.upload();
+
+    //everything else that follows the instances, what is turned off catches up when it is turned on
+    if (m_model.useInstanceCulling) updateInstanceBounds();
+    else m_boundsMoved = true;
+    if (m_showBoundingBox) rebuildBoundingBoxes();
+    else m_boxesMoved = true;
+    m_instancesMoved = true;
 }
 
-void Application::calculateBoundingBox(mesh_builder teapot, int transIndex){
-    //transform each vertex position by the instance transformation
-    for(unsigned int i = 0; i < teapot.vertices.size(); i++){
-        teapot.vertices[i].pos = m_model.mesh.transformations.at(transIndex) * vec4(teapot.vertices[i].pos,1);
+
+void Application::measureAnimationScaling(){
+    m_animationScaling.clear();
+    if (m_motions.empty()) return;
+    vector<mat4> transforms(m_motions.size());
+    for (unsigned threads = 1; threads <= hardware_threads(); threads++) {
+        task_pool pool(threads);
+        double best = numeric_limits<double>::infinity();
+        for (int run = 0; run < 5; run++) {
+            animation_stats stats;
+            animate_instances(m_motions, m_animationTime, transforms.data(), nullptr, m_model.instances.buffer_format, pool, &stats);
+            best = std::min(best, stats.ms);
+        }
+        m_animationScaling.push_back(best);
     }
-    
-    //calculate boundaries
-    GLfloat min_x, max_x, min_y, max_y, min_z, max_z;
-    min_x = max_x = teapot.vertices[0].pos.x;
-    min_y = max_y = teapot.vertices[0].pos.y;
-    min_z = max_z = teapot.vertices[0].pos.z;
-    for(unsigned int i = 0; i < teapot.vertices.size(); i++){
-        if (teapot.vertices[i].pos.x < min_x) min_x = teapot.vertices[i].pos.x;
-        if (teapot.vertices[i].pos.x > max_x) max_x = teapot.vertices[i].pos.x;
-        if (teapot.vertices[i].pos.y < min_y) min_y = teapot.vertices[i].pos.y;
-        if (teapot.vertices[i].pos.y > max_y) max_y = teapot.vertices[i].pos.y;
-        if (teapot.vertices[i].pos.z < min_z) min_z = teapot.vertices[i].pos.z;
-        if (teapot.vertices[i].pos.z > max_z) max_z = teapot.vertices[i].pos.z;
-    }
-    minV = vec3(min_x, min_y, min_z);
-    maxV = vec3(max_x, max_y, max_z);
-    //add to list of bounding box meshes
-    boundingBox_mesh.push_back(createBoundingBoxMesh(minV, maxV));
 }
 
 
 void Application::render() {
+
+	// upload some more of whatever is being streamed in
+	m_assets.update(size_t(m_uploadBudgetKB) * 1024);
+
+	// move the instances
+	animateInstances();
 	
 	// retrieve the window hieght
 	int width, height;
@@ -101,8 +283,8 @@ void Application::render() {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
 
 	// enable flags for normal/forward rendering
-	glEnable(GL_DEPTH_TEST); 
-	glDepthFunc(GL_LESS);
+	gl_state().enable(GL_DEPTH_TEST);
+	gl_state().depth_func(GL_LESS);
 
 	// calculate the projection and view matrix
 	mat4 proj = perspective(1.f, float(width) / height, 0.1f, 1000.f);
@@ -112,24 +294,70 @@ void Application::render() {
     mat4 rotateY = rotate(view, m_pitch, vec3(1.0f, 0.0f, 0.0f));
     mat4 rotateX = rotate(view, m_yaw, vec3(0.0f, 1.0f, 0.0f));
     view = trans * rotateY * rotateX * view;
+    m_view = view;
+    m_proj = proj;
+
+    //everything every program reads this frame, uploaded once for all of them
+    cgra::frame_uniforms frame;
+    frame.view = view;
+    frame.projection = proj;
+    frame.view_projection = proj * view;
+    frame.light_color = vec4(m_lightColor, 1);
+    frame.specular = vec4(m_specularColor, m_shininess);
+    frame.viewport = vec2(width, height);
+    frame.time = float(glfwGetTime());
+    cgra::update_frame_uniforms(frame);
     
-	// draw options
-	if (m_show_grid) cgra::drawGrid(view, proj);
-	if (m_show_axis) cgra::drawAxis(view, proj);
-	glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe) ? GL_LINE : GL_FILL);
+    //everything to draw goes in the queue, which draws the model before the lines over it
+    //and keeps draws sharing state together (front to back among them)
+    m_renderQueue.clear();
+    const float modelDepth = -(view * m_model.modelTransform * vec4(m_model.boundsCenter, 1)).z;
+    const float originDepth = -view[3].z;
 
 	// draw the model
-	m_model.draw(view, proj);
+    m_renderQueue.submit(m_renderQueue.make_key(render_pass::opaque, m_model.shader, m_model.texture, m_model.mesh.vao, modelDepth),
+        [](void *app, uint32_t) {
+            Application &a = *static_cast<Application *>(app);
+            gl_state().polygon_mode((a.m_showWireframe) ? GL_LINE : GL_FILL);
+            a.m_model.draw(a.m_view, a.m_proj, a.m_windowsize.y);
+        }, this);
+
+	// draw options, keyed by the program and vertex array each one draws with
+	const GLuint dummyVao = dummy_vertex_array();
+	if (m_show_grid) m_renderQueue.submit(m_renderQueue.make_key(render_pass::lines, gridProgram(), 0, dummyVao, originDepth), [](void *, uint32_t) { cgra::drawGrid(); }, nullptr);
+	if (m_show_axis) m_renderQueue.submit(m_renderQueue.make_key(render_pass::lines, axisProgram(), 0, dummyVao, originDepth), [](void *, uint32_t) { cgra::drawAxis(); }, nullptr);
     
-    //bounding box
-    if(m_showBoundingBox) {
-        if(!m_model.mesh.drawInstances) boundingBox_mesh.at(0).draw();
-        else{
-            for(unsigned int i=0; i< boundingBox_mesh.size(); i++){ //for all the instances
-                boundingBox_mesh.at(i).draw();
+    //bounding boxes, every instance's in one draw (or just the one around them all when there are no stored instances)
+    if (m_showBoundingBox) {
+        const bool batch = !m_model.useProceduralInstances;
+        const uint64_t key = m_renderQueue.make_key(render_pass::lines, batch ? m_boxBatch.program() : boxProgram(), 0, batch ? m_boxBatch.vertex_array() : dummyVao, modelDepth);
+        m_renderQueue.submit(key, [](void *app, uint32_t) {
+            Application &a = *static_cast<Application *>(app);
+            if (a.m_model.useProceduralInstances) {
+                if (!a.m_proceduralBounds.empty()) drawBox(a.m_model.modelTransform, a.m_proceduralBounds.min, a.m_proceduralBounds.max, vec3(0.6, 1, 0.6));
             }
-        }
+            else {
+                size_t boxes = a.m_model.mesh.drawInstances ? a.m_boxBatch.size() : 1;
+                a.m_boxBatch.draw(a.m_model.modelTransform, vec3(0.6, 1, 0.6), boxes);
+            }
+        }, this);
+    }
+
+    //picked instance
+    if (m_picked.hit()) {
+        m_renderQueue.submit(m_renderQueue.make_key(render_pass::lines, boxProgram(), 0, dummyVao, modelDepth), [](void *app, uint32_t) {
+            Application &a = *static_cast<Application *>(app);
+            //from the transform rather than the bvh, which is only refitted when picking
+            const mat4 transform = a.m_model.useProceduralInstances
+                ? procedural_ring_transform(a.m_model.proceduralSeed, a.m_picked.instance)
+                : a.m_model.instances.transforms[a.m_picked.instance];
+            const aabb box = transform_aabb(a.m_meshBvh.bounds(), transform);
+            drawBox(a.m_model.modelTransform, box.min, box.max, vec3(1, 0.8, 0));
+        }, this);
     }
+
+    m_renderQueue.sort();
+    m_renderQueue.execute();
 }
 
 
@@ -137,7 +365,7 @@ void Application::renderGUI() {
 
 	// setup window
 	ImGui::SetNextWindowPos(ImVec2(5, 5), ImGuiSetCond_Once);
-	ImGui::SetNextWindowSize(ImVec2(360, 200), ImGuiSetCond_Once);
+	ImGui::SetNextWindowSize(ImVec2(360, 260), ImGuiSetCond_Once);
 	ImGui::Begin("Camera", 0);
 
 	// display current camera parameters
@@ -148,15 +376,53 @@ void Application::renderGUI() {
     ImGui::SliderFloat("Distance", &m_distance, 0, 100, "%.1f");
 	ImGui::SliderFloat3("Model Color", value_ptr(m_model.color), 0, 1, "%.2f");
     //Phong shading
-    ImGui::SliderFloat3("Light Color", value_ptr(m_model.lightcolor), 0, 1, "%.2f");
-    ImGui::SliderFloat3("Specular Color", value_ptr(m_model.speccolor), 0, 1, "%.2f");
-    ImGui::SliderFloat("Shininess", &m_model.shininess, 1.0, 100, "%.1f");
+    ImGui::SliderFloat3("Light Color", value_ptr(m_lightColor), 0, 1, "%.2f");
+    ImGui::SliderFloat3("Specular Color", value_ptr(m_specularColor), 0, 1, "%.2f");
+    ImGui::SliderFloat("Shininess", &m_shininess, 1.0, 100, "%.1f");
     
     //more instances - toggle on and off drawing instances
     if(ImGui::Button("More instances")){
         m_model.mesh.drawInstances = ! m_model.mesh.drawInstances;
     }
     
+    //how many instances, the same seed always gives the same instances
+    ImGui::InputInt("Instances", &m_instanceCount, 100, 10000);
+    ImGui::InputInt("Seed", &m_instanceSeed);
+    m_instanceCount = std::min(std::max(m_instanceCount, 1), 4000000);
+    if (ImGui::Button("Regenerate instances")) rebuildInstances();
+    ImGui::SameLine();
+    ImGui::Text("%d drawn", int(m_model.mesh.instance_count));
+
+    //how each instance is stored on the gpu, the shader rebuilds its transform
+    int format = int(m_model.instances.format);
+    if (ImGui::Combo("Instance format", &format, "Full mat4\0" "3x4 affine\0" "Position, scale, quaternion\0")) {
+        m_model.instances.format = instance_format(format);
+        m_model.instances.upload();
+        if (m_model.mesh.vao) m_model.instances.attach(m_model.mesh);
+    }
+    const instance_format held = m_model.instances.buffer_format;
+    const size_t instanceBytes = instance_transform_bytes(held) + instance_color_bytes(held);
+    ImGui::Text("%d bytes per instance, %.1f MB", int(instanceBytes), instanceBytes * m_model.instances.size() / (1024.0 * 1024.0));
+
+    //instances from gl_InstanceID and the seed, no memory or uploads at all
+    bool procedural = ImGui::Checkbox("Procedural instances", &m_model.useProceduralInstances);
+    procedural |= ImGui::InputInt("Procedural count", &m_proceduralCount, 100000, 10000000);
+    m_proceduralCount = std::min(std::max(m_proceduralCount, 1), 1 << 30);
+    if (procedural) rebuildProceduralInstances();
+
+    //animation of the instances, and how its update scales with threads
+    ImGui::Checkbox("Animate", &m_animate);
+    ImGui::SameLine();
+    ImGui::SliderInt("Threads", &m_animationThreads, 1, int(hardware_threads()));
+    if (m_animate) {
+        const animation_stats &as = m_animationStats;
+        ImGui::Text("%d instances in %d tasks on %d threads, %d steals (%.2f ms)", int(as.instances), int(as.tasks), int(as.threads), int(as.steals), as.ms);
+    }
+    if (ImGui::Button("Measure scaling")) measureAnimationScaling();
+    for (size_t t = 0; t < m_animationScaling.size(); t++) {
+        ImGui::Text("%d threads: %.2f ms (%.2fx)", int(t + 1), m_animationScaling[t], m_animationScaling[0] / m_animationScaling[t]);
+    }
+    
     //use different colour for each instacne - toggle on and off
     if(ImGui::Button("Use colour instances")){
         m_model.useColorInstances = !m_model.useColorInstances;
@@ -167,10 +433,105 @@ void Application::renderGUI() {
         m_model.loadTexture = !m_model.loadTexture;
     }
     
+    //level of detail for the instances
+    ImGui::Checkbox("LOD", &m_model.useLod);
+    ImGui::SameLine();
+    ImGui::SliderFloat("Pixel error", &m_model.lodPixelError, 0.1f, 10, "%.1f");
+    if (m_model.useLod && m_model.mesh.drawInstances) {
+        for (size_t l = 0; l < m_model.lods.level_counts.size(); ++l) {
+            ImGui::Text("LOD %d: %d instances, %d triangles each", int(l), int(m_model.lods.level_counts[l]), m_model.lods.levels[l].index_count / 3);
+        }
+    }
+
+    //meshlet culling for the single teapot
+    ImGui::Checkbox("Meshlet culling", &m_model.useMeshletCulling);
+    if (m_model.useMeshletCulling && !m_model.mesh.drawInstances) {
+        ImGui::SameLine();
+        ImGui::Text("%d / %d meshlets, %d triangles", int(m_model.meshletDraw.meshlets), int(m_model.meshlets.size()), int(m_model.meshletDraw.triangles));
+    }
+
+    //frustum culling for the instances
+    if (ImGui::Checkbox("Instance culling", &m_model.useInstanceCulling) && m_model.useInstanceCulling && m_boundsMoved) {
+        updateInstanceBounds();
+    }
+    ImGui::SameLine();
+    ImGui::SliderFloat("Min pixels", &m_model.cullPixelThreshold, 0, 20, "%.1f");
+    ImGui::Checkbox("GPU culling", &m_model.useGpuCulling);
+    if (m_model.useGpuCulling && m_model.mesh.drawInstances) {
+        ImGui::SameLine();
+        if (m_model.gpuCuller.last_drawn() < 0) ImGui::Text("%d tested, drawn count stays on the gpu", int(m_model.gpuCuller.last_tested()));
+        else ImGui::Text("%d tested, %d drawn (one frame behind)", int(m_model.gpuCuller.last_tested()), int(m_model.gpuCuller.last_drawn()));
+    }
+    else if (m_model.useInstanceCulling && m_model.mesh.drawInstances) {
+        const cull_stats &cs = m_model.cullStats;
+        ImGui::Text("%d visible, %d outside, %d too small (%.2f ms)", int(cs.visible), int(cs.frustum_culled), int(cs.small_culled), cs.ms);
+    }
+
+    //occlusion culling (on top of the instance culling)
+    ImGui::Checkbox("Occlusion culling", &m_model.useOcclusionCulling);
+    if (m_model.useOcclusionCulling && m_model.useInstanceCulling && !m_model.useGpuCulling && m_model.mesh.drawInstances && m_model.occlusion.levels() > 0) {
+        const occlusion_stats &os = m_model.occlusion.stats();
+        ImGui::SameLine();
+        int occluders = int(m_model.occlusionOptions.max_occluders);
+        if (ImGui::SliderInt("Occluders", &occluders, 1, 256)) m_model.occlusionOptions.max_occluders = size_t(occluders);
+        ImGui::Text("%d occluders, %d triangles (%.2f ms)", int(os.occluders), int(os.triangles), os.raster_ms);
+        ImGui::Text("%d of %d occluded (%.2f ms)", int(os.occluded), int(os.tested), os.test_ms);
+        ImGui::SliderInt("Depth level", &m_occlusionLevel, 0, m_model.occlusion.levels() - 1);
+        updateOcclusionTexture();
+        //rows are stored bottom up
+        float aspect = float(m_model.occlusion.level_height(m_occlusionLevel)) / m_model.occlusion.level_width(m_occlusionLevel);
+        ImGui::Image((void *)(intptr_t)m_occlusionTexture, ImVec2(256, 256 * aspect), ImVec2(0, 1), ImVec2(1, 0));
+    }
+
+    //picking
+    if (m_picked.hit()) {
+        ImGui::Text("Picked instance %d, triangle %d at %.2f (%.3f ms)", int(m_picked.instance), int(m_picked.triangle), m_picked.t, m_pickMs);
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) m_picked = ray_hit();
+    }
+    else {
+        ImGui::Text("Click a teapot to pick it");
+    }
+
+    //background loading
+    asset_stream_stats streaming = m_assets.stats();
+    if (m_assets.busy()) {
+        ImGui::Text("Streaming: %d decoding, %d uploading, %d done", int(streaming.decoding), int(streaming.uploading), int(streaming.resident));
+    }
+    ImGui::SliderInt("Upload KB/frame", &m_uploadBudgetKB, 64, 16384);
+    ImGui::Text("Uploaded %.1f KB last frame, %.2f MB total", streaming.bytes_last_update / 1024.0, streaming.bytes_total / (1024.0 * 1024.0));
+
+    //shared gpu resources
+    if (ImGui::CollapsingHeader("Resources")) {
+        const resource_registry &registry = resources();
+        ImGui::Text("Textures %.1f KB, buffers %.1f KB", registry.bytes(resource_kind::texture) / 1024.0, registry.bytes(resource_kind::buffer) / 1024.0);
+        for (const auto &r : registry.resources()) {
+            size_t slash = r.first.find_last_of("/\\");
+            string name = (slash == string::npos) ? r.first : r.first.substr(slash + 1);
+            ImGui::Text("%s %s: %.1f KB, %d refs", resource_kind_name(r.second.kind), name.c_str(), r.second.bytes / 1024.0, r.second.refs);
+        }
+        const program_reflection &program = reflection(m_model.shader);
+        ImGui::Text("Model shader: %d uniforms, %d uploads, %d unchanged and skipped", int(program.uniforms().size()), int(program.uploads()), int(program.skipped()));
+        const gl_state_stats &state = gl_state().last_frame();
+        ImGui::Text("GL state last frame: %d calls, %d unchanged and skipped", int(state.issued), int(state.eliminated));
+        ImGui::Text("Render queue: %d packets sorted in %.3f ms", int(m_renderQueue.size()), m_renderQueue.sort_ms());
+    }
+
     //draw bounding boxes - toggle on and off
     if(ImGui::Button("Draw bounding box")){
         m_showBoundingBox = !m_showBoundingBox;
+        if (m_showBoundingBox && m_boxesMoved) rebuildBoundingBoxes();
+    }
+    ImGui::SameLine();
+    bool tightBoxes = m_instanceBoxes.tight();
+    if (ImGui::Checkbox("Tight boxes", &tightBoxes)) {
+        m_instanceBoxes.set_tight(tightBoxes);
+        rebuildBoundingBoxes();
     }
+    ImGui::SameLine();
+    ImGui::Checkbox("Geometry shader", &m_boxBatch.use_geometry_shader);
+    ImGui::SameLine();
+    ImGui::Text("%d boxes (%.2f ms)", int(m_instanceBoxes.size()), m_instanceBoxes.ms());
     
 	// extra drawing parameters
 	ImGui::Checkbox("Show axis", &m_show_axis);
@@ -185,7 +546,34 @@ void Application::renderGUI() {
 }
 
 
+void Application::updateOcclusionTexture() {
+    const occlusion_buffer &occlusion = m_model.occlusion;
+    m_occlusionLevel = std::min(m_occlusionLevel, occlusion.levels() - 1);
+    const vector<float> &depth = occlusion.level(m_occlusionLevel);
+    int width = occlusion.level_width(m_occlusionLevel);
+    int height = occlusion.level_height(m_occlusionLevel);
+
+    //near is white and the far plane (or nothing drawn) black, stretched over the depths drawn
+    float nearest = 1;
+    for (float d : depth) nearest = std::min(nearest, d);
+    float scale = nearest < 1 ? 1 / (1 - nearest) : 0;
+    vector<unsigned char> pixels(depth.size() * 4);
+    for (size_t i = 0; i < depth.size(); i++) {
+        unsigned char v = (unsigned char)(255 * glm::clamp((1 - depth[i]) * scale, 0.f, 1.f));
+        pixels[4 * i] = pixels[4 * i + 1] = pixels[4 * i + 2] = v;
+        pixels[4 * i + 3] = 255;
+    }
+
+    if (!m_occlusionTexture) glGenTextures(1, &m_occlusionTexture);
+    gl_state().bind_texture(0, GL_TEXTURE_2D, m_occlusionTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+
 void Application::cursorPosCallback(double xpos, double ypos) {
+    m_mousePosition = vec2(xpos, ypos);
     double xmid = 500; double ymid = 350; //centre point in world
     if(ImGui::IsMouseDragging()){
         double xdiff = xpos - xmid;
@@ -197,7 +585,54 @@ void Application::cursorPosCallback(double xpos, double ypos) {
 
 
 void Application::mouseButtonCallback(int button, int action, int mods) {
-	(void)button, action, mods; // currently un-used
+	(void)mods; // currently un-used
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) pick();
+}
+
+
+void Application::pick() {
+    m_picked = ray_hit();
+    if (m_model.useProceduralInstances && m_model.mesh.drawInstances) {
+        //nothing to build a bvh over, every instance is tested (spread over the threads)
+        int width, height;
+        glfwGetWindowSize(m_window, &width, &height);
+        ray r = screen_ray(m_mousePosition, vec2(width, height), m_view * m_model.modelTransform, m_proj);
+        auto start = chrono::steady_clock::now();
+        if (m_meshBvh.triangles() > 0) m_picked = pick_procedural_ring(r, m_meshBvh, m_model.proceduralSeed, m_model.proceduralCount);
+        m_pickMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        return;
+    }
+    if (m_instanceBvh.size() == 0) return;
+    if (m_instancesMoved) {
+        m_instanceBvh.refit(m_model.instances.transforms);
+        m_instancesMoved = false;
+    }
+
+    //the ray under the mouse in the model's space (cursor positions are in window, not framebuffer, pixels)
+    int width, height;
+    glfwGetWindowSize(m_window, &width, &height);
+    ray r = screen_ray(m_mousePosition, vec2(width, height), m_view * m_model.modelTransform, m_proj);
+
+    auto start = chrono::steady_clock::now();
+    if (m_model.mesh.drawInstances) {
+        m_picked = m_instanceBvh.intersect(r, m_model.instances.transforms);
+    }
+    else {
+        //only the first instance is drawn
+        mat4 inv = inverse(m_model.instances.transforms[0]);
+        ray local;
+        local.origin = vec3(inv * vec4(r.origin, 1));
+        local.direction = vec3(inv * vec4(r.direction, 0));
+        float t;
+        uint32_t triangle;
+        if (m_meshBvh.intersect(local, numeric_limits<float>::infinity(), t, triangle)) {
+            m_picked.t = t;
+            m_picked.instance = 0;
+            m_picked.triangle = triangle;
+            m_picked.position = r.origin + t * r.direction;
+        }
+    }
+    m_pickMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 }
 
 
@@ -1,12 +1,23 @@
 
 #pragma once
 
+// std
+#include <memory>
+#include <vector>
+
 // glm
 #include <glm/glm.hpp>
 
 // project
 #include "opengl.hpp"
 #include "basic_model.hpp"
+#include "cgra/cgra_animation.hpp"
+#include "cgra/cgra_asset_stream.hpp"
+#include "cgra/cgra_bounds.hpp"
+#include "cgra/cgra_box_batch.hpp"
+#include "cgra/cgra_bvh.hpp"
+#include "cgra/cgra_procedural.hpp"
+#include "cgra/cgra_render_queue.hpp"
 
 
 // Main application class
@@ -30,14 +41,60 @@ private:
     
     //bounding box
     bool m_showBoundingBox = false;
-    glm::vec3 minV, maxV;
-    std::vector<cgra::gl_mesh> boundingBox_mesh;
+    cgra::instance_boxes m_instanceBoxes; // world boxes of the instances, from the model's box or hull
+    cgra::box_batch m_boxBatch; // draws all of them at once
+    bool m_boxesMoved = false; // the instances moved while the boxes were hidden
+
+    //instances of the model
+    int m_instanceCount = 100;
+    int m_instanceSeed = 1;
+
+    //instances made in the vertex shader instead (same seed), with nothing stored per instance
+    int m_proceduralCount = 10000000;
+    cgra::aabb m_proceduralBounds; // around all of them, from the cpu copy of the shader's formula
+
+    //animating the instances every frame, on a pool of m_animationThreads threads
+    bool m_animate = false;
+    std::vector<cgra::instance_motion> m_motions;
+    float m_animationTime = 0;
+    double m_lastFrameTime = 0;
+    int m_animationThreads = int(cgra::hardware_threads());
+    std::unique_ptr<cgra::task_pool> m_animationPool;
+    cgra::animation_stats m_animationStats;
+    std::vector<double> m_animationScaling; // ms by thread count - 1, from measureAnimationScaling
+    bool m_boundsMoved = false; // the instances moved while culling was off, the model's instanceBounds are stale
+
+    //picking instances with the mouse, through a bvh over the instances whose
+    //leaves are the bvh over the model's triangles
+    cgra::mesh_bvh m_meshBvh;
+    cgra::instance_bvh m_instanceBvh;
+    bool m_instancesMoved = false; // the bvh needs refitting before the next pick
+    cgra::ray_hit m_picked;
+    double m_pickMs = 0;
+    glm::vec2 m_mousePosition{0};
+    glm::mat4 m_view{1}, m_proj{1}; // camera of the last frame
+
+    //everything drawn in a frame, sorted by pass and state
+    cgra::render_queue m_renderQueue;
+
+    //debug view of the occlusion culling depth buffer
+    GLuint m_occlusionTexture = 0;
+    int m_occlusionLevel = 0;
 
 	// basic model
 	// contains a shader, a model transform
 	// a mesh, and other model information (color etc.)
 	basic_model m_model;
 
+    //phong shading, the same for everything drawn (see cgra::frame_uniforms)
+    glm::vec3 m_lightColor{0.8, 0.5, 1};
+    glm::vec3 m_specularColor{1, 1, 1};
+    float m_shininess = 20;
+
+	// background loading, assets appear as they finish uploading
+	cgra::asset_stream m_assets;
+	int m_uploadBudgetKB = 1024; // staged upload budget per frame
+
 public:
 	// setup
 	Application(GLFWwindow *);
@@ -56,7 +113,28 @@ public:
 	void scrollCallback(double xoffset, double yoffset);
 	void keyCallback(int key, int scancode, int action, int mods);
 	void charCallback(unsigned int c);
-    
-    //calculate bounding box method
-    void calculateBoundingBox(cgra::mesh_builder teapot, int transIndex);
+
+    //regenerates the model's instances from m_instanceCount and m_instanceSeed
+    void rebuildInstances();
+
+    //recomputes the instances' world boxes and the meshes drawn for them
+    void rebuildBoundingBoxes();
+
+    //passes m_proceduralCount and m_instanceSeed on to the model and finds their bounds
+    void rebuildProceduralInstances();
+
+    //moves the instances to where they are at this frame, straight into their gpu buffer
+    void animateInstances();
+
+    //recomputes the bounding spheres culling tests, from the model's bounds
+    void updateInstanceBounds();
+
+    //times animateInstances' update stage on 1 to every hardware thread
+    void measureAnimationScaling();
+
+    //picks the instance under the mouse
+    void pick();
+
+    //copies a level of the occlusion depth buffer into m_occlusionTexture for the gui
+    void updateOcclusionTexture();
 };
@@ -7,24 +7,29 @@
 
 // project
 #include "opengl.hpp"
+#include "cgra/cgra_culling.hpp"
+#include "cgra/cgra_gl_state.hpp"
+#include "cgra/cgra_gpu_culling.hpp"
+#include "cgra/cgra_instances.hpp"
+#include "cgra/cgra_lod.hpp"
 #include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_meshlet.hpp"
+#include "cgra/cgra_occlusion.hpp"
+#include "cgra/cgra_procedural.hpp"
+#include "cgra/cgra_shader.hpp"
 
 #include <string>
 
-#define U_TEXTURE 2 //texture binded to location 2 in vertex shader
-
 // Basic model that holds the shader, mesh and transform for drawing.
 // Can be copied and/or modified for adding in extra information for drawing
 // including colors for diffuse/specular, and textures for texture mapping etc.
 struct basic_model {
 	GLuint shader = 0;
 	cgra::gl_mesh mesh;
+	cgra::instance_set instances; // drawn when mesh.drawInstances is set, attach them to mesh first
 	glm::vec3 color;
 	glm::mat4 modelTransform{1.0};
-    //phong shading fields
-    glm::vec3 lightcolor;
-    glm::vec3 speccolor;
-    float shininess;
+    //the light and specular colours are the scene's, in cgra::frame_uniforms
     
     //bounding box
     //glm::mat4 boundingBox = glm::mat4(1.0f);
@@ -32,34 +37,159 @@ struct basic_model {
     //booleans to determine what type of colour the fragment shader should load
     bool loadTexture = false;
     bool useColorInstances = false;
+    GLuint texture = 0; // bound to unit 0 when loadTexture is set
+
+    //level of detail for the instances (same instances as mesh, one batch per level)
+    cgra::gl_lod_mesh lods;
+    bool useLod = false;
+    float lodPixelError = 1.0f; // largest error allowed on screen, in pixels
+
+    //meshlet culling for the single (non instanced) model, the meshlets must
+    //match the order of the mesh's index buffer (see build_meshlets)
+    std::vector<cgra::meshlet> meshlets;
+    cgra::meshlet_draw_list meshletDraw;
+    bool useMeshletCulling = false;
+
+    //frustum and small object culling of the instances, only the visible ones
+    //are uploaded and drawn (instanceBounds must match instances, see compute_instance_bounds)
+    cgra::instance_bounds instanceBounds;
+    bool useInstanceCulling = false;
+    float cullPixelThreshold = 1.0f; // instances smaller than this on screen are skipped
+    cgra::cull_stats cullStats;
+    std::vector<uint32_t> visibleInstances;
+    std::vector<glm::mat4> visibleTransforms;
+    std::vector<glm::vec3> visibleColors;
+    bool instancesCompacted = false; // mesh's instance buffers hold the visible instances, not instances
+
+    //occlusion culling of the instances left after frustum culling, the nearest are drawn
+    //with occluderMesh into a small cpu depth buffer that the rest are tested against
+    bool useOcclusionCulling = false;
+    cgra::occluder_mesh occluderMesh;
+    cgra::occlusion_options occlusionOptions;
+    cgra::occlusion_buffer occlusion;
+    cgra::aabb boundsBox; // the mesh's bounding box in object space
+
+    //the same culling done on the gpu with transform feedback, the instances are never read
+    //back (boundsCenter and boundsRadius are the mesh's bounding sphere in object space)
+    bool useGpuCulling = false;
+    cgra::gpu_instance_culler gpuCuller;
+    glm::vec3 boundsCenter{0.0f};
+    float boundsRadius = 0.0f;
 
-	void draw(const glm::mat4 &view, const glm::mat4 proj) {
+    //instances made by the vertex shader from their index (see cgra_procedural) instead of
+    //instances, nothing per instance is stored or uploaded. takes the place of LOD and culling
+    bool useProceduralInstances = false;
+    uint32_t proceduralSeed = 0;
+    uint32_t proceduralCount = 0;
+
+    //handles of shader's uniforms (see cgra::program_reflection), found again whenever shader changes
+    struct uniform_handles {
+        GLuint program = 0;
+        int model = -1, color = -1;
+        int texture = -1, loadTexture = -1, useColorInstances = -1;
+        int proceduralInstances = -1, instanceSeed = -1;
+    } uniforms;
+
+    void findUniforms(const cgra::program_reflection &program) {
+        uniforms.program = program.program();
+        uniforms.model = program.uniform("uModelMatrix");
+        uniforms.color = program.uniform("uColor");
+        uniforms.texture = program.uniform("u_texture");
+        uniforms.loadTexture = program.uniform("loadTexture");
+        uniforms.useColorInstances = program.uniform("useColorInstances");
+        uniforms.proceduralInstances = program.uniform("uProceduralInstances");
+        uniforms.instanceSeed = program.uniform("uInstanceSeed");
+    }
+
+	// viewportHeight (in pixels) sizes the instances on screen for culling and lod selection
+	void draw(const glm::mat4 &view, const glm::mat4 proj, float viewportHeight) {
 		using namespace glm;
 
 		// calculate the modelview transform
 		mat4 modelview = view * modelTransform;
 
-		// load shader and variables
-		glUseProgram(shader);
-		glUniformMatrix4fv(glGetUniformLocation(shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
-		glUniformMatrix4fv(glGetUniformLocation(shader, "uModelViewMatrix"), 1, false, value_ptr(modelview));
-		glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, value_ptr(color));
-        //phong shading uniforms
-        glUniform3fv(glGetUniformLocation(shader, "ulightcolor"), 1, value_ptr(lightcolor));
-        glUniform3fv(glGetUniformLocation(shader, "uspeccolor"), 1, value_ptr(speccolor));
-        glUniform1f(glGetUniformLocation(shader, "ushininess"), shininess);
+		// cull the instances on the gpu first, it uses its own program
+		bool procedural = useProceduralInstances && mesh.drawInstances && proceduralCount > 0;
+		bool lod = !procedural && useLod && mesh.drawInstances && !lods.levels.empty();
+		bool gpuCulling = !procedural && useGpuCulling && mesh.drawInstances && !lod && instances.transform_buffer;
+		if (gpuCulling) {
+			gpuCuller.cull(instances, boundsCenter, boundsRadius, modelview, proj, viewportHeight, cullPixelThreshold);
+		}
+
+		// load shader and variables, only the ones that changed since the last frame are uploaded
+		// (the camera and light are in the frame's uniforms, see cgra::update_frame_uniforms)
+		cgra::program_reflection &program = cgra::reflection(shader);
+		if (uniforms.program != shader) findUniforms(program);
+		cgra::gl_state().use_program(shader);
+		program.set(uniforms.model, modelTransform);
+		program.set(uniforms.color, color);
 
         //texture uniform
-        glUniform1i(U_TEXTURE, 0);
+        program.set(uniforms.texture, 0);
+        if (texture) cgra::gl_state().bind_texture(0, GL_TEXTURE_2D, texture);
         
         //bounding box
         //glUniformMatrix4fv(glGetUniformLocation(shader, "uBoundingBox"), 1, GL_FALSE, glm::value_ptr(boundingBox));
         
         //bools
-        glUniform1i(glGetUniformLocation(shader, "loadTexture"), loadTexture);
-        glUniform1i(glGetUniformLocation(shader, "useColorInstances"), useColorInstances);
+        program.set(uniforms.loadTexture, loadTexture);
+        program.set(uniforms.useColorInstances, useColorInstances);
+        program.set(uniforms.proceduralInstances, procedural);
+        program.set(uniforms.instanceSeed, unsigned(proceduralSeed));
         
+		// cull the instances
+		const std::vector<mat4> *drawTransforms = &instances.transforms;
+		const std::vector<vec3> *drawColors = &instances.colors;
+		bool culling = !procedural && !gpuCulling && useInstanceCulling && mesh.drawInstances && instanceBounds.size() == instances.size();
+		if (culling) {
+			cgra::cull_options options;
+			options.pixel_threshold = cullPixelThreshold;
+			cgra::cull_instances(instanceBounds, modelview, proj, viewportHeight, options, visibleInstances, &cullStats);
+			if (useOcclusionCulling && !occluderMesh.indices.empty() && !boundsBox.empty()) {
+				occlusion.render(occluderMesh, instances, visibleInstances, modelview, proj, occlusionOptions);
+				occlusion.cull(instances, boundsBox, visibleInstances);
+			}
+			cgra::gather_instances(instances, visibleInstances, visibleTransforms, visibleColors);
+			drawTransforms = &visibleTransforms;
+			drawColors = &visibleColors;
+		}
+		else if (procedural) {
+			// the shader can't be left reading instance buffers shorter than the instances
+			if (mesh.instanceVbo || mesh.colVbo) mesh.clear_instance_buffers();
+			instancesCompacted = true;
+		}
+		else if (instancesCompacted && !gpuCulling) {
+			// back to drawing the full set
+			instances.attach(mesh);
+			instancesCompacted = false;
+		}
+
 		// draw the mesh
-		mesh.draw(); 
+		if (procedural) {
+			mesh.draw_instanced(GLsizei(proceduralCount));
+		}
+		else if (lod) {
+			lods.select(*drawTransforms, *drawColors, modelview, proj, viewportHeight, lodPixelError);
+			lods.draw();
+		}
+		else if (culling) {
+			if (visibleTransforms.empty()) return;
+			mesh.update_instances(visibleTransforms.data(), visibleColors.data(), visibleTransforms.size(), instances.format);
+			instancesCompacted = true;
+			mesh.draw();
+		}
+		else if (gpuCulling) {
+			gpuCuller.draw(mesh);
+			instancesCompacted = true;
+		}
+		else if (useMeshletCulling && !mesh.drawInstances && !meshlets.empty()) {
+			mat4 instance = instances.transforms.empty() ? mat4(1) : instances.transforms[0];
+			size_t index_size = (mesh.index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+			cgra::cull_meshlets(meshlets, modelview * instance, proj, index_size, meshletDraw);
+			mesh.draw_ranges(meshletDraw.counts.data(), meshletDraw.offsets.data(), GLsizei(meshletDraw.counts.size()));
+		}
+		else {
+			mesh.draw();
+		}
 	}
 };
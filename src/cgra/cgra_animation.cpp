@@ -0,0 +1,106 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+// project
+#include "cgra_animation.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		static_assert(sizeof(instance_motion) == 32, "two instance motions to a cache line");
+
+		// instances per task, 64 KB of transforms (a mat4 is a cache line)
+		const size_t animation_chunk = 1024;
+
+		// a well mixed 32 bits from a seed and an index, so every instance's motion can be made
+		// on its own
+		uint32_t hash(uint32_t seed, uint32_t i) {
+			uint64_t x = (uint64_t(seed) << 32) | i;
+			x += 0x9e3779b97f4a7c15ull;
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+			return uint32_t(x ^ (x >> 31));
+		}
+
+		// in [0, 1)
+		float unit(uint32_t seed, uint32_t i) {
+			return float(hash(seed, i) >> 8) / float(1 << 24);
+		}
+	}
+
+
+	vector<instance_motion> make_instance_motions(const vector<mat4> &transforms, uint32_t seed) {
+		vector<instance_motion> motions(transforms.size());
+		for (size_t i = 0; i < motions.size(); ++i) {
+			const uint32_t k = uint32_t(i) * 4;
+			instance_motion &m = motions[i];
+			m.center = vec3(transforms[i][3]);
+			m.scale = length(vec3(transforms[i][0]));
+			m.orbit_radius = 0.5f + 2.5f * unit(seed, k);
+			m.orbit_speed = (0.5f + 1.5f * unit(seed, k + 1)) * (hash(seed, k + 2) & 1 ? 1 : -1);
+			m.spin_speed = 4 * unit(seed, k + 2) - 2;
+			m.phase = 6.2831853f * unit(seed, k + 3);
+		}
+		return motions;
+	}
+
+
+	mat4 motion_transform(const instance_motion &m, float time) {
+		const float orbit = m.phase + m.orbit_speed * time;
+		const float spin = m.phase + m.spin_speed * time;
+		const float c = std::cos(spin) * m.scale, s = std::sin(spin) * m.scale;
+		mat4 t;
+		t[0] = vec4(c, 0, -s, 0);
+		t[1] = vec4(0, m.scale, 0, 0);
+		t[2] = vec4(s, 0, c, 0);
+		t[3] = vec4(m.center + m.orbit_radius * vec3(std::cos(orbit), 0.25f * std::sin(2 * orbit), std::sin(orbit)), 1);
+		return t;
+	}
+
+
+	void animate_instances(const vector<instance_motion> &motions, float time, mat4 *transforms,
+		void *mapped, instance_format format, task_pool &pool, animation_stats *stats)
+	{
+		const auto start = chrono::steady_clock::now();
+		unsigned char *out = static_cast<unsigned char *>(mapped);
+		const size_t bytes = instance_transform_bytes(format);
+		const unsigned tasks = unsigned((motions.size() + animation_chunk - 1) / animation_chunk);
+		pool.run(tasks, [&](unsigned task) {
+			const size_t first = task * animation_chunk;
+			const size_t end = std::min(first + animation_chunk, motions.size());
+			for (size_t i = first; i < end; ++i) {
+				const instance_motion &m = motions[i];
+				const mat4 t = motion_transform(m, time);
+				transforms[i] = t;
+				if (!out) continue;
+				if (format == instance_format::pos_quat) {
+					// the spin is about y, so the quaternion is known without going through the matrix
+					const float half_spin = 0.5f * (m.phase + m.spin_speed * time);
+					const vec4 packed[2] = { vec4(vec3(t[3]), m.scale), vec4(0, std::sin(half_spin), 0, std::cos(half_spin)) };
+					memcpy(out + i * bytes, packed, sizeof(packed));
+				}
+				else {
+					pack_instance_transform(format, t, out + i * bytes);
+				}
+			}
+		});
+
+		if (stats) {
+			stats->instances = motions.size();
+			stats->tasks = tasks;
+			stats->threads = std::min(pool.size(), std::max(tasks, 1u));
+			stats->steals = pool.steals();
+			stats->ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_mesh.hpp"
+#include "cgra_parallel.hpp"
+
+
+namespace cgra {
+
+	// How an instance moves, everything its transform is made from at any time. 32 bytes, so
+	// two fit in a cache line
+	struct instance_motion {
+		glm::vec3 center;   // middle of the orbit
+		float scale;
+		float orbit_radius; // orbits around the y axis through center, bobbing up and down by a quarter of this
+		float orbit_speed;  // radians per second
+		float spin_speed;   // about the instance's own y axis, radians per second
+		float phase;        // radians along the orbit (and the spin) at time 0
+	};
+
+	// motions centred on where each instance is and keeping its size (transforms must be a
+	// uniform scale, rotation and translation, as make_ring_instances gives). the same seed
+	// always gives the same motions
+	std::vector<instance_motion> make_instance_motions(const std::vector<glm::mat4> &transforms, std::uint32_t seed);
+
+	// the transform of motion at time (in seconds)
+	glm::mat4 motion_transform(const instance_motion &motion, float time);
+
+
+	struct animation_stats {
+		size_t instances = 0;
+		unsigned tasks = 0;
+		unsigned threads = 0;
+		unsigned steals = 0; // tasks taken by a thread that ran out of its own
+		double ms = 0;
+	};
+
+	// Writes the transform of every motion at time to transforms, and to mapped as well in
+	// format if it isn't null (a mapped instance buffer, which is only written to, in order).
+	// The instances are split into tasks of whole cache lines of both motions and transforms,
+	// so no two threads ever write to the same line.
+	void animate_instances(const std::vector<instance_motion> &motions, float time, glm::mat4 *transforms,
+		void *mapped, instance_format format, task_pool &pool = default_task_pool(), animation_stats *stats = nullptr);
+}
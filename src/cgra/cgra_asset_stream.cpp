@@ -0,0 +1,362 @@
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+// project
+#include "cgra_asset_stream.hpp"
+#include "cgra_gl_state.hpp"
+#include "cgra_image.hpp"
+#include "cgra_resource.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	// something decoded by a worker, then uploaded a chunk at a time by update()
+	struct asset_stream::upload {
+		// exactly one of these is set
+		shared_ptr<streamed_texture> texture;
+		shared_ptr<streamed_mesh> mesh;
+
+		function<void(streamed_texture &)> on_texture;
+		function<void(streamed_mesh &)> on_mesh;
+
+		// decoded data, filled in by the worker
+		rgba_image image;
+		packed_mesh packed;
+		bool failed = false;
+
+		// upload progress, main thread only
+		bool ready = false; // already resident (shared through resources()), only the callback is left
+		bool started = false;
+		size_t done = 0; // bytes (meshes) or rows (textures) uploaded
+		GLuint gl_texture = 0;
+		gl_mesh gl_buffers;
+
+		bool complete() const {
+			if (texture) return done >= size_t(image.size.y);
+			return done >= packed.vertex_data.size() + packed.index_data.size();
+		}
+	};
+
+
+	asset_stream::asset_stream(unsigned threads, size_t staging_size, unsigned staging_count)
+		: m_slots(max(1u, staging_count)), m_slot_size(max<size_t>(staging_size, 4096)) {
+		if (threads == 0) {
+			unsigned hw = thread::hardware_concurrency();
+			threads = hw > 1 ? hw - 1 : 1;
+		}
+		for (unsigned i = 0; i < threads; i++)
+			m_workers.emplace_back([this] { worker(); });
+	}
+
+
+	asset_stream::~asset_stream() {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+			m_work.clear(); // anything not started yet is dropped
+		}
+		m_wake.notify_all();
+		for (thread &t : m_workers) t.join();
+	}
+
+
+	void asset_stream::worker() {
+		while (true) {
+			function<void()> work;
+			{
+				unique_lock<mutex> lock(m_mutex);
+				m_wake.wait(lock, [this] { return m_stop || !m_work.empty(); });
+				if (m_stop) return;
+				work = move(m_work.front());
+				m_work.pop_front();
+			}
+			work();
+		}
+	}
+
+
+	void asset_stream::enqueue(function<void()> work) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_work.push_back(move(work));
+			m_decoding++;
+		}
+		m_wake.notify_one();
+	}
+
+
+	void asset_stream::finished(unique_ptr<upload> u) {
+		lock_guard<mutex> lock(m_mutex);
+		m_decoded.push_back(move(u));
+		m_decoding--;
+	}
+
+
+	GLuint asset_stream::placeholder_texture() {
+		if (!m_placeholder) {
+			const unsigned char white[4] = {255, 255, 255, 255};
+			glGenTextures(1, &m_placeholder);
+			gl_state().bind_texture(0, GL_TEXTURE_2D, m_placeholder);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		}
+		return m_placeholder;
+	}
+
+
+	shared_ptr<streamed_texture> asset_stream::load_texture(const string &filename, function<void(streamed_texture &)> on_resident) {
+		auto tex = make_shared<streamed_texture>();
+		tex->filename = filename;
+		tex->texture = placeholder_texture();
+
+		// the upload is owned by the work item until the worker hands it back
+		auto u = make_shared<unique_ptr<upload>>(new upload());
+		(*u)->texture = tex;
+		(*u)->on_texture = move(on_resident);
+
+		// already loaded, skip the decode and upload
+		if (GLuint id = resources().acquire(filename)) {
+			gl_state().bind_texture(0, GL_TEXTURE_2D, id);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &tex->size.x);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &tex->size.y);
+			tex->texture = id;
+			tex->resident = true;
+			(*u)->ready = true;
+			m_uploads.push_back(move(*u));
+			return tex;
+		}
+		enqueue([this, u, filename] {
+			try {
+				(*u)->image = rgba_image(filename);
+			} catch (exception &) {
+				(*u)->failed = true; // rgba_image has already reported it
+			}
+			finished(move(*u));
+		});
+		return tex;
+	}
+
+
+	shared_ptr<streamed_mesh> asset_stream::load_mesh(function<packed_mesh()> load, function<void(streamed_mesh &)> on_resident) {
+		auto mesh = make_shared<streamed_mesh>();
+
+		auto u = make_shared<unique_ptr<upload>>(new upload());
+		(*u)->mesh = mesh;
+		(*u)->on_mesh = move(on_resident);
+		enqueue([this, u, load = move(load)] {
+			try {
+				(*u)->packed = load();
+			} catch (exception &e) {
+				cerr << "Error: Failed to load mesh: " << e.what() << endl;
+				(*u)->failed = true;
+			}
+			finished(move(*u));
+		});
+		return mesh;
+	}
+
+
+	void * asset_stream::acquire_slot(GLenum target, size_t size) {
+		staging_slot &slot = m_slots[m_next_slot];
+
+		// never wait here, if the gpu hasn't finished with the oldest copy try again next frame
+		if (slot.fence) {
+			if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) return nullptr;
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+		}
+
+		if (!slot.buffer) glGenBuffers(1, &slot.buffer);
+		gl_state().bind_buffer(target, slot.buffer);
+		if (slot.capacity < size) {
+			slot.capacity = max(size, m_slot_size);
+			glBufferData(target, slot.capacity, nullptr, GL_STREAM_COPY);
+		}
+
+		// the fence guarantees nothing is reading this buffer any more
+		return glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+
+
+	void asset_stream::release_slot(GLenum target) {
+		staging_slot &slot = m_slots[m_next_slot];
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gl_state().bind_buffer(target, 0);
+		m_next_slot = (m_next_slot + 1) % m_slots.size();
+	}
+
+
+	void asset_stream::start(upload &u) {
+		u.started = true;
+		if (u.texture) {
+			glGenTextures(1, &u.gl_texture);
+			gl_state().bind_texture(0, GL_TEXTURE_2D, u.gl_texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, u.image.wrap.x);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, u.image.wrap.y);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, u.image.size.x, u.image.size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		} else {
+			// allocate only, the data is copied in from the staging buffers
+			u.gl_buffers = build_gl_mesh(u.packed, nullptr, nullptr);
+		}
+	}
+
+
+	size_t asset_stream::upload_chunk(upload &u) {
+		if (u.texture) {
+			size_t row_bytes = size_t(u.image.size.x) * 4;
+			size_t rows = min(max<size_t>(m_slot_size / row_bytes, 1), size_t(u.image.size.y) - u.done);
+			size_t bytes = rows * row_bytes;
+
+			void *dst = acquire_slot(GL_PIXEL_UNPACK_BUFFER, bytes);
+			if (!dst) return 0;
+			memcpy(dst, u.image.data.data() + u.done * row_bytes, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			// with a pixel unpack buffer bound the data pointer is an offset into it
+			gl_state().bind_texture(0, GL_TEXTURE_2D, u.gl_texture);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, GLint(u.done), u.image.size.x, GLsizei(rows), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			release_slot(GL_PIXEL_UNPACK_BUFFER); // unbinds it, or later texture uploads would read from it
+
+			u.done += rows;
+			return bytes;
+		}
+
+		// vertex data then index data, as one stream of bytes
+		size_t vertex_bytes = u.packed.vertex_data.size();
+		bool indices = u.done >= vertex_bytes;
+		const vector<unsigned char> &src = indices ? u.packed.index_data : u.packed.vertex_data;
+		size_t offset = indices ? u.done - vertex_bytes : u.done;
+		size_t bytes = min(m_slot_size, src.size() - offset);
+
+		void *dst = acquire_slot(GL_COPY_READ_BUFFER, bytes);
+		if (!dst) return 0;
+		memcpy(dst, src.data() + offset, bytes);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+
+		// binding to copy write leaves the vao's element array binding alone
+		gl_state().bind_buffer(GL_COPY_WRITE_BUFFER, indices ? u.gl_buffers.ibo : u.gl_buffers.vbo);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, bytes);
+		release_slot(GL_COPY_READ_BUFFER);
+
+		u.done += bytes;
+		return bytes;
+	}
+
+
+	void asset_stream::finish(upload &u) {
+		if (u.texture) {
+			streamed_texture &tex = *u.texture;
+			if (u.failed) {
+				tex.failed = true;
+			} else if (!u.ready) {
+				gl_state().bind_texture(0, GL_TEXTURE_2D, u.gl_texture);
+				glGenerateMipmap(GL_TEXTURE_2D);
+				// register it so later loads of the same file share it
+				tex.texture = resources().adopt(tex.filename, resource_kind::texture, u.gl_texture, u.image.data.size() * 4 / 3);
+				tex.size = u.image.size;
+				tex.resident = true;
+				u.gl_texture = 0;
+			}
+			if (u.on_texture) u.on_texture(tex);
+		} else {
+			streamed_mesh &mesh = *u.mesh;
+			if (u.failed) {
+				mesh.failed = true;
+			} else {
+				mesh.mesh = u.gl_buffers;
+				mesh.resident = true;
+				u.gl_buffers = gl_mesh();
+			}
+			if (u.on_mesh) u.on_mesh(mesh);
+		}
+		m_resident++;
+	}
+
+
+	void asset_stream::update(size_t budget_bytes) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			for (auto &u : m_decoded) m_uploads.push_back(move(u));
+			m_decoded.clear();
+		}
+
+		size_t sent = 0;
+		while (!m_uploads.empty()) {
+			upload &u = *m_uploads.front();
+			if (!u.failed && !u.ready) {
+				if (!u.started) start(u);
+				if (!u.complete()) {
+					if (sent > 0 && sent >= budget_bytes) break;
+					size_t bytes = upload_chunk(u);
+					if (!bytes) break; // staging buffers are all still in use
+					sent += bytes;
+					if (!u.complete()) continue;
+				}
+			}
+
+			// take it off the queue before the callback, which may queue more
+			unique_ptr<upload> done = move(m_uploads.front());
+			m_uploads.pop_front();
+			finish(*done);
+		}
+
+		m_bytes_last_update = sent;
+		m_bytes_total += sent;
+	}
+
+
+	bool asset_stream::busy() const {
+		lock_guard<mutex> lock(m_mutex);
+		return m_decoding > 0 || !m_decoded.empty() || !m_uploads.empty();
+	}
+
+
+	asset_stream_stats asset_stream::stats() const {
+		asset_stream_stats s;
+		{
+			lock_guard<mutex> lock(m_mutex);
+			s.decoding = m_decoding;
+			s.uploading = m_decoded.size();
+		}
+		s.uploading += m_uploads.size();
+		s.resident = m_resident;
+		s.bytes_last_update = m_bytes_last_update;
+		s.bytes_total = m_bytes_total;
+		return s;
+	}
+
+
+	void asset_stream::destroy() {
+		for (auto &u : m_uploads) {
+			if (u->gl_texture) {
+				gl_state().forget_texture(u->gl_texture);
+				glDeleteTextures(1, &u->gl_texture);
+			}
+			if (u->gl_buffers.vao) u->gl_buffers.destroy();
+		}
+		m_uploads.clear();
+
+		for (staging_slot &slot : m_slots) {
+			if (slot.fence) glDeleteSync(slot.fence);
+			gl_state().forget_buffer(slot.buffer);
+			glDeleteBuffers(1, &slot.buffer);
+			slot = staging_slot();
+		}
+
+		gl_state().forget_texture(m_placeholder);
+		glDeleteTextures(1, &m_placeholder);
+		m_placeholder = 0;
+	}
+}
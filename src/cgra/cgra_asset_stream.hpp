@@ -0,0 +1,135 @@
+#pragma once
+
+// std
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+#include "cgra_mesh.hpp"
+
+
+namespace cgra {
+
+	// A texture being streamed in. texture is the stream's placeholder (1x1 white)
+	// until the whole image is on the gpu, then it is the real texture.
+	struct streamed_texture {
+		std::string filename;
+		GLuint texture = 0;
+		glm::ivec2 size{0};
+		bool resident = false;
+		bool failed = false;
+	};
+
+	// A mesh being streamed in. mesh is empty (vao 0, draws nothing) until resident, draw a
+	// stand in until then (eg. a box_mesh of its bounds).
+	struct streamed_mesh {
+		gl_mesh mesh;
+		bool resident = false;
+		bool failed = false;
+	};
+
+	struct asset_stream_stats {
+		size_t decoding = 0;     // queued for or running on a worker
+		size_t uploading = 0;    // decoded, waiting for or part way through upload
+		size_t resident = 0;     // finished (or failed)
+		size_t bytes_last_update = 0;
+		size_t bytes_total = 0;
+	};
+
+
+	// Loads assets in the background so the first frame doesn't wait for them.
+	//
+	// Worker threads parse and decode (anything that doesn't touch gl). The decoded data is
+	// then copied to the gpu from the main thread by update(), at most a byte budget per call,
+	// through a ring of staging buffers: each chunk is written into a mapped staging buffer and
+	// copied on the gpu (glCopyBufferSubData for meshes, a pixel unpack buffer and
+	// glTexSubImage2D for textures). A fence per staging buffer stops a buffer being rewritten
+	// before the gpu has finished copying out of it, and update() stops early rather than wait.
+	//
+	// Must be used from the thread that owns the gl context (apart from the workers it starts).
+	// The on_resident callbacks run on the main thread inside update().
+	// Gl objects are only freed by destroy(), which needs the context to still be current.
+	class asset_stream {
+	public:
+		// threads = 0 uses every hardware thread but one (at least one)
+		explicit asset_stream(unsigned threads = 0, size_t staging_size = size_t(1) << 20, unsigned staging_count = 4);
+		~asset_stream();
+
+		asset_stream(const asset_stream &) = delete;
+		asset_stream & operator=(const asset_stream &) = delete;
+
+		// decodes an image file on a worker and uploads it with mipmaps. the texture is shared
+		// by file name through resources() and holds one reference (release it by file name)
+		std::shared_ptr<streamed_texture> load_texture(const std::string &filename,
+			std::function<void(streamed_texture &)> on_resident = {});
+
+		// runs load on a worker (it must not make gl calls, see pack_mesh) and uploads the result
+		std::shared_ptr<streamed_mesh> load_mesh(std::function<packed_mesh()> load,
+			std::function<void(streamed_mesh &)> on_resident = {});
+
+		// main thread, once per frame: uploads up to budget_bytes (at least one chunk)
+		void update(size_t budget_bytes);
+
+		// true while anything is still decoding or uploading
+		bool busy() const;
+
+		asset_stream_stats stats() const;
+
+		// 1x1 white texture streamed_texture::texture holds until the real one is resident
+		GLuint placeholder_texture();
+
+		// deletes the staging buffers, the placeholder and anything not yet resident
+		void destroy();
+
+	private:
+		struct upload;
+
+		struct staging_slot {
+			GLuint buffer = 0;
+			size_t capacity = 0;
+			GLsync fence = 0; // set when the gpu may still be reading from buffer
+		};
+
+		// workers
+		std::vector<std::thread> m_workers;
+		mutable std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::deque<std::function<void()>> m_work;
+		std::vector<std::unique_ptr<upload>> m_decoded; // finished by workers, not yet picked up
+		size_t m_decoding = 0;
+		bool m_stop = false;
+
+		// main thread only
+		std::deque<std::unique_ptr<upload>> m_uploads;
+		std::vector<staging_slot> m_slots;
+		size_t m_slot_size = 0;
+		size_t m_next_slot = 0;
+		GLuint m_placeholder = 0;
+		size_t m_resident = 0;
+		size_t m_bytes_last_update = 0;
+		size_t m_bytes_total = 0;
+
+		void worker();
+		void enqueue(std::function<void()> work);
+		void finished(std::unique_ptr<upload> u);
+
+		// a free staging buffer mapped for writing to target, or nullptr if the next one is still in use
+		void * acquire_slot(GLenum target, size_t size);
+		void release_slot(GLenum target);
+
+		// uploads one chunk, returns the bytes sent or 0 if it has to wait for a staging buffer
+		size_t upload_chunk(upload &u);
+		void start(upload &u);
+		void finish(upload &u);
+	};
+}
@@ -0,0 +1,309 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <unordered_set>
+
+// project
+#include "cgra_bounds.hpp"
+#include "cgra_simd.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		using namespace simd;
+
+		// instances per update task
+		const size_t update_chunk = 4096;
+
+		// a face of the hull being built, wound counterclockwise seen from outside
+		struct hull_face {
+			uint32_t v[3];
+			vec3 normal; // unit length, pointing out
+			float offset;
+			bool alive;
+
+			float distance(const vec3 &p) const { return dot(normal, p) - offset; }
+		};
+
+		void make_face(const vector<vec3> &points, uint32_t a, uint32_t b, uint32_t c, hull_face &f) {
+			const vec3 n = cross(points[b] - points[a], points[c] - points[a]);
+			const float l = length(n);
+			f.v[0] = a;
+			f.v[1] = b;
+			f.v[2] = c;
+			f.normal = (l > 0) ? n / l : vec3(0);
+			f.offset = dot(f.normal, points[a]);
+			f.alive = true;
+		}
+
+		uint64_t edge_key(uint32_t a, uint32_t b) { return (uint64_t(a) << 32) | b; }
+
+
+		// boxes of the instances through the center and half size of local, a vector of
+		// instances at a time
+		void transform_boxes(const aabb &local, const mat4 *transforms, size_t count, aabb *out) {
+			if (local.empty()) {
+				for (size_t k = 0; k < count; ++k) out[k] = local;
+				return;
+			}
+
+			const int w = vfloat::width;
+			const vec3 c = local.center(), e = (local.max - local.min) * 0.5f;
+			const vfloat cx(c.x), cy(c.y), cz(c.z), ex(e.x), ey(e.y), ez(e.z);
+			alignas(32) float m[12][w];
+			alignas(32) float r[6][w];
+
+			size_t k = 0;
+			for (; k + w <= count; k += w) {
+				for (int l = 0; l < w; ++l) {
+					const mat4 &t = transforms[k + l];
+					for (int j = 0; j < 4; ++j) {
+						m[j * 3 + 0][l] = t[j][0];
+						m[j * 3 + 1][l] = t[j][1];
+						m[j * 3 + 2][l] = t[j][2];
+					}
+				}
+				for (int i = 0; i < 3; ++i) {
+					const vfloat m0 = vfloat::load(m[i]), m1 = vfloat::load(m[3 + i]), m2 = vfloat::load(m[6 + i]);
+					const vfloat center = vfloat::load(m[9 + i]) + m0 * cx + m1 * cy + m2 * cz;
+					const vfloat extent = vabs(m0) * ex + vabs(m1) * ey + vabs(m2) * ez;
+					(center - extent).store(r[i]);
+					(center + extent).store(r[3 + i]);
+				}
+				for (int l = 0; l < w; ++l) {
+					aabb &b = out[k + l];
+					b.min = vec3(r[0][l], r[1][l], r[2][l]);
+					b.max = vec3(r[3][l], r[4][l], r[5][l]);
+				}
+			}
+			for (; k < count; ++k) out[k] = transform_aabb(local, transforms[k]);
+		}
+	}
+
+
+	aabb mesh_aabb(const mesh_builder &mb) {
+		aabb box;
+		for (const mesh_vertex &v : mb.vertices) box.extend(v.pos);
+		return box;
+	}
+
+
+	mesh_builder box_mesh(const aabb &box) {
+		mesh_builder mb;
+		for (int axis = 0; axis < 3; axis++) {
+			// u cross v is the axis, so the corners in uv order go counterclockwise seen from the
+			// max side and clockwise from the min side
+			const int u = (axis + 1) % 3;
+			const int v = (axis + 2) % 3;
+			for (int side = 0; side < 2; side++) {
+				const GLuint first = GLuint(mb.vertices.size());
+				for (int corner = 0; corner < 4; corner++) {
+					const vec2 uv(float(corner == 1 || corner == 2), float(corner >= 2));
+					mesh_vertex vertex;
+					vertex.pos[axis] = side ? box.max[axis] : box.min[axis];
+					vertex.pos[u] = box.min[u] + (box.max[u] - box.min[u]) * uv.x;
+					vertex.pos[v] = box.min[v] + (box.max[v] - box.min[v]) * uv.y;
+					vertex.norm[axis] = side ? 1.0f : -1.0f;
+					vertex.uv = uv;
+					mb.push_vertex(vertex);
+				}
+				const GLuint quad[2][6] = { { 0, 2, 1, 0, 3, 2 }, { 0, 1, 2, 0, 2, 3 } };
+				for (GLuint i : quad[side]) mb.push_index(first + i);
+			}
+		}
+		return mb;
+	}
+
+
+	vector<vec3> convex_hull_vertices(const mesh_builder &mb) {
+		vector<vec3> points(mb.vertices.size());
+		for (size_t i = 0; i < points.size(); ++i) points[i] = mb.vertices[i].pos;
+		return convex_hull_vertices(points);
+	}
+
+
+	// Incremental hull: start from a tetrahedron of far apart points, then for each point outside
+	// the hull so far remove the faces it can see and join the edge of the hole to it. Points
+	// within eps of the hull are skipped while building and picked up by the check at the end.
+	vector<vec3> convex_hull_vertices(const vector<vec3> &points) {
+		const size_t n = points.size();
+		if (n < 4) return points;
+
+		aabb box;
+		for (const vec3 &p : points) box.extend(p);
+		const vec3 size = box.max - box.min;
+		const float eps = std::max(size.x, std::max(size.y, size.z)) * 1e-6f;
+
+		// the starting tetrahedron: the extremes in x, the point furthest from the line between
+		// them and the point furthest from the plane of those three
+		uint32_t t[4] = { 0, 0, 0, 0 };
+		for (uint32_t i = 0; i < n; ++i) {
+			if (points[i].x < points[t[0]].x) t[0] = i;
+			if (points[i].x > points[t[1]].x) t[1] = i;
+		}
+		const vec3 axis = points[t[1]] - points[t[0]];
+		float best = 0;
+		for (uint32_t i = 0; i < n; ++i) {
+			const float d = length(cross(axis, points[i] - points[t[0]]));
+			if (d > best) { best = d; t[2] = i; }
+		}
+		if (!(length(axis) > eps) || !(best > eps * length(axis))) return points;
+		hull_face base;
+		make_face(points, t[0], t[1], t[2], base);
+		best = 0;
+		for (uint32_t i = 0; i < n; ++i) {
+			const float d = std::abs(base.distance(points[i]));
+			if (d > best) { best = d; t[3] = i; }
+		}
+		if (!(best > eps)) return points;
+
+		vector<hull_face> faces;
+		const vec3 inside = (points[t[0]] + points[t[1]] + points[t[2]] + points[t[3]]) * 0.25f;
+		const int tetrahedron[4][3] = { { 0, 1, 2 }, { 0, 3, 1 }, { 1, 3, 2 }, { 2, 3, 0 } };
+		for (const auto &tf : tetrahedron) {
+			hull_face f;
+			make_face(points, t[tf[0]], t[tf[1]], t[tf[2]], f);
+			if (f.distance(inside) > 0) make_face(points, t[tf[0]], t[tf[2]], t[tf[1]], f);
+			faces.push_back(f);
+		}
+
+		// random order keeps the number of faces made and removed small
+		vector<uint32_t> order(n);
+		for (uint32_t i = 0; i < n; ++i) order[i] = i;
+		shuffle(order.begin(), order.end(), mt19937(1));
+
+		unordered_set<uint64_t> edges;
+		vector<uint32_t> horizon;
+		size_t alive = faces.size();
+		for (uint32_t p : order) {
+			const vec3 &point = points[p];
+			edges.clear();
+			for (hull_face &f : faces) {
+				if (!f.alive || !(f.distance(point) > eps)) continue;
+				f.alive = false;
+				--alive;
+				for (int e = 0; e < 3; ++e) edges.insert(edge_key(f.v[e], f.v[(e + 1) % 3]));
+			}
+			if (edges.empty()) continue;
+
+			// the edges of the hole are the ones whose other face stayed
+			horizon.clear();
+			for (uint64_t e : edges) {
+				const uint32_t a = uint32_t(e >> 32), b = uint32_t(e);
+				if (!edges.count(edge_key(b, a))) {
+					horizon.push_back(a);
+					horizon.push_back(b);
+				}
+			}
+			for (size_t e = 0; e < horizon.size(); e += 2) {
+				hull_face f;
+				make_face(points, horizon[e], horizon[e + 1], p, f);
+				faces.push_back(f);
+				++alive;
+			}
+
+			if (faces.size() > 2 * alive + 64) {
+				faces.erase(remove_if(faces.begin(), faces.end(), [](const hull_face &f) { return !f.alive; }), faces.end());
+			}
+		}
+
+		// the hull's corners, and anything at all outside its faces so the extremes of the mesh
+		// are never lost to rounding. a face that came out degenerate means the hull can't be
+		// trusted, so then every point is kept
+		vector<bool> keep(n, false);
+		for (const hull_face &f : faces) {
+			if (!f.alive) continue;
+			if (f.normal == vec3(0)) return points;
+			for (uint32_t v : f.v) keep[v] = true;
+		}
+		vector<vec3> hull;
+		for (uint32_t i = 0; i < n; ++i) {
+			if (!keep[i]) {
+				for (const hull_face &f : faces) {
+					if (f.alive && f.distance(points[i]) > 0) { keep[i] = true; break; }
+				}
+			}
+			if (keep[i]) hull.push_back(points[i]);
+		}
+		return hull;
+	}
+
+
+	void transform_aabbs(const aabb &local, const mat4 *transforms, size_t count, aabb *out) {
+		transform_boxes(local, transforms, count, out);
+	}
+
+
+	void instance_boxes::set_mesh(const aabb &local, vector<vec3> hull) {
+		m_local = local;
+		m_hull = std::move(hull);
+		m_tight = m_tight && !m_hull.empty();
+
+		// padded with copies of the first vertex, which change nothing
+		const size_t w = vfloat::width;
+		m_hull_stride = (m_hull.size() + w - 1) / w * w;
+		m_hull_soa.assign(3 * m_hull_stride, 0.f);
+		for (size_t i = 0; i < m_hull_stride; ++i) {
+			const vec3 &p = m_hull[i < m_hull.size() ? i : 0];
+			m_hull_soa[i] = p.x;
+			m_hull_soa[m_hull_stride + i] = p.y;
+			m_hull_soa[2 * m_hull_stride + i] = p.z;
+		}
+	}
+
+
+	void instance_boxes::compute(const mat4 *transforms, size_t first, size_t count) {
+		if (!m_tight) {
+			transform_boxes(m_local, transforms + first, count, m_boxes.data() + first);
+			return;
+		}
+
+		const int w = vfloat::width;
+		const float inf = numeric_limits<float>::infinity();
+		const float *hx = m_hull_soa.data(), *hy = hx + m_hull_stride, *hz = hy + m_hull_stride;
+		alignas(32) float lanes[6][w];
+		for (size_t i = first; i < first + count; ++i) {
+			const mat4 &t = transforms[i];
+			vfloat lo[3] = { vfloat(inf), vfloat(inf), vfloat(inf) };
+			vfloat hi[3] = { vfloat(-inf), vfloat(-inf), vfloat(-inf) };
+			for (size_t v = 0; v < m_hull_stride; v += w) {
+				const vfloat x = vfloat::loadu(hx + v), y = vfloat::loadu(hy + v), z = vfloat::loadu(hz + v);
+				for (int c = 0; c < 3; ++c) {
+					const vfloat p = vfloat(t[0][c]) * x + vfloat(t[1][c]) * y + vfloat(t[2][c]) * z;
+					lo[c] = vmin(lo[c], p);
+					hi[c] = vmax(hi[c], p);
+				}
+			}
+			aabb &b = m_boxes[i];
+			for (int c = 0; c < 3; ++c) {
+				lo[c].storeu(lanes[c]);
+				hi[c].storeu(lanes[3 + c]);
+				b.min[c] = *min_element(lanes[c], lanes[c] + w) + t[3][c];
+				b.max[c] = *max_element(lanes[3 + c], lanes[3 + c] + w) + t[3][c];
+			}
+		}
+	}
+
+
+	void instance_boxes::update(const vector<mat4> &transforms, task_pool &pool) {
+		const auto start = chrono::steady_clock::now();
+		m_boxes.resize(transforms.size());
+		const unsigned chunks = unsigned((transforms.size() + update_chunk - 1) / update_chunk);
+		const auto task = [&](unsigned c) {
+			const size_t first = c * update_chunk;
+			compute(transforms.data(), first, std::min(update_chunk, transforms.size() - first));
+		};
+		if (chunks > 1 && pool.size() > 1) pool.run(chunks, task);
+		else for (unsigned c = 0; c < chunks; ++c) task(c);
+		m_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+}
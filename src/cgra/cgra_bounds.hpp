@@ -0,0 +1,75 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_bvh.hpp"
+#include "cgra_mesh.hpp"
+#include "cgra_parallel.hpp"
+
+
+namespace cgra {
+
+	// box around every vertex of mb
+	aabb mesh_aabb(const mesh_builder &mb);
+
+	// a closed box with a flat normal and the whole texture on each face, for standing in for
+	// a mesh that is still loading
+	mesh_builder box_mesh(const aabb &box);
+
+	// the vertices of mb on its convex hull (plus any that are only just inside it), the only ones
+	// that can be the extremes of the mesh in any direction, whatever the transform. a flat or
+	// tiny mesh gives back all its vertices
+	std::vector<glm::vec3> convex_hull_vertices(const mesh_builder &mb);
+	std::vector<glm::vec3> convex_hull_vertices(const std::vector<glm::vec3> &points);
+
+	// out[i] = transform_aabb(local, transforms[i]), SSE/AVX wide over the instances
+	void transform_aabbs(const aabb &local, const glm::mat4 *transforms, size_t count, aabb *out);
+
+
+	// World boxes of every instance of a mesh, from work done once per mesh rather than once per
+	// instance.
+	//
+	// By default each box is the mesh's local box through the instance transform, which costs
+	// the same however big the mesh is but can be loose for rotated instances (the box of a
+	// rotated box). Tight boxes transform the mesh's convex hull vertices instead, giving the
+	// exact box of the transformed mesh for a cost that grows with the size of the hull.
+	class instance_boxes {
+	public:
+		instance_boxes() { }
+
+		// local is the box of the mesh, hull its convex_hull_vertices (only needed for tight boxes)
+		void set_mesh(const aabb &local, std::vector<glm::vec3> hull);
+
+		// switching recomputes nothing, call update() afterwards
+		void set_tight(bool tight) { m_tight = tight && !m_hull.empty(); }
+		bool tight() const { return m_tight; }
+
+		// recomputes every box, resizing to the number of transforms
+		void update(const std::vector<glm::mat4> &transforms, task_pool &pool = default_task_pool());
+
+		size_t size() const { return m_boxes.size(); }
+		const std::vector<aabb> & boxes() const { return m_boxes; }
+		const aabb & local_box() const { return m_local; }
+		const std::vector<glm::vec3> & hull() const { return m_hull; }
+
+		// time taken by the last update
+		double ms() const { return m_ms; }
+
+	private:
+		aabb m_local;
+		std::vector<glm::vec3> m_hull;
+		std::vector<float> m_hull_soa; // x, y and z rows of the hull, padded to the simd width
+		size_t m_hull_stride = 0;
+		bool m_tight = false;
+		std::vector<aabb> m_boxes;
+		double m_ms = 0;
+
+		// the boxes of instances [first, first + count)
+		void compute(const glm::mat4 *transforms, size_t first, size_t count);
+	};
+}
@@ -0,0 +1,245 @@
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+// project
+#include "cgra_box_batch.hpp"
+#include "cgra_frame_uniforms.hpp"
+#include "cgra_gl_state.hpp"
+#include "cgra_resource.hpp"
+#include "cgra_shader.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		// a unit cube corner per vertex, the box's min and size per instance
+		const char *lines_shader_source = R"(
+	#version 330 core
+	uniform mat4 uModelMatrix;
+	uniform vec3 uColor;
+#ifdef _VERTEX_
+	layout(location = 0) in vec3 aCorner;
+	layout(location = 1) in vec3 aMin;
+	layout(location = 2) in vec3 aSize;
+	void main() {
+		gl_Position = uViewProjection * uModelMatrix * vec4(aMin + aCorner * aSize, 1.0);
+	}
+#endif
+#ifdef _FRAGMENT_
+	out vec3 f_color;
+	void main() {
+		gl_FragDepth = gl_FragCoord.z - 0.000001;
+		f_color = uColor;
+	}
+#endif)";
+
+		// a point per box, expanded to its edges
+		const char *points_shader_source = R"(
+	#version 330 core
+	uniform mat4 uModelMatrix;
+	uniform vec3 uColor;
+#ifdef _VERTEX_
+	layout(location = 1) in vec3 aMin;
+	layout(location = 2) in vec3 aSize;
+	out vec3 v_min;
+	out vec3 v_size;
+	void main() {
+		v_min = aMin;
+		v_size = aSize;
+	}
+#endif
+#ifdef _GEOMETRY_
+	layout(points) in;
+	layout(line_strip, max_vertices = 24) out;
+	in vec3 v_min[];
+	in vec3 v_size[];
+	// the corners differing in one bit (bit 0 x, bit 1 y, bit 2 z)
+	const ivec2 edges[] = ivec2[](
+		ivec2(0, 1), ivec2(2, 3), ivec2(4, 5), ivec2(6, 7),
+		ivec2(0, 2), ivec2(1, 3), ivec2(4, 6), ivec2(5, 7),
+		ivec2(0, 4), ivec2(1, 5), ivec2(2, 6), ivec2(3, 7)
+	);
+	void main() {
+		mat4 mvp = uViewProjection * uModelMatrix;
+		vec4 corners[8];
+		for (int i = 0; i < 8; i++) {
+			corners[i] = mvp * vec4(v_min[0] + v_size[0] * vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1), 1.0);
+		}
+		for (int e = 0; e < 12; e++) {
+			gl_Position = corners[edges[e].x];
+			EmitVertex();
+			gl_Position = corners[edges[e].y];
+			EmitVertex();
+			EndPrimitive();
+		}
+	}
+#endif
+#ifdef _FRAGMENT_
+	out vec3 f_color;
+	void main() {
+		gl_FragDepth = gl_FragCoord.z - 0.000001;
+		f_color = uColor;
+	}
+#endif)";
+
+		// a program and the handles of its uniforms
+		struct box_shader {
+			GLuint program = 0;
+			int model = -1;
+			int color = -1;
+		};
+
+		box_shader build_shader(const char *shader_source, bool geometry) {
+			const string source = with_frame_uniforms(shader_source);
+			shader_builder prog;
+			prog.set_shader_source(GL_VERTEX_SHADER, source);
+			if (geometry) prog.set_shader_source(GL_GEOMETRY_SHADER, source);
+			prog.set_shader_source(GL_FRAGMENT_SHADER, source);
+			box_shader shader;
+			shader.program = prog.build();
+			shader.model = reflection(shader.program).uniform("uModelMatrix");
+			shader.color = reflection(shader.program).uniform("uColor");
+			return shader;
+		}
+
+		// shared by every batch, built on first use
+		box_shader & batch_shader(bool geometry) {
+			static box_shader lines_shader;
+			static box_shader points_shader;
+			if (geometry) {
+				if (!points_shader.program) points_shader = build_shader(points_shader_source, true);
+				return points_shader;
+			}
+			if (!lines_shader.program) lines_shader = build_shader(lines_shader_source, false);
+			return lines_shader;
+		}
+
+		// every batch's buffer gets its own key in resources()
+		unsigned next_batch_id = 0;
+	}
+
+
+	void box_batch::init() {
+		if (m_lines_vao) return;
+
+		const string key = "box_batch/" + to_string(next_batch_id++) + "/boxes";
+		m_boxes = resources().acquire_buffer(key, GL_ARRAY_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+
+		// unit cube, corner i has bit 0 for x, bit 1 for y and bit 2 for z
+		vec3 corners[8];
+		for (int i = 0; i < 8; ++i) corners[i] = vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+		const uint8_t edges[24] = {
+			0, 1, 2, 3, 4, 5, 6, 7,
+			0, 2, 1, 3, 4, 6, 5, 7,
+			0, 4, 1, 5, 2, 6, 3, 7
+		};
+		glGenBuffers(1, &m_cube_vbo);
+		glGenBuffers(1, &m_cube_ibo);
+
+		// both paths read the boxes as per box attributes 1 and 2, per instance for the
+		// lines and per vertex for the points
+		glGenVertexArrays(1, &m_lines_vao);
+		gl_state().bind_vertex_array(m_lines_vao);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, m_cube_vbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)(0));
+		gl_state().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, m_cube_ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(edges), edges, GL_STATIC_DRAW);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, m_boxes);
+		for (int i = 0; i < 2; ++i) {
+			glEnableVertexAttribArray(1 + i);
+			glVertexAttribPointer(1 + i, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(vec3), (void *)(i * sizeof(vec3)));
+			glVertexAttribDivisor(1 + i, 1);
+		}
+
+		glGenVertexArrays(1, &m_points_vao);
+		gl_state().bind_vertex_array(m_points_vao);
+		for (int i = 0; i < 2; ++i) {
+			glEnableVertexAttribArray(1 + i);
+			glVertexAttribPointer(1 + i, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(vec3), (void *)(i * sizeof(vec3)));
+		}
+
+		gl_state().bind_vertex_array(0);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, 0);
+		gl_state().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+
+	void box_batch::upload(const aabb *boxes, size_t count) {
+		init();
+
+		m_staging.resize(2 * count);
+		for (size_t i = 0; i < count; ++i) {
+			const aabb &b = boxes[i];
+			m_staging[2 * i] = b.empty() ? vec3(0) : b.min;
+			m_staging[2 * i + 1] = b.empty() ? vec3(0) : b.max - b.min;
+		}
+
+		const size_t bytes = m_staging.size() * sizeof(vec3);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, m_boxes);
+		if (count > m_capacity) {
+			m_capacity = count;
+			glBufferData(GL_ARRAY_BUFFER, bytes, m_staging.data(), GL_DYNAMIC_DRAW);
+			resources().set_bytes(resource_kind::buffer, m_boxes, bytes);
+		}
+		else if (bytes > 0) {
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, m_staging.data());
+		}
+		m_count = count;
+	}
+
+
+	void box_batch::draw(const mat4 &model, const vec3 &color, size_t count) {
+		count = std::min(count, m_count);
+		if (count == 0) return;
+
+		const box_shader &shader = batch_shader(use_geometry_shader);
+
+		// the camera comes from the frame's uniforms
+		program_reflection &program = reflection(shader.program);
+		gl_state().use_program(shader.program);
+		program.set(shader.model, model);
+		program.set(shader.color, color);
+
+		if (use_geometry_shader) {
+			gl_state().bind_vertex_array(m_points_vao);
+			glDrawArrays(GL_POINTS, 0, GLsizei(count));
+		}
+		else {
+			gl_state().bind_vertex_array(m_lines_vao);
+			glDrawElementsInstanced(GL_LINES, 24, GL_UNSIGNED_BYTE, 0, GLsizei(count));
+		}
+	}
+
+
+	GLuint box_batch::program() const {
+		return batch_shader(use_geometry_shader).program;
+	}
+
+
+	void box_batch::destroy() {
+		if (m_boxes) resources().release(resource_kind::buffer, m_boxes);
+		gl_state().forget_buffer(m_cube_vbo);
+		gl_state().forget_buffer(m_cube_ibo);
+		gl_state().forget_vertex_array(m_lines_vao);
+		gl_state().forget_vertex_array(m_points_vao);
+		glDeleteBuffers(1, &m_cube_vbo);
+		glDeleteBuffers(1, &m_cube_ibo);
+		glDeleteVertexArrays(1, &m_lines_vao);
+		glDeleteVertexArrays(1, &m_points_vao);
+		m_boxes = m_cube_vbo = m_cube_ibo = 0;
+		m_lines_vao = m_points_vao = 0;
+		m_count = m_capacity = 0;
+		m_staging.clear();
+		m_staging.shrink_to_fit();
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// std
+#include <limits>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+#include "cgra_bvh.hpp"
+
+
+namespace cgra {
+
+	// Draws the edges of any number of boxes with a single draw call.
+	//
+	// Each box is stored once on the gpu as its min corner and size (24 bytes). By default the
+	// boxes are instances of a unit cube line mesh, scaled and moved into place in the vertex
+	// shader. With use_geometry_shader each box is a single point instead and a geometry shader
+	// emits its 12 edges (as drawBox does), so no mesh is needed at all.
+	class box_batch {
+	public:
+		bool use_geometry_shader = false;
+
+		box_batch() { }
+		box_batch(const box_batch &) = delete;
+		box_batch & operator=(const box_batch &) = delete;
+
+		// replaces the boxes, the buffer only grows when there are more of them than ever before.
+		// empty boxes are drawn as a point at the origin
+		void upload(const aabb *boxes, size_t count);
+		void upload(const std::vector<aabb> &boxes) { upload(boxes.data(), boxes.size()); }
+
+		// draws the first count boxes (in the space model takes to world space) straight to the
+		// current framebuffer with the camera of the frame's uniforms, just in front of the surface
+		void draw(const glm::mat4 &model, const glm::vec3 &color, size_t count = std::numeric_limits<size_t>::max());
+
+		size_t size() const { return m_count; }
+
+		// the program and vertex array draw() uses, for sorting its draws by state (see
+		// render_queue::make_key). the vertex array is 0 until the first upload
+		GLuint program() const;
+		GLuint vertex_array() const { return use_geometry_shader ? m_points_vao : m_lines_vao; }
+
+		// deletes the gl objects, the shaders are shared and stay
+		void destroy();
+
+	private:
+		GLuint m_boxes = 0; // shared through resources() so it shows up there
+		GLuint m_cube_vbo = 0;
+		GLuint m_cube_ibo = 0;
+		GLuint m_lines_vao = 0;
+		GLuint m_points_vao = 0;
+		size_t m_count = 0;
+		size_t m_capacity = 0;
+		std::vector<glm::vec3> m_staging; // min and size of each box
+
+		void init();
+	};
+}
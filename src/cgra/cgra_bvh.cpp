@@ -0,0 +1,488 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+
+// project
+#include "cgra_bvh.hpp"
+#include "cgra_bounds.hpp"
+#include "cgra_simd.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		using namespace simd;
+
+		const int sah_bins = 16;
+
+		// past this depth nodes are split at the median, so the tree (and the traversal
+		// stack) stays shallow however badly the boxes are distributed
+		const uint32_t max_sah_depth = 40;
+
+		// enough for 8 children at every level of the deepest tree build() makes
+		const int traversal_stack = 1024;
+
+		const uint32_t no_parent = numeric_limits<uint32_t>::max();
+
+		// the binary tree build() starts with before it is collapsed
+		struct build_node {
+			aabb box;
+			uint32_t left = 0, right = 0;
+			uint32_t first = 0, count = 0; // primitives of a leaf, count is 0 for inner nodes
+		};
+
+		// primitives are moved around with their boxes while building, so each split reads memory in order
+		struct build_primitive {
+			aabb box;
+			vec3 center;
+			uint32_t index;
+		};
+
+		struct build_task {
+			uint32_t node, first, count, depth;
+		};
+
+		struct traversal_entry {
+			int32_t node;   // node, or first primitive of a leaf
+			uint32_t count; // primitives of a leaf, 0 for a node
+			float t;        // where the ray enters its box
+		};
+
+		int bin_of(float c, float min, float scale, int bins) {
+			return std::min(bins - 1, int((c - min) * scale));
+		}
+	}
+
+
+	aabb transform_aabb(const aabb &box, const mat4 &transform) {
+		if (box.empty()) return box;
+		aabb out;
+		out.min = out.max = vec3(transform[3]);
+		for (int j = 0; j < 3; ++j) {
+			for (int i = 0; i < 3; ++i) {
+				const float a = transform[j][i] * box.min[j];
+				const float b = transform[j][i] * box.max[j];
+				out.min[i] += std::min(a, b);
+				out.max[i] += std::max(a, b);
+			}
+		}
+		return out;
+	}
+
+
+	ray screen_ray(const vec2 &point, const vec2 &window_size, const mat4 &view, const mat4 &proj) {
+		const vec2 ndc(2 * point.x / window_size.x - 1, 1 - 2 * point.y / window_size.y);
+		const mat4 inv = inverse(proj * view);
+		const vec4 near_point = inv * vec4(ndc.x, ndc.y, -1, 1);
+		const vec4 far_point = inv * vec4(ndc.x, ndc.y, 1, 1);
+		ray r;
+		r.origin = vec3(near_point) / near_point.w;
+		r.direction = vec3(far_point) / far_point.w - r.origin;
+		return r;
+	}
+
+
+	void bvh::build(vector<aabb> boxes, uint32_t max_leaf) {
+		m_boxes = std::move(boxes);
+		m_nodes.clear();
+		m_primitives.clear();
+		m_leaf.clear();
+		m_parent.clear();
+		const uint32_t n = uint32_t(m_boxes.size());
+		if (n == 0) return;
+		max_leaf = std::max(max_leaf, 1u);
+
+		vector<build_primitive> prims(n);
+		for (uint32_t i = 0; i < n; ++i) prims[i] = { m_boxes[i], m_boxes[i].center(), i };
+
+		// binary tree by binned SAH
+		vector<build_node> tree(1);
+		tree.reserve(2 * (n / max_leaf) + 2);
+		vector<build_task> tasks{ { 0, 0, n, 0 } };
+		while (!tasks.empty()) {
+			const build_task task = tasks.back();
+			tasks.pop_back();
+			build_primitive *begin = prims.data() + task.first;
+			build_primitive *end = begin + task.count;
+
+			aabb box, center_box;
+			for (const build_primitive *p = begin; p != end; ++p) {
+				box.extend(p->box);
+				center_box.extend(p->center);
+			}
+			tree[task.node].box = box;
+
+			// cheapest split between bins (costs relative to intersecting one primitive)
+			const vec3 extent = center_box.max - center_box.min;
+			int best_axis = -1, best_bin = 0, best_bins = sah_bins;
+			float best_cost = numeric_limits<float>::infinity();
+			if (task.count > 1 && task.depth < max_sah_depth) {
+				// all three axes are binned in one pass, small nodes use fewer bins
+				const int bins = int(std::min<uint32_t>(sah_bins, task.count));
+				vec3 scale;
+				for (int axis = 0; axis < 3; ++axis) scale[axis] = extent[axis] > 0 ? bins / extent[axis] : 0.f;
+				aabb bin_box[3][sah_bins];
+				uint32_t bin_count[3][sah_bins] = {};
+				for (const build_primitive *p = begin; p != end; ++p) {
+					for (int axis = 0; axis < 3; ++axis) {
+						const int b = bin_of(p->center[axis], center_box.min[axis], scale[axis], bins);
+						bin_box[axis][b].extend(p->box);
+						bin_count[axis][b]++;
+					}
+				}
+				for (int axis = 0; axis < 3; ++axis) {
+					if (!(extent[axis] > 0)) continue;
+					float right_area[sah_bins];
+					uint32_t right_count[sah_bins];
+					aabb right;
+					uint32_t count = 0;
+					for (int b = bins - 1; b > 0; --b) {
+						right.extend(bin_box[axis][b]);
+						count += bin_count[axis][b];
+						right_area[b] = right.area();
+						right_count[b] = count;
+					}
+					aabb left;
+					count = 0;
+					for (int b = 0; b < bins - 1; ++b) {
+						left.extend(bin_box[axis][b]);
+						count += bin_count[axis][b];
+						const float cost = left.area() * count + right_area[b + 1] * right_count[b + 1];
+						if (count > 0 && right_count[b + 1] > 0 && cost < best_cost) {
+							best_cost = cost;
+							best_axis = axis;
+							best_bin = b;
+							best_bins = bins;
+						}
+					}
+				}
+			}
+
+			const float area = box.area();
+			const float split_cost = 1 + (area > 0 ? best_cost / area : 0);
+			if (task.count <= max_leaf && (best_axis < 0 || split_cost >= float(task.count))) {
+				tree[task.node].first = task.first;
+				tree[task.node].count = task.count;
+				continue;
+			}
+
+			build_primitive *mid = begin;
+			if (best_axis >= 0) {
+				const float scale = best_bins / extent[best_axis];
+				const float min = center_box.min[best_axis];
+				mid = partition(begin, end, [&](const build_primitive &p) { return bin_of(p.center[best_axis], min, scale, best_bins) <= best_bin; });
+			}
+			if (mid == begin || mid == end) {
+				// no useful split (or too deep), halve along the longest axis
+				mid = begin + task.count / 2;
+				const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+				if (extent[axis] > 0) {
+					nth_element(begin, mid, end, [&](const build_primitive &a, const build_primitive &b) { return a.center[axis] < b.center[axis]; });
+				}
+			}
+
+			const uint32_t left = uint32_t(tree.size());
+			tree.resize(tree.size() + 2);
+			tree[task.node].left = left;
+			tree[task.node].right = left + 1;
+			const uint32_t left_count = uint32_t(mid - begin);
+			tasks.push_back({ left, task.first, left_count, task.depth + 1 });
+			tasks.push_back({ left + 1, task.first + left_count, task.count - left_count, task.depth + 1 });
+		}
+
+		m_primitives.resize(n);
+		for (uint32_t i = 0; i < n; ++i) m_primitives[i] = prims[i].index;
+		prims = vector<build_primitive>();
+
+		// collapse into nodes of up to 8 children, opening the largest child until they are full
+		m_leaf.resize(n);
+		vector<pair<uint32_t, uint32_t>> collapse{ { 0, no_parent } }; // binary node, parent slot
+		while (!collapse.empty()) {
+			const uint32_t b = collapse.back().first;
+			const uint32_t parent = collapse.back().second;
+			collapse.pop_back();
+
+			const uint32_t w = uint32_t(m_nodes.size());
+			m_nodes.emplace_back();
+			m_parent.push_back(parent);
+			if (parent != no_parent) m_nodes[parent / width].child[parent % width] = int32_t(w);
+
+			uint32_t children[width] = { b };
+			int child_count = 1;
+			while (child_count < width) {
+				int open = -1;
+				float open_area = -1;
+				for (int c = 0; c < child_count; ++c) {
+					const build_node &bn = tree[children[c]];
+					if (bn.count == 0 && bn.box.area() > open_area) {
+						open = c;
+						open_area = bn.box.area();
+					}
+				}
+				if (open < 0) break;
+				const build_node &bn = tree[children[open]];
+				children[open] = bn.left;
+				children[child_count++] = bn.right;
+			}
+
+			node &wn = m_nodes[w];
+			for (int s = 0; s < width; ++s) {
+				const build_node *bn = (s < child_count) ? &tree[children[s]] : nullptr;
+				const aabb box = bn ? bn->box : aabb();
+				wn.min_x[s] = box.min.x;
+				wn.min_y[s] = box.min.y;
+				wn.min_z[s] = box.min.z;
+				wn.max_x[s] = box.max.x;
+				wn.max_y[s] = box.max.y;
+				wn.max_z[s] = box.max.z;
+				wn.child[s] = -1;
+				wn.count[s] = 0;
+				if (!bn) continue;
+				if (bn->count > 0) {
+					wn.child[s] = int32_t(bn->first);
+					wn.count[s] = bn->count;
+					for (uint32_t p = bn->first; p < bn->first + bn->count; ++p) {
+						m_leaf[m_primitives[p]] = w * width + s;
+					}
+				}
+				else {
+					collapse.push_back({ children[s], w * width + s });
+				}
+			}
+		}
+	}
+
+
+	aabb bvh::leaf_bounds(uint32_t n, int slot) const {
+		aabb box;
+		const node &nd = m_nodes[n];
+		for (uint32_t p = uint32_t(nd.child[slot]); p < uint32_t(nd.child[slot]) + nd.count[slot]; ++p) {
+			box.extend(m_boxes[m_primitives[p]]);
+		}
+		return box;
+	}
+
+
+	aabb bvh::node_bounds(uint32_t n) const {
+		aabb box;
+		const node &nd = m_nodes[n];
+		for (int s = 0; s < width; ++s) {
+			if (nd.child[s] < 0) continue;
+			box.extend(vec3(nd.min_x[s], nd.min_y[s], nd.min_z[s]));
+			box.extend(vec3(nd.max_x[s], nd.max_y[s], nd.max_z[s]));
+		}
+		return box;
+	}
+
+
+	bool bvh::set_slot(uint32_t n, int slot, const aabb &box) {
+		node &nd = m_nodes[n];
+		if (nd.min_x[slot] == box.min.x && nd.min_y[slot] == box.min.y && nd.min_z[slot] == box.min.z &&
+			nd.max_x[slot] == box.max.x && nd.max_y[slot] == box.max.y && nd.max_z[slot] == box.max.z) return false;
+		nd.min_x[slot] = box.min.x;
+		nd.min_y[slot] = box.min.y;
+		nd.min_z[slot] = box.min.z;
+		nd.max_x[slot] = box.max.x;
+		nd.max_y[slot] = box.max.y;
+		nd.max_z[slot] = box.max.z;
+		return true;
+	}
+
+
+	void bvh::update(uint32_t i, const aabb &box) {
+		m_boxes[i] = box;
+		uint32_t n = m_leaf[i] / width;
+		if (!set_slot(n, m_leaf[i] % width, leaf_bounds(n, m_leaf[i] % width))) return;
+		// stop as soon as a node's box doesn't change, nothing above it will either
+		while (m_parent[n] != no_parent) {
+			const uint32_t parent = m_parent[n];
+			if (!set_slot(parent / width, parent % width, node_bounds(n))) return;
+			n = parent / width;
+		}
+	}
+
+
+	void bvh::refit(vector<aabb> boxes) {
+		m_boxes = std::move(boxes);
+		// children come after their parents, so going backwards they are always done first
+		for (size_t n = m_nodes.size(); n-- > 0;) {
+			const node &nd = m_nodes[n];
+			for (int s = 0; s < width; ++s) {
+				if (nd.count[s] > 0) set_slot(uint32_t(n), s, leaf_bounds(uint32_t(n), s));
+				else if (nd.child[s] >= 0) set_slot(uint32_t(n), s, node_bounds(uint32_t(nd.child[s])));
+			}
+		}
+	}
+
+
+	aabb bvh::bounds() const {
+		return m_nodes.empty() ? aabb() : node_bounds(0);
+	}
+
+
+	float bvh::traverse(const ray &r, float t_max, const leaf_function &leaf) const {
+		if (m_nodes.empty()) return t_max;
+
+		// slab tests as box * inv - origin * inv, with the near and far planes picked by the
+		// direction's signs up front. empty slots (min > max) always miss
+		vec3 inv;
+		for (int a = 0; a < 3; ++a) {
+			const float d = r.direction[a];
+			inv[a] = 1.f / (std::fabs(d) < 1e-30f ? (d < 0 ? -1e-30f : 1e-30f) : d);
+		}
+		const vfloat ix(inv.x), iy(inv.y), iz(inv.z);
+		const vfloat ox(r.origin.x * inv.x), oy(r.origin.y * inv.y), oz(r.origin.z * inv.z);
+		const vfloat zero(0.f);
+		const bool neg_x = inv.x < 0, neg_y = inv.y < 0, neg_z = inv.z < 0;
+		const int lane_mask = (1 << vfloat::width) - 1;
+
+		traversal_entry stack[traversal_stack];
+		int top = 0;
+		stack[top++] = { 0, 0, 0.f };
+		alignas(32) float t_near[width];
+
+		while (top > 0) {
+			const traversal_entry e = stack[--top];
+			if (e.t > t_max) continue;
+			if (e.count > 0) {
+				t_max = leaf(&m_primitives[e.node], e.count, t_max);
+				continue;
+			}
+
+			const node &nd = m_nodes[e.node];
+			const float *near_x = neg_x ? nd.max_x : nd.min_x, *far_x = neg_x ? nd.min_x : nd.max_x;
+			const float *near_y = neg_y ? nd.max_y : nd.min_y, *far_y = neg_y ? nd.min_y : nd.max_y;
+			const float *near_z = neg_z ? nd.max_z : nd.min_z, *far_z = neg_z ? nd.min_z : nd.max_z;
+			const vfloat tm(t_max);
+			int hits = 0;
+			for (int k = 0; k < width; k += vfloat::width) {
+				const vfloat tn = vmax(vmax(vfloat::load(near_x + k) * ix - ox, vfloat::load(near_y + k) * iy - oy),
+					vmax(vfloat::load(near_z + k) * iz - oz, zero));
+				const vfloat tf = vmin(vmin(vfloat::load(far_x + k) * ix - ox, vfloat::load(far_y + k) * iy - oy),
+					vmin(vfloat::load(far_z + k) * iz - oz, tm));
+				tn.store(t_near + k);
+				hits |= (~vbits(vgreater(tn, tf)) & lane_mask) << k;
+			}
+
+			// push the children that were hit farthest first, so the nearest is visited next
+			traversal_entry found[width];
+			int found_count = 0;
+			for (int s = 0; s < width; ++s) {
+				if (!((hits >> s) & 1)) continue;
+				const traversal_entry c = { nd.child[s], nd.count[s], t_near[s] };
+				int i = found_count++;
+				for (; i > 0 && found[i - 1].t < c.t; --i) found[i] = found[i - 1];
+				found[i] = c;
+			}
+			for (int i = 0; i < found_count; ++i) stack[top++] = found[i];
+		}
+		return t_max;
+	}
+
+
+	void mesh_bvh::build(const mesh_builder &mb) {
+		m_positions.resize(mb.vertices.size());
+		for (size_t i = 0; i < mb.vertices.size(); ++i) m_positions[i] = mb.vertices[i].pos;
+		m_indices.assign(mb.indices.begin(), mb.indices.end());
+		m_indices.resize(m_indices.size() / 3 * 3);
+
+		vector<aabb> boxes(m_indices.size() / 3);
+		for (size_t t = 0; t < boxes.size(); ++t) {
+			for (int k = 0; k < 3; ++k) boxes[t].extend(m_positions[m_indices[3 * t + k]]);
+		}
+		m_tree.build(std::move(boxes), 4);
+	}
+
+
+	bool mesh_bvh::intersect(const ray &r, float t_max, float &t, uint32_t &triangle) const {
+		uint32_t hit = ray_hit::none;
+		const float t_hit = m_tree.traverse(r, t_max, [&](const uint32_t *primitives, uint32_t count, float tm) {
+			for (uint32_t i = 0; i < count; ++i) {
+				// Moller-Trumbore, either side of the triangle
+				const uint32_t tri = primitives[i];
+				const vec3 &a = m_positions[m_indices[3 * tri]];
+				const vec3 e1 = m_positions[m_indices[3 * tri + 1]] - a;
+				const vec3 e2 = m_positions[m_indices[3 * tri + 2]] - a;
+				const vec3 p = cross(r.direction, e2);
+				const float det = dot(e1, p);
+				if (det == 0) continue;
+				const float inv_det = 1 / det;
+				const vec3 s = r.origin - a;
+				const float u = dot(s, p) * inv_det;
+				if (u < 0 || u > 1) continue;
+				const vec3 q = cross(s, e1);
+				const float v = dot(r.direction, q) * inv_det;
+				if (v < 0 || u + v > 1) continue;
+				const float d = dot(e2, q) * inv_det;
+				if (d > 0 && d < tm) {
+					tm = d;
+					hit = tri;
+				}
+			}
+			return tm;
+		});
+		if (hit == ray_hit::none) return false;
+		t = t_hit;
+		triangle = hit;
+		return true;
+	}
+
+
+	vector<aabb> instance_bvh::instance_boxes(const vector<mat4> &transforms) const {
+		vector<aabb> boxes(transforms.size());
+		transform_aabbs(m_mesh->bounds(), transforms.data(), transforms.size(), boxes.data());
+		return boxes;
+	}
+
+
+	void instance_bvh::build(const mesh_bvh &mesh, const vector<mat4> &transforms) {
+		m_mesh = &mesh;
+		// every leaf means walking a mesh_bvh, so keep them small
+		m_tree.build(instance_boxes(transforms), 2);
+	}
+
+
+	void instance_bvh::update(const vector<mat4> &transforms, size_t first, size_t count) {
+		const aabb local = m_mesh->bounds();
+		for (size_t i = first; i < first + count; ++i) {
+			m_tree.update(uint32_t(i), transform_aabb(local, transforms[i]));
+		}
+	}
+
+
+	void instance_bvh::refit(const vector<mat4> &transforms) {
+		m_tree.refit(instance_boxes(transforms));
+	}
+
+
+	ray_hit instance_bvh::intersect(const ray &r, const vector<mat4> &transforms) const {
+		ray_hit hit;
+		if (!m_mesh) return hit;
+		hit.t = m_tree.traverse(r, numeric_limits<float>::infinity(), [&](const uint32_t *primitives, uint32_t count, float tm) {
+			for (uint32_t i = 0; i < count; ++i) {
+				// the ray in object space, with the direction unnormalized so t means the same
+				const mat4 inv = inverse(transforms[primitives[i]]);
+				ray local;
+				local.origin = vec3(inv * vec4(r.origin, 1));
+				local.direction = vec3(inv * vec4(r.direction, 0));
+				float t;
+				uint32_t triangle;
+				if (m_mesh->intersect(local, tm, t, triangle)) {
+					tm = t;
+					hit.instance = primitives[i];
+					hit.triangle = triangle;
+				}
+			}
+			return tm;
+		});
+		if (hit.hit()) hit.position = r.origin + hit.t * r.direction;
+		else hit.t = numeric_limits<float>::infinity();
+		return hit;
+	}
+}
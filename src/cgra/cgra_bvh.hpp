@@ -0,0 +1,169 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_mesh.hpp"
+
+
+namespace cgra {
+
+	// Axis aligned box, empty (min > max) until something is added
+	struct aabb {
+		glm::vec3 min{std::numeric_limits<float>::infinity()};
+		glm::vec3 max{-std::numeric_limits<float>::infinity()};
+
+		bool empty() const { return min.x > max.x; }
+		glm::vec3 center() const { return (min + max) * 0.5f; }
+		float area() const {
+			if (empty()) return 0;
+			const glm::vec3 d = max - min;
+			return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+		}
+		void extend(const glm::vec3 &p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void extend(const aabb &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	};
+
+	// box around box after transform (Arvo's method, the box of the transformed box's corners)
+	aabb transform_aabb(const aabb &box, const glm::mat4 &transform);
+
+
+	// hits are points origin + t * direction with t > 0, direction doesn't need to be normalized
+	struct ray {
+		glm::vec3 origin{0};
+		glm::vec3 direction{0, 0, -1};
+	};
+
+	// ray from the camera through a point of the window (in window coordinates, origin at the
+	// top left as glfw gives them) in the space view takes to view space
+	ray screen_ray(const glm::vec2 &point, const glm::vec2 &window_size, const glm::mat4 &view, const glm::mat4 &proj);
+
+
+	// Bounding volume hierarchy over a set of boxes (primitives), the building block of mesh_bvh
+	// and instance_bvh.
+	//
+	// A binary tree is built by binned SAH and then collapsed so each node has up to 8 children,
+	// whose boxes are stored as separate arrays so a ray is tested against all of them together
+	// with SSE/AVX slab tests. Children are visited nearest first and anything beyond the closest
+	// hit so far is skipped.
+	class bvh {
+	public:
+		static const int width = 8;
+
+		struct alignas(32) node {
+			float min_x[width], min_y[width], min_z[width];
+			float max_x[width], max_y[width], max_z[width];
+			// leaf: count primitives starting at child in primitives(), otherwise the child node
+			// (or -1 for an unused slot, whose box is empty)
+			std::int32_t child[width];
+			std::uint32_t count[width];
+		};
+
+		// called for each leaf the ray reaches before t_max with its primitives, returns the new
+		// t_max (the closest hit so far, or t_max unchanged)
+		using leaf_function = std::function<float(const std::uint32_t *primitives, std::uint32_t count, float t_max)>;
+
+		bvh() { }
+
+		// max_leaf is the most primitives a leaf may hold, smaller leaves are used when the SAH
+		// says they are cheaper
+		void build(std::vector<aabb> boxes, std::uint32_t max_leaf = 4);
+
+		// moves primitive i to box, growing or shrinking only the nodes above it. the tree stays
+		// valid but gets slower to traverse the further things move from where they were built
+		void update(std::uint32_t i, const aabb &box);
+
+		// recomputes every node from the primitive boxes (after many updates)
+		void refit(std::vector<aabb> boxes);
+
+		// visits the leaves the ray passes through, nearest first, returns the final t_max
+		float traverse(const ray &r, float t_max, const leaf_function &leaf) const;
+
+		size_t size() const { return m_boxes.size(); }
+		const aabb & box(std::uint32_t i) const { return m_boxes[i]; }
+		aabb bounds() const;
+		const std::vector<node> & nodes() const { return m_nodes; }
+		const std::vector<std::uint32_t> & primitives() const { return m_primitives; }
+
+	private:
+		std::vector<node> m_nodes;                 // parents always come before their children
+		std::vector<aabb> m_boxes;                 // by primitive
+		std::vector<std::uint32_t> m_primitives;   // primitive indices, each leaf is a range
+		std::vector<std::uint32_t> m_leaf;         // node * width + slot of each primitive's leaf
+		std::vector<std::uint32_t> m_parent;       // node * width + slot pointing at each node
+
+		aabb leaf_bounds(std::uint32_t node, int slot) const;
+		aabb node_bounds(std::uint32_t node) const;
+		bool set_slot(std::uint32_t node, int slot, const aabb &box);
+	};
+
+
+	// Bvh over the triangles of a mesh (the bottom level for picking), built once per mesh
+	class mesh_bvh {
+	public:
+		mesh_bvh() { }
+
+		// mb must be a GL_TRIANGLES mesh
+		void build(const mesh_builder &mb);
+
+		// closest triangle hit before t_max, returns false (leaving t and triangle alone) if none
+		bool intersect(const ray &r, float t_max, float &t, std::uint32_t &triangle) const;
+
+		size_t triangles() const { return m_indices.size() / 3; }
+		aabb bounds() const { return m_tree.bounds(); }
+		const bvh & tree() const { return m_tree; }
+
+	private:
+		bvh m_tree;
+		std::vector<glm::vec3> m_positions;
+		std::vector<std::uint32_t> m_indices;
+	};
+
+
+	struct ray_hit {
+		static const std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+		float t = std::numeric_limits<float>::infinity();
+		std::uint32_t instance = none;
+		std::uint32_t triangle = none;
+		glm::vec3 position{0};
+
+		bool hit() const { return instance != none; }
+	};
+
+	// Two level bvh for picking instances of a mesh: a bvh over the instances' world boxes
+	// (the top level) whose leaves hand the ray, moved into each instance's object space, to the
+	// mesh's mesh_bvh (the bottom level). The mesh_bvh must outlive this.
+	class instance_bvh {
+	public:
+		instance_bvh() { }
+
+		void build(const mesh_bvh &mesh, const std::vector<glm::mat4> &transforms);
+
+		// after transforms[first, first + count) changed, refits only the nodes above them
+		void update(const std::vector<glm::mat4> &transforms, size_t first, size_t count);
+
+		// after every transform changed (but not the number of them)
+		void refit(const std::vector<glm::mat4> &transforms);
+
+		// closest instance hit by r, transforms must be the ones given to build or update
+		ray_hit intersect(const ray &r, const std::vector<glm::mat4> &transforms) const;
+
+		size_t size() const { return m_tree.size(); }
+		const aabb & instance_bounds(std::uint32_t i) const { return m_tree.box(i); }
+		const bvh & tree() const { return m_tree; }
+
+	private:
+		const mesh_bvh *m_mesh = nullptr;
+		bvh m_tree;
+
+		std::vector<aabb> instance_boxes(const std::vector<glm::mat4> &transforms) const;
+	};
+}
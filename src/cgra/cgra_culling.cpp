@@ -0,0 +1,188 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// project
+#include "cgra_culling.hpp"
+#include "cgra_simd.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		using namespace simd;
+
+		// instances per task, a multiple of every simd width
+		const size_t cull_chunk = 8192;
+
+		// runs fn(chunk, begin, end) over [0, count) in chunks, on pool if there are enough of them
+		template <typename Fn>
+		void for_chunks(size_t count, size_t min_parallel, task_pool &pool, Fn &&fn) {
+			const size_t chunks = (count + cull_chunk - 1) / cull_chunk;
+			if (chunks <= 1 || count < min_parallel || pool.size() == 1) {
+				for (size_t c = 0; c < chunks; ++c) fn(c, c * cull_chunk, std::min(count, (c + 1) * cull_chunk));
+				return;
+			}
+			pool.run(unsigned(chunks), [&](unsigned c) {
+				fn(c, c * cull_chunk, std::min(count, (c + 1) * cull_chunk));
+			});
+		}
+
+		// the culling state shared by every block
+		struct simd_frustum {
+			vfloat px[6], py[6], pz[6], pw[6]; // normalized planes, pointing inwards
+			vfloat wx, wy, wz, ww;             // row of the matrix giving clip w (view depth)
+			vfloat size_scale;                 // radius * size_scale / w is the diameter in pixels
+			vfloat threshold;
+		};
+	}
+
+
+	void compute_instance_bounds(const instance_set &instances, const vec3 &center, float radius, instance_bounds &out, task_pool &pool) {
+		const size_t count = instances.size();
+		const size_t padded = (count + 7) / 8 * 8;
+		out.count = count;
+		out.x.assign(padded, 0.f);
+		out.y.assign(padded, 0.f);
+		out.z.assign(padded, 0.f);
+		out.radius.assign(padded, 0.f);
+
+		for_chunks(count, cull_options().parallel_min, pool, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				const mat4 &t = instances.transforms[i];
+				const vec4 c = t * vec4(center, 1);
+				// the largest axis scale bounds any rotation and non-uniform scale
+				const float s = std::sqrt(std::max(dot(vec3(t[0]), vec3(t[0])), std::max(dot(vec3(t[1]), vec3(t[1])), dot(vec3(t[2]), vec3(t[2])))));
+				out.x[i] = c.x;
+				out.y[i] = c.y;
+				out.z[i] = c.z;
+				out.radius[i] = radius * s;
+			}
+		});
+	}
+
+
+	cull_frustum make_cull_frustum(const mat4 &modelview, const mat4 &proj, float viewport_height) {
+		const mat4 m = proj * modelview;
+		const vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		const vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		const vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		const vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+		const vec4 planes[6] = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2 };
+
+		cull_frustum f;
+		for (int p = 0; p < 6; ++p) {
+			const float len = length(vec3(planes[p]));
+			f.planes[p] = planes[p] / (len > 0 ? len : 1.f);
+		}
+		// clip w is the view depth (scaled by any scale in modelview, which the radius needs too)
+		const float view_scale = length(vec3(modelview[0]));
+		f.depth_row = row3;
+		f.size_scale = view_scale * proj[1][1] * viewport_height;
+		return f;
+	}
+
+
+	void cull_instances(const instance_bounds &bounds, const mat4 &modelview, const mat4 &proj,
+		float viewport_height, const cull_options &options, vector<uint32_t> &visible, cull_stats *stats, task_pool &pool)
+	{
+		const auto start = chrono::steady_clock::now();
+		const cull_frustum cf = make_cull_frustum(modelview, proj, viewport_height);
+
+		simd_frustum f;
+		for (int p = 0; p < 6; ++p) {
+			f.px[p] = vfloat(cf.planes[p].x);
+			f.py[p] = vfloat(cf.planes[p].y);
+			f.pz[p] = vfloat(cf.planes[p].z);
+			f.pw[p] = vfloat(cf.planes[p].w);
+		}
+		f.wx = vfloat(cf.depth_row.x);
+		f.wy = vfloat(cf.depth_row.y);
+		f.wz = vfloat(cf.depth_row.z);
+		f.ww = vfloat(cf.depth_row.w);
+		f.size_scale = vfloat(cf.size_scale);
+		f.threshold = vfloat(options.pixel_threshold);
+
+		const size_t count = bounds.size();
+		const size_t chunks = (count + cull_chunk - 1) / cull_chunk;
+		vector<vector<uint32_t>> chunk_visible(chunks);
+		vector<size_t> chunk_outside(chunks, 0), chunk_small(chunks, 0);
+
+		for_chunks(count, options.parallel_min, pool, [&](size_t c, size_t begin, size_t end) {
+			vector<uint32_t> &out = chunk_visible[c];
+			out.clear();
+			out.reserve(end - begin);
+			size_t outside = 0, small = 0;
+			const vfloat zero(0.f);
+
+			for (size_t i = begin; i < end; i += vfloat::width) {
+				const vfloat x = vfloat::loadu(&bounds.x[i]);
+				const vfloat y = vfloat::loadu(&bounds.y[i]);
+				const vfloat z = vfloat::loadu(&bounds.z[i]);
+				const vfloat r = vfloat::loadu(&bounds.radius[i]);
+
+				// inside (or touching) every plane
+				vfloat in = vgreater(f.px[0] * x + f.py[0] * y + f.pz[0] * z + f.pw[0] + r, zero);
+				for (int p = 1; p < 6; ++p) {
+					in = in & vgreater(f.px[p] * x + f.py[p] * y + f.pz[p] * z + f.pw[p] + r, zero);
+				}
+
+				// projected diameter below the threshold, instances around the camera (w <= 0)
+				// never are since threshold * w <= 0
+				const vfloat w = f.wx * x + f.wy * y + f.wz * z + f.ww;
+				const vfloat too_small = vless(r * f.size_scale, f.threshold * w);
+
+				const int lanes = int(std::min<size_t>(vfloat::width, end - i));
+				const int valid = (1 << lanes) - 1;
+				const int in_bits = vbits(in) & valid;
+				const int small_bits = vbits(too_small) & in_bits;
+				const int visible_bits = in_bits & ~small_bits;
+
+				for (int l = 0; l < lanes; ++l) {
+					outside += (~in_bits >> l) & 1;
+					small += (small_bits >> l) & 1;
+					if ((visible_bits >> l) & 1) out.push_back(uint32_t(i + l));
+				}
+			}
+			chunk_outside[c] = outside;
+			chunk_small[c] = small;
+		});
+
+		visible.clear();
+		size_t outside = 0, small = 0;
+		for (size_t c = 0; c < chunks; ++c) {
+			visible.insert(visible.end(), chunk_visible[c].begin(), chunk_visible[c].end());
+			outside += chunk_outside[c];
+			small += chunk_small[c];
+		}
+
+		if (stats) {
+			stats->tested = count;
+			stats->frustum_culled = outside;
+			stats->small_culled = small;
+			stats->visible = visible.size();
+			stats->ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+	}
+
+
+	void gather_instances(const instance_set &instances, const vector<uint32_t> &visible,
+		vector<mat4> &transforms, vector<vec3> &colors, task_pool &pool)
+	{
+		transforms.resize(visible.size());
+		colors.resize(visible.size());
+		for_chunks(visible.size(), cull_options().parallel_min, pool, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				transforms[i] = instances.transforms[visible[i]];
+				colors[i] = instances.colors[visible[i]];
+			}
+		});
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_instances.hpp"
+#include "cgra_parallel.hpp"
+
+
+namespace cgra {
+
+	// Bounding spheres of a set of instances, as separate arrays so several load into one
+	// simd register. The arrays are padded with zeros to a multiple of 8.
+	struct instance_bounds {
+		std::vector<float> x, y, z, radius;
+		size_t count = 0;
+
+		size_t size() const { return count; }
+	};
+
+	// bounding sphere of every instance (in the space the instance transforms map to) from the
+	// bounding sphere of the mesh they draw (center, radius in object space)
+	void compute_instance_bounds(const instance_set &instances, const glm::vec3 &center, float radius,
+		instance_bounds &out, task_pool &pool = default_task_pool());
+
+
+	// What the culling tests need from a view: the six frustum planes of proj * modelview
+	// (normalized, pointing inwards, a sphere is inside a plane if dot(xyz, c) + w > -r),
+	// the row of proj * modelview giving clip w, and the scale that turns radius / w into
+	// a diameter in pixels
+	struct cull_frustum {
+		glm::vec4 planes[6];
+		glm::vec4 depth_row;
+		float size_scale = 0;
+	};
+
+	cull_frustum make_cull_frustum(const glm::mat4 &modelview, const glm::mat4 &proj, float viewport_height);
+
+
+	struct cull_options {
+		// instances covering fewer pixels than this on screen (by diameter) are dropped, 0 keeps them all
+		float pixel_threshold = 0;
+
+		// below this many instances everything runs on the calling thread
+		size_t parallel_min = 16384;
+	};
+
+	struct cull_stats {
+		size_t tested = 0;
+		size_t frustum_culled = 0; // entirely outside the view frustum
+		size_t small_culled = 0;   // inside the frustum, but under the pixel threshold
+		size_t visible = 0;
+		double ms = 0;
+	};
+
+	// Tests every sphere against the six planes of the frustum of proj * modelview (modelview
+	// takes the space of the bounds to view space) and writes the indices of those that are
+	// at least partly inside, and not too small, to visible in increasing order. The spheres
+	// are tested several at a time with SSE/AVX, in blocks spread over pool for large counts.
+	void cull_instances(const instance_bounds &bounds, const glm::mat4 &modelview, const glm::mat4 &proj,
+		float viewport_height, const cull_options &options, std::vector<std::uint32_t> &visible,
+		cull_stats *stats = nullptr, task_pool &pool = default_task_pool());
+
+	// copies the transforms and colours of the visible instances into compact arrays for upload
+	void gather_instances(const instance_set &instances, const std::vector<std::uint32_t> &visible,
+		std::vector<glm::mat4> &transforms, std::vector<glm::vec3> &colors, task_pool &pool = default_task_pool());
+}
@@ -0,0 +1,64 @@
+
+// std
+#include <cstddef>
+
+// project
+#include "cgra_frame_uniforms.hpp"
+#include "cgra_gl_state.hpp"
+#include "cgra_resource.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		static_assert(sizeof(frame_uniforms) == 3 * 64 + 3 * 16, "frame_uniforms must match the std140 FrameData block");
+		static_assert(offsetof(frame_uniforms, time) == 3 * 64 + 2 * 16 + 8, "frame_uniforms must match the std140 FrameData block");
+
+		frame_uniforms current;
+		GLuint buffer = 0;
+
+		// as in res/shaders/default_vert.glsl and default_frag.glsl
+		const char *frame_uniform_block = R"(
+	layout(std140) uniform FrameData {
+		mat4 uView;
+		mat4 uProjection;
+		mat4 uViewProjection;
+		vec4 uLightColor;
+		vec4 uSpecular;
+		vec2 uViewport;
+		float uTime;
+	};
+)";
+	}
+
+
+	string with_frame_uniforms(const string &source) {
+		const size_t version = source.find("#version");
+		if (version == string::npos) return frame_uniform_block + source;
+		const size_t line_end = source.find('\n', version);
+		if (line_end == string::npos) return source + "\n" + frame_uniform_block;
+		string s = source;
+		s.insert(line_end + 1, frame_uniform_block);
+		return s;
+	}
+
+
+	void update_frame_uniforms(const frame_uniforms &frame) {
+		current = frame;
+		if (!buffer) buffer = resources().acquire_buffer("frame_uniforms", GL_UNIFORM_BUFFER, sizeof(frame_uniforms), nullptr, GL_STREAM_DRAW);
+		gl_state().bind_buffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(frame_uniforms), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_uniforms), &frame);
+		gl_state().bind_buffer_base(GL_UNIFORM_BUFFER, frame_uniform_binding, buffer);
+	}
+
+
+	const frame_uniforms & current_frame_uniforms() {
+		return current;
+	}
+}
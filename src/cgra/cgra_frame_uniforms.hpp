@@ -0,0 +1,44 @@
+#pragma once
+
+// std
+#include <string>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	// Everything about the frame that every program reads, uploaded once a frame into a single
+	// uniform buffer bound to frame_uniform_binding. Programs declare it as the FrameData block
+	// (with_frame_uniforms, or the same text in a shader file) and shader_builder::build binds
+	// them to it, so a program costs nothing per frame for any of this.
+	//
+	// The layout matches std140: matrices and vec4s first, so there is no padding to get wrong.
+	struct frame_uniforms {
+		glm::mat4 view{1};
+		glm::mat4 projection{1};
+		glm::mat4 view_projection{1};
+		glm::vec4 light_color{1};    // rgb, the light is at the camera
+		glm::vec4 specular{1};       // rgb colour, w shininess
+		glm::vec2 viewport{0};       // size in pixels
+		float time = 0;              // seconds
+		float padding = 0;
+	};
+
+	const GLuint frame_uniform_binding = 0;
+
+	// source with the GLSL declaration of frame_uniforms added after its #version line, for
+	// shaders built from strings
+	std::string with_frame_uniforms(const std::string &source);
+
+	// replaces the frame's uniforms (orphaning the buffer, so drawing from the last frame's
+	// doesn't have to finish first) and binds them to frame_uniform_binding
+	void update_frame_uniforms(const frame_uniforms &frame);
+
+	// the values last given to update_frame_uniforms
+	const frame_uniforms & current_frame_uniforms();
+}
@@ -8,7 +8,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 // project
+#include "cgra_frame_uniforms.hpp"
 #include "cgra_geometry.hpp"
+#include "cgra_gl_state.hpp"
 #include "cgra_shader.hpp"
 #include <opengl.hpp>
 
@@ -26,8 +28,8 @@ namespace cgra {
 			glGenVertexArrays(1, &vao);
 			glGenBuffers(1, &vbo);
 			glGenBuffers(1, &ibo);
-			glBindVertexArray(vao);
-			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			gl_state().bind_vertex_array(vao);
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, vbo);
 			glBufferData(GL_ARRAY_BUFFER, vcount * sizeof(float), vertices, GL_STATIC_DRAW);
 			glEnableVertexAttribArray(0);
 			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(draw_mesh_vertex), (void *)(offsetof(draw_mesh_vertex, pos)));
@@ -35,9 +37,9 @@ namespace cgra {
 			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(draw_mesh_vertex), (void *)(offsetof(draw_mesh_vertex, norm)));
 			glEnableVertexAttribArray(2);
 			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(draw_mesh_vertex), (void *)(offsetof(draw_mesh_vertex, uv)));
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+			gl_state().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * icount, indices, GL_STATIC_DRAW);
-			glBindVertexArray(0);
+			gl_state().bind_vertex_array(0);
 			return vao;
 		}
 	}
@@ -409,7 +411,7 @@ namespace cgra {
 			c = sizeof(idx) / sizeof(idx[0]);
 			m = compileDrawVAO(vert, v, idx, c);
 		}
-		glBindVertexArray(m);
+		gl_state().bind_vertex_array(m);
 		glDrawElements(GL_TRIANGLES, c, GL_UNSIGNED_INT, 0);
 	}
 
@@ -541,7 +543,7 @@ namespace cgra {
 			c = sizeof(idx) / sizeof(idx[0]);
 			m = compileDrawVAO(vert, v, idx, c);
 		}
-		glBindVertexArray(m);
+		gl_state().bind_vertex_array(m);
 		glDrawElements(GL_TRIANGLES, c, GL_UNSIGNED_INT, 0);
 	}
 
@@ -639,18 +641,16 @@ namespace cgra {
 			c = sizeof(idx) / sizeof(idx[0]);
 			m = compileDrawVAO(vert, v, idx, c);
 		}
-		glBindVertexArray(m);
+		gl_state().bind_vertex_array(m);
 		glDrawElements(GL_TRIANGLES, c, GL_UNSIGNED_INT, 0);
 	}
 
 
 
-	void drawAxis(const glm::mat4 &view, const glm::mat4 &proj) {
+	GLuint axisProgram() {
 
 		const char* axis_shader_source = R"(
 	#version 330 core
-	uniform mat4 uProjectionMatrix;
-	uniform mat4 uModelViewMatrix;
 #ifdef _VERTEX_
 	flat out int v_instanceID;
 	void main() {
@@ -672,10 +672,10 @@ namespace cgra {
 	);
 	void main() {
 		v_color = abs(dir[v_instanceID[0]]);
-		gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(0.0, 0.0, 0.0, 1.0);
+		gl_Position = uViewProjection * vec4(0.0, 0.0, 0.0, 1.0);
 		EmitVertex();
 		v_color = abs(dir[v_instanceID[0]]);
-		gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(normalize(dir[v_instanceID[0]]) * 1000, 1.0);
+		gl_Position = uViewProjection * vec4(normalize(dir[v_instanceID[0]]) * 1000, 1.0);
 		EmitVertex();
 		EndPrimitive();
 	}
@@ -691,25 +691,30 @@ namespace cgra {
 		static GLuint axis_shader = 0;
 		if (!axis_shader) {
 			shader_builder prog;
-			prog.set_shader_source(GL_VERTEX_SHADER, axis_shader_source);
-			prog.set_shader_source(GL_GEOMETRY_SHADER, axis_shader_source);
-			prog.set_shader_source(GL_FRAGMENT_SHADER, axis_shader_source);
+			const std::string source = with_frame_uniforms(axis_shader_source);
+			prog.set_shader_source(GL_VERTEX_SHADER, source);
+			prog.set_shader_source(GL_GEOMETRY_SHADER, source);
+			prog.set_shader_source(GL_FRAGMENT_SHADER, source);
 			axis_shader = prog.build();
 		}
+		return axis_shader;
+	}
+
+
+	void drawAxis() {
+		const GLuint axis_shader = axisProgram();
 
-		glUseProgram(axis_shader);
-		glUniformMatrix4fv(glGetUniformLocation(axis_shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
-		glUniformMatrix4fv(glGetUniformLocation(axis_shader, "uModelViewMatrix"), 1, false, value_ptr(view));
+		// the camera comes from the frame's uniforms, there is nothing else to set
+		gl_state().use_program(axis_shader);
 		draw_dummy(6);
 	}
 
 
-	void drawGrid(const glm::mat4 &view, const glm::mat4 &proj) {
+	GLuint gridProgram() {
 
 		const char* grid_shader_source = R"(
 	#version 330 core
-	uniform mat4 uProjectionMatrix;
-	uniform mat4 uModelViewMatrix;
+	uniform mat4 uModelMatrix;
 #ifdef _VERTEX_
 	flat out int v_instanceID;
 	void main() {
@@ -721,9 +726,9 @@ namespace cgra {
 	layout(line_strip, max_vertices = 2) out;
 	flat in int v_instanceID[];
 	void main() {
-		gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(v_instanceID[0] - 10, 0, -10, 1);
+		gl_Position = uViewProjection * uModelMatrix * vec4(v_instanceID[0] - 10, 0, -10, 1);
 		EmitVertex();
-		gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(v_instanceID[0] - 10, 0, 10, 1);
+		gl_Position = uViewProjection * uModelMatrix * vec4(v_instanceID[0] - 10, 0, 10, 1);
 		EmitVertex();
 		EndPrimitive();
 	}
@@ -737,19 +742,100 @@ namespace cgra {
 		static GLuint grid_shader = 0;
 		if (!grid_shader) {
 			shader_builder prog;
-			prog.set_shader_source(GL_VERTEX_SHADER, grid_shader_source);
-			prog.set_shader_source(GL_GEOMETRY_SHADER, grid_shader_source);
-			prog.set_shader_source(GL_FRAGMENT_SHADER, grid_shader_source);
+			const std::string source = with_frame_uniforms(grid_shader_source);
+			prog.set_shader_source(GL_VERTEX_SHADER, source);
+			prog.set_shader_source(GL_GEOMETRY_SHADER, source);
+			prog.set_shader_source(GL_FRAGMENT_SHADER, source);
 			grid_shader = prog.build();
 		}
+		return grid_shader;
+	}
+
+
+	void drawGrid() {
+		const GLuint grid_shader = gridProgram();
 
 		const glm::mat4 rot = glm::rotate(glm::mat4(1), glm::pi<float>() / 2.f, glm::vec3(0, 1, 0));
 
-		glUseProgram(grid_shader);
-		glUniformMatrix4fv(glGetUniformLocation(grid_shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
-		glUniformMatrix4fv(glGetUniformLocation(grid_shader, "uModelViewMatrix"), 1, false, value_ptr(view));
+		static program_reflection &grid = reflection(grid_shader);
+		static const int model = grid.uniform("uModelMatrix");
+
+		gl_state().use_program(grid_shader);
+		grid.set(model, glm::mat4(1));
 		draw_dummy(21);
-		glUniformMatrix4fv(glGetUniformLocation(grid_shader, "uModelViewMatrix"), 1, false, value_ptr(view * rot));
+		grid.set(model, rot);
 		draw_dummy(21);
 	}
+
+	GLuint boxProgram() {
+
+		const char* box_shader_source = R"(
+	#version 330 core
+	uniform mat4 uModelMatrix;
+	uniform vec3 uMin;
+	uniform vec3 uMax;
+	uniform vec3 uColor;
+#ifdef _VERTEX_
+	flat out int v_instanceID;
+	void main() {
+		v_instanceID = gl_InstanceID;
+	}
+#endif
+#ifdef _GEOMETRY_
+	layout(points) in;
+	layout(line_strip, max_vertices = 2) out;
+	flat in int v_instanceID[];
+	// the corners differing in one bit (bit 0 x, bit 1 y, bit 2 z)
+	const ivec2 edges[] = ivec2[](
+		ivec2(0, 1), ivec2(2, 3), ivec2(4, 5), ivec2(6, 7),
+		ivec2(0, 2), ivec2(1, 3), ivec2(4, 6), ivec2(5, 7),
+		ivec2(0, 4), ivec2(1, 5), ivec2(2, 6), ivec2(3, 7)
+	);
+	vec4 corner(int i) {
+		return vec4(mix(uMin, uMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1)), 1.0);
+	}
+	void main() {
+		gl_Position = uViewProjection * uModelMatrix * corner(edges[v_instanceID[0]].x);
+		EmitVertex();
+		gl_Position = uViewProjection * uModelMatrix * corner(edges[v_instanceID[0]].y);
+		EmitVertex();
+		EndPrimitive();
+	}
+#endif
+#ifdef _FRAGMENT_
+	out vec3 f_color;
+	void main() {
+		gl_FragDepth = gl_FragCoord.z - 0.000001;
+		f_color = uColor;
+	}
+#endif)";
+		static GLuint box_shader = 0;
+		if (!box_shader) {
+			shader_builder prog;
+			const std::string source = with_frame_uniforms(box_shader_source);
+			prog.set_shader_source(GL_VERTEX_SHADER, source);
+			prog.set_shader_source(GL_GEOMETRY_SHADER, source);
+			prog.set_shader_source(GL_FRAGMENT_SHADER, source);
+			box_shader = prog.build();
+		}
+		return box_shader;
+	}
+
+
+	void drawBox(const glm::mat4 &model, const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &color) {
+		const GLuint box_shader = boxProgram();
+
+		static program_reflection &box = reflection(box_shader);
+		static const int model_matrix = box.uniform("uModelMatrix");
+		static const int min_corner = box.uniform("uMin");
+		static const int max_corner = box.uniform("uMax");
+		static const int box_color = box.uniform("uColor");
+
+		gl_state().use_program(box_shader);
+		box.set(model_matrix, model);
+		box.set(min_corner, min);
+		box.set(max_corner, max);
+		box.set(box_color, color);
+		draw_dummy(12);
+	}
 }
\ No newline at end of file
@@ -1,6 +1,13 @@
 
 #pragma once
 
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+
+
 namespace cgra {
 	
 	// creates a mesh for a unit sphere (radius of 1)
@@ -15,9 +22,22 @@ namespace cgra {
 	// immediately draws the sphere mesh, assuming the shader is set up
 	void drawCone();
 
-	// sets up a shader and draws an axis straight to the current framebuffer
-	void drawAxis(const glm::mat4 &view, const glm::mat4 &proj);
+	// these draw straight to the current framebuffer with the camera of the frame's uniforms
+	// (see update_frame_uniforms)
+
+	// sets up a shader and draws an axis
+	void drawAxis();
+
+	// sets up a shader and draws a grid
+	void drawGrid();
+
+	// sets up a shader and draws the edges of the box from min to max (in the space model
+	// takes to world space), just in front of the surface
+	void drawBox(const glm::mat4 &model, const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &color);
 
-	// sets up a shader and draws a grid straight to the current framebuffer
-	void drawGrid(const glm::mat4 &view, const glm::mat4 &proj);
+	// the programs the three above use (built on first use), they all draw dummy_vertex_array().
+	// for sorting their draws by state, see render_queue::make_key
+	GLuint axisProgram();
+	GLuint gridProgram();
+	GLuint boxProgram();
 }
\ No newline at end of file
@@ -0,0 +1,242 @@
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "cgra_gl_state.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		// index into the cached bindings, or -1 for targets that aren't cached
+		int buffer_index(GLenum target) {
+			switch (target) {
+			case GL_ARRAY_BUFFER: return 0;
+			case GL_ELEMENT_ARRAY_BUFFER: return 1;
+			case GL_COPY_READ_BUFFER: return 2;
+			case GL_COPY_WRITE_BUFFER: return 3;
+			case GL_PIXEL_PACK_BUFFER: return 4;
+			case GL_PIXEL_UNPACK_BUFFER: return 5;
+			case GL_UNIFORM_BUFFER: return 6;
+			case GL_TEXTURE_BUFFER: return 7;
+			case GL_TRANSFORM_FEEDBACK_BUFFER: return 8;
+			case GL_DRAW_INDIRECT_BUFFER: return 9;
+			case GL_QUERY_BUFFER: return 10;
+			default: return -1;
+			}
+		}
+
+		int texture_index(GLenum target) {
+			switch (target) {
+			case GL_TEXTURE_2D: return 0;
+			case GL_TEXTURE_2D_ARRAY: return 1;
+			case GL_TEXTURE_3D: return 2;
+			case GL_TEXTURE_CUBE_MAP: return 3;
+			default: return -1;
+			}
+		}
+
+		int capability_index(GLenum capability) {
+			switch (capability) {
+			case GL_DEPTH_TEST: return 0;
+			case GL_CULL_FACE: return 1;
+			case GL_BLEND: return 2;
+			case GL_SCISSOR_TEST: return 3;
+			case GL_STENCIL_TEST: return 4;
+			case GL_RASTERIZER_DISCARD: return 5;
+			case GL_PROGRAM_POINT_SIZE: return 6;
+			case GL_PRIMITIVE_RESTART: return 7;
+			default: return -1;
+			}
+		}
+	}
+
+
+	bool gl_state_cache::same(GLuint &cached, GLuint value) {
+		if (cached == value) {
+			m_frame.eliminated++;
+			return true;
+		}
+		cached = value;
+		m_frame.issued++;
+		return false;
+	}
+
+
+	void gl_state_cache::use_program(GLuint program) {
+		if (!same(m_program, program)) glUseProgram(program);
+	}
+
+
+	void gl_state_cache::bind_vertex_array(GLuint vao) {
+		if (same(m_vertex_array, vao)) return;
+		glBindVertexArray(vao);
+		m_buffers[buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = unknown;
+	}
+
+
+	void gl_state_cache::bind_buffer(GLenum target, GLuint buffer) {
+		const int i = buffer_index(target);
+		if (i < 0) {
+			m_frame.issued++;
+			glBindBuffer(target, buffer);
+			return;
+		}
+		if (!same(m_buffers[i], buffer)) glBindBuffer(target, buffer);
+	}
+
+
+	void gl_state_cache::bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+		GLuint *cached = nullptr;
+		if (index < GLuint(indexed_bindings)) {
+			if (target == GL_UNIFORM_BUFFER) cached = &m_uniform_buffers[index];
+			if (target == GL_TRANSFORM_FEEDBACK_BUFFER) cached = &m_feedback_buffers[index];
+		}
+		if (cached && same(*cached, buffer)) return;
+		if (!cached) m_frame.issued++;
+		glBindBufferBase(target, index, buffer);
+		const int i = buffer_index(target);
+		if (i >= 0) m_buffers[i] = buffer;
+	}
+
+
+	void gl_state_cache::active_texture(GLuint unit) {
+		if (!same(m_active_texture, unit)) glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+
+	void gl_state_cache::bind_texture(GLuint unit, GLenum target, GLuint texture) {
+		const int i = texture_index(target);
+		if (i < 0 || unit >= GLuint(texture_units)) {
+			active_texture(unit);
+			m_frame.issued++;
+			glBindTexture(target, texture);
+			return;
+		}
+		if (m_textures[unit][i] == texture) {
+			m_frame.eliminated++;
+			return;
+		}
+		active_texture(unit);
+		same(m_textures[unit][i], texture);
+		glBindTexture(target, texture);
+	}
+
+
+	void gl_state_cache::set_enabled(GLenum capability, bool enabled) {
+		const int i = capability_index(capability);
+		if (i >= 0 && same(m_enabled[i], enabled)) return;
+		if (i < 0) m_frame.issued++;
+		if (enabled) glEnable(capability);
+		else glDisable(capability);
+	}
+
+
+	void gl_state_cache::depth_func(GLenum func) {
+		if (!same(m_depth_func, func)) glDepthFunc(func);
+	}
+
+
+	void gl_state_cache::depth_mask(bool mask) {
+		if (!same(m_depth_mask, mask)) glDepthMask(mask ? GL_TRUE : GL_FALSE);
+	}
+
+
+	void gl_state_cache::polygon_mode(GLenum mode) {
+		if (!same(m_polygon_mode, mode)) glPolygonMode(GL_FRONT_AND_BACK, mode);
+	}
+
+
+	void gl_state_cache::vertex_attrib(GLuint index, const vec4 &value) {
+		if (index < GLuint(vertex_attribs)) {
+			if (m_attrib_known[index] && m_attribs[index] == value) {
+				m_frame.eliminated++;
+				return;
+			}
+			m_attribs[index] = value;
+			m_attrib_known[index] = true;
+		}
+		m_frame.issued++;
+		glVertexAttrib4fv(index, value_ptr(value));
+	}
+
+
+	void gl_state_cache::forget_program(GLuint program) {
+		// a deleted program stays in use until another is, so just stop assuming anything
+		if (m_program == program) m_program = unknown;
+	}
+
+
+	void gl_state_cache::forget_vertex_array(GLuint vao) {
+		if (m_vertex_array == vao) {
+			m_vertex_array = 0;
+			m_buffers[buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = unknown;
+		}
+	}
+
+
+	void gl_state_cache::forget_buffer(GLuint buffer) {
+		for (GLuint &b : m_buffers) if (b == buffer) b = 0;
+		for (GLuint &b : m_uniform_buffers) if (b == buffer) b = 0;
+		for (GLuint &b : m_feedback_buffers) if (b == buffer) b = 0;
+	}
+
+
+	void gl_state_cache::forget_texture(GLuint texture) {
+		for (auto &unit : m_textures) {
+			for (GLuint &t : unit) if (t == texture) t = 0;
+		}
+	}
+
+
+	void gl_state_cache::invalidate() {
+		m_program = unknown;
+		m_vertex_array = unknown;
+		for (GLuint &b : m_buffers) b = unknown;
+		for (GLuint &b : m_uniform_buffers) b = unknown;
+		for (GLuint &b : m_feedback_buffers) b = unknown;
+		m_active_texture = unknown;
+		for (auto &unit : m_textures) {
+			for (GLuint &t : unit) t = unknown;
+		}
+		for (GLuint &e : m_enabled) e = unknown;
+		m_depth_func = unknown;
+		m_depth_mask = unknown;
+		m_polygon_mode = unknown;
+		for (bool &known : m_attrib_known) known = false;
+	}
+
+
+	void gl_state_cache::end_frame() {
+		m_last_frame = m_frame;
+		m_frame = gl_state_stats();
+	}
+
+
+	gl_state_cache & gl_state() {
+		static gl_state_cache cache;
+		return cache;
+	}
+
+
+	GLuint dummy_vertex_array() {
+		static GLuint vao = 0;
+		if (vao == 0) {
+			glGenVertexArrays(1, &vao);
+		}
+		return vao;
+	}
+
+
+	void draw_dummy(unsigned instances) {
+		// left bound, the next draw binds its own if it is different
+		gl_state().bind_vertex_array(dummy_vertex_array());
+		glDrawArraysInstanced(GL_POINTS, 0, 1, instances);
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	// gl calls asked of the state cache since the last end_frame
+	struct gl_state_stats {
+		size_t issued = 0;     // made, because the state was different (or unknown)
+		size_t eliminated = 0; // skipped, because the state was already that
+	};
+
+
+	// A shadow of the gl context state that draws change most often: the program, the vertex
+	// array, buffer bindings, textures on each unit, a few enables, the depth function and mask,
+	// the polygon mode and constant vertex attributes. Each setter only calls gl when the value
+	// differs from the one last set, so code that draws can bind everything it needs without
+	// knowing (or undoing) what was bound before.
+	//
+	// This only works while everything goes through the cache. Code that changes the same state
+	// directly (eg. the gui) must be followed by invalidate(), and objects that are deleted must
+	// be forgotten, or a new object given the same name would never be bound.
+	//
+	// Targets, units, capabilities and attributes the cache doesn't track are passed straight
+	// through. Only use from the thread that owns the gl context.
+	class gl_state_cache {
+	public:
+		gl_state_cache() { invalidate(); }
+		gl_state_cache(const gl_state_cache &) = delete;
+		gl_state_cache & operator=(const gl_state_cache &) = delete;
+
+		void use_program(GLuint program);
+
+		// the element array binding belongs to the vertex array, so it is unknown after a change
+		void bind_vertex_array(GLuint vao);
+
+		void bind_buffer(GLenum target, GLuint buffer);
+
+		// whole buffer to an indexed target, which also binds it to the target itself
+		void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+
+		// binds to unit, making it the active texture unit first if it isn't
+		void bind_texture(GLuint unit, GLenum target, GLuint texture);
+
+		// the active texture unit, for code that binds textures itself
+		void active_texture(GLuint unit);
+
+		void set_enabled(GLenum capability, bool enabled);
+		void enable(GLenum capability) { set_enabled(capability, true); }
+		void disable(GLenum capability) { set_enabled(capability, false); }
+
+		void depth_func(GLenum func);
+		void depth_mask(bool mask);
+
+		// for GL_FRONT_AND_BACK, the only face core profiles allow
+		void polygon_mode(GLenum mode);
+
+		// current value of a generic vertex attribute. drawing with the attribute's array
+		// enabled leaves its current value undefined (GL 3.3 section 2.8.3), so only use this for
+		// attributes that are never read from an array
+		void vertex_attrib(GLuint index, const glm::vec4 &value);
+
+		// call before or after deleting an object (gl unbinds it if it was bound)
+		void forget_program(GLuint program);
+		void forget_vertex_array(GLuint vao);
+		void forget_buffer(GLuint buffer);
+		void forget_texture(GLuint texture);
+
+		// forgets everything, the next call of every setter goes through
+		void invalidate();
+
+		// starts counting a new frame, what was counted so far becomes last_frame()
+		void end_frame();
+
+		const gl_state_stats & frame() const { return m_frame; }
+		const gl_state_stats & last_frame() const { return m_last_frame; }
+
+	private:
+		static const GLuint unknown = ~GLuint(0);
+		static const int buffer_targets = 11;
+		static const int indexed_bindings = 8;
+		static const int texture_units = 16;
+		static const int texture_targets = 4;
+		static const int capabilities = 8;
+		static const int vertex_attribs = 16;
+
+		// true if the call can be skipped, counting it either way
+		bool same(GLuint &cached, GLuint value);
+
+		GLuint m_program;
+		GLuint m_vertex_array;
+		GLuint m_buffers[buffer_targets];
+		GLuint m_uniform_buffers[indexed_bindings];
+		GLuint m_feedback_buffers[indexed_bindings];
+		GLuint m_active_texture;
+		GLuint m_textures[texture_units][texture_targets];
+		GLuint m_enabled[capabilities];
+		GLuint m_depth_func;
+		GLuint m_depth_mask;
+		GLuint m_polygon_mode;
+		glm::vec4 m_attribs[vertex_attribs];
+		bool m_attrib_known[vertex_attribs];
+
+		gl_state_stats m_frame;
+		gl_state_stats m_last_frame;
+	};
+
+	// the cache for the application's gl context
+	gl_state_cache & gl_state();
+
+
+	// draws an empty vertex array, for shaders that do all the work
+	void draw_dummy(unsigned instances = 1);
+
+	// the empty vertex array draw_dummy binds
+	GLuint dummy_vertex_array();
+}
@@ -0,0 +1,262 @@
+
+// std
+#include <cstddef>
+#include <string>
+
+// project
+#include "cgra_gl_state.hpp"
+#include "cgra_gpu_culling.hpp"
+#include "cgra_resource.hpp"
+#include "cgra_shader.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		const char *cull_shader_source = R"(
+	#version 330 core
+	uniform vec4 uPlanes[6];
+	uniform vec4 uDepthRow;
+	uniform vec4 uBounds; // object space bounding sphere, xyz center and w radius
+	uniform float uSizeScale;
+	uniform float uThreshold;
+	uniform int uFormat; // of the input, see instance_format. the output is always full
+#ifdef _VERTEX_
+	layout(location = 0) in mat4 aPacked;
+	layout(location = 4) in vec3 aColor;
+	out mat4 v_transform;
+	out vec3 v_color;
+	flat out int v_visible;
+	// as default_vert.glsl decodes it
+	mat4 unpack() {
+		if (uFormat == 0) return aPacked;
+		if (uFormat == 1) return transpose(aPacked);
+		vec4 q = aPacked[1];
+		float s = aPacked[0].w;
+		mat3 r = mat3(
+			1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y),
+			2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x),
+			2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y)
+		) * s;
+		return mat4(vec4(r[0], 0), vec4(r[1], 0), vec4(r[2], 0), vec4(aPacked[0].xyz, 1));
+	}
+	void main() {
+		mat4 aTransform = unpack();
+		vec3 c = (aTransform * vec4(uBounds.xyz, 1)).xyz;
+		float s = max(dot(aTransform[0].xyz, aTransform[0].xyz), max(dot(aTransform[1].xyz, aTransform[1].xyz), dot(aTransform[2].xyz, aTransform[2].xyz)));
+		float r = uBounds.w * sqrt(s);
+		bool visible = true;
+		for (int i = 0; i < 6; i++) {
+			visible = visible && (dot(uPlanes[i].xyz, c) + uPlanes[i].w + r > 0.0);
+		}
+		float w = dot(uDepthRow.xyz, c) + uDepthRow.w;
+		visible = visible && !(r * uSizeScale < uThreshold * w);
+		v_transform = aTransform;
+		v_color = aColor;
+		v_visible = visible ? 1 : 0;
+	}
+#endif
+#ifdef _GEOMETRY_
+	layout(points) in;
+	layout(points, max_vertices = 1) out;
+	in mat4 v_transform[];
+	in vec3 v_color[];
+	flat in int v_visible[];
+	out mat4 tf_transform;
+	out vec3 tf_color;
+	void main() {
+		if (v_visible[0] != 0) {
+			tf_transform = v_transform[0];
+			tf_color = v_color[0];
+			EmitVertex();
+			EndPrimitive();
+		}
+	}
+#endif)";
+
+		// layout of a glDrawElementsIndirect command
+		struct draw_elements_command {
+			GLuint count;
+			GLuint instance_count;
+			GLuint first_index;
+			GLint base_vertex;
+			GLuint base_instance;
+		};
+
+		// every culler's buffers get their own keys in resources()
+		unsigned next_culler_id = 0;
+	}
+
+
+	void gpu_instance_culler::init() {
+		if (m_program) return;
+
+		shader_builder sb;
+		sb.set_shader_source(GL_VERTEX_SHADER, cull_shader_source);
+		sb.set_shader_source(GL_GEOMETRY_SHADER, cull_shader_source);
+		// the varyings have to be named before linking
+		GLuint program = glCreateProgram();
+		// interleaved into one record, gl 3.3 only guarantees a vec4 per separate varying
+		const char *varyings[] = { "tf_transform", "tf_color" };
+		glTransformFeedbackVaryings(program, 2, varyings, GL_INTERLEAVED_ATTRIBS);
+		m_program = sb.build(program);
+		const program_reflection &reflected = reflection(m_program);
+		m_uniforms.planes = reflected.uniform("uPlanes");
+		m_uniforms.depth_row = reflected.uniform("uDepthRow");
+		m_uniforms.bounds = reflected.uniform("uBounds");
+		m_uniforms.size_scale = reflected.uniform("uSizeScale");
+		m_uniforms.threshold = reflected.uniform("uThreshold");
+		m_uniforms.format = reflected.uniform("uFormat");
+
+		glGenVertexArrays(1, &m_vao);
+
+		// output buffers are shared through resources() so meshes can hold on to them
+		const string prefix = "gpu_culling/" + to_string(next_culler_id++);
+		for (int i = 0; i < 2; ++i) {
+			output &o = m_outputs[i];
+			o.key = prefix + "/instances" + to_string(i);
+			o.instances = resources().acquire_buffer(o.key, GL_ARRAY_BUFFER, 0, nullptr, GL_STREAM_COPY);
+			glGenQueries(1, &o.query);
+		}
+
+		m_indirect = GLEW_ARB_query_buffer_object && GLEW_ARB_draw_indirect;
+		if (m_indirect) {
+			glGenBuffers(1, &m_command);
+			gl_state().bind_buffer(GL_DRAW_INDIRECT_BUFFER, m_command);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(draw_elements_command), nullptr, GL_DYNAMIC_DRAW);
+			gl_state().bind_buffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+	}
+
+
+	void gpu_instance_culler::cull(const instance_set &set, const vec3 &center, float radius,
+		const mat4 &modelview, const mat4 &proj, float viewport_height, float pixel_threshold)
+	{
+		init();
+		m_last_tested = set.size();
+		if (!set.transform_buffer || !set.color_buffer) return;
+
+		// the indirect path draws what it just culled, otherwise alternate outputs so the
+		// previous cull can be drawn while this one runs
+		if (!m_indirect) m_current = 1 - m_current;
+		output &o = m_outputs[m_current];
+		if (o.capacity < set.size()) {
+			o.capacity = set.size();
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, o.instances);
+			glBufferData(GL_ARRAY_BUFFER, o.capacity * interleaved_instance_bytes, nullptr, GL_STREAM_COPY);
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, 0);
+			resources().set_bytes(resource_kind::buffer, o.instances, o.capacity * interleaved_instance_bytes);
+		}
+
+		// the instance set's buffers as per vertex inputs, in whatever format they hold. the
+		// columns a compact format leaves out are constant (the affine one's is its bottom row)
+		const instance_format format = set.buffer_format;
+		const GLsizei stride = GLsizei(instance_transform_bytes(format));
+		gl_state().bind_vertex_array(m_vao);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, set.transform_buffer);
+		for (int i = 0; i < 4; i++) {
+			if (i * GLsizei(sizeof(vec4)) < stride) {
+				glEnableVertexAttribArray(i);
+				glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, stride, (void *)(i * sizeof(vec4)));
+			}
+			else {
+				glDisableVertexAttribArray(i);
+			}
+		}
+		if (format == instance_format::affine) glVertexAttrib4f(3, 0, 0, 0, 1);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, set.color_buffer);
+		glEnableVertexAttribArray(4);
+		if (format == instance_format::full) {
+			glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)(0));
+		}
+		else {
+			glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4, (void *)(0));
+		}
+
+		const cull_frustum f = make_cull_frustum(modelview, proj, viewport_height);
+		program_reflection &program = reflection(m_program);
+		gl_state().use_program(m_program);
+		program.set(m_uniforms.planes, f.planes, 6);
+		program.set(m_uniforms.depth_row, f.depth_row);
+		program.set(m_uniforms.bounds, vec4(center, radius));
+		program.set(m_uniforms.size_scale, f.size_scale);
+		program.set(m_uniforms.threshold, pixel_threshold);
+		program.set(m_uniforms.format, int(format));
+
+		gl_state().enable(GL_RASTERIZER_DISCARD);
+		gl_state().bind_buffer_base(GL_TRANSFORM_FEEDBACK_BUFFER, 0, o.instances);
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, o.query);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, GLsizei(set.size()));
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+		gl_state().bind_buffer_base(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		gl_state().disable(GL_RASTERIZER_DISCARD);
+		o.culled = true;
+	}
+
+
+	void gpu_instance_culler::draw(gl_mesh &mesh) {
+		if (!m_program || mesh.vao == 0) return;
+
+		if (m_indirect) {
+			output &o = m_outputs[m_current];
+			if (!o.culled) return;
+			mesh.set_interleaved_instances(resources().acquire(o.key), GLsizei(o.capacity));
+
+			// everything but the instance count comes from the mesh
+			draw_elements_command command = { GLuint(mesh.index_count), 0, 0, 0, 0 };
+			gl_state().bind_buffer(GL_DRAW_INDIRECT_BUFFER, m_command);
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), &command);
+
+			// with a query buffer bound the result pointer is an offset into it (so it is
+			// unbound again, or the other path's query results would go into it too)
+			gl_state().bind_buffer(GL_QUERY_BUFFER, m_command);
+			glGetQueryObjectuiv(o.query, GL_QUERY_RESULT, (GLuint *)(offsetof(draw_elements_command, instance_count)));
+			gl_state().bind_buffer(GL_QUERY_BUFFER, 0);
+
+			mesh.draw_indirect(m_command);
+			o.culled = false;
+			m_last_drawn = -1;
+			return;
+		}
+
+		// the previous cull, which stays valid until the cull after this one overwrites it. its
+		// result is normally ready by now, reading it only waits for the gpu if it isn't (or if
+		// this is the first cull and there is no previous one to draw)
+		output *o = &m_outputs[1 - m_current];
+		if (!o->culled) o = &m_outputs[m_current];
+		if (!o->culled) return;
+		GLuint count = 0;
+		glGetQueryObjectuiv(o->query, GL_QUERY_RESULT, &count);
+
+		mesh.set_interleaved_instances(resources().acquire(o->key), GLsizei(count));
+		mesh.draw_instanced(GLsizei(count));
+		m_last_drawn = count;
+	}
+
+
+	void gpu_instance_culler::destroy() {
+		for (output &o : m_outputs) {
+			if (o.instances) resources().release(resource_kind::buffer, o.instances);
+			if (o.query) glDeleteQueries(1, &o.query);
+			o = output();
+		}
+		m_uniforms = uniform_handles();
+		forget_reflection(m_program);
+		gl_state().forget_program(m_program);
+		gl_state().forget_vertex_array(m_vao);
+		gl_state().forget_buffer(m_command);
+		glDeleteProgram(m_program);
+		glDeleteVertexArrays(1, &m_vao);
+		glDeleteBuffers(1, &m_command);
+		m_program = 0;
+		m_vao = 0;
+		m_command = 0;
+	}
+}
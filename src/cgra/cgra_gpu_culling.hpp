@@ -0,0 +1,88 @@
+#pragma once
+
+// std
+#include <string>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+#include "cgra_culling.hpp"
+#include "cgra_instances.hpp"
+#include "cgra_mesh.hpp"
+
+
+namespace cgra {
+
+	// Culls instances on the gpu with transform feedback (GL 3.3), for counts where even the
+	// simd cpu culling (see cull_instances) is too slow.
+	//
+	// cull() runs a vertex + geometry shader over the instance buffers with the rasterizer off.
+	// The vertex shader tests each instance's bounding sphere against the frustum and the pixel
+	// threshold, the geometry shader only emits the ones that pass, and transform feedback
+	// packs them into a compact buffer of interleaved transforms and colours (one record, as a
+	// separate mat4 varying is past the 4 components GL 3.3 guarantees for separate attributes).
+	// A GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN query counts them. draw() then draws a mesh with
+	// the compact buffer:
+	//  - with ARB_query_buffer_object and ARB_draw_indirect the query result is written straight
+	//    into the instance count of an indirect draw, nothing is read back to the cpu
+	//  - otherwise the output is double buffered and draw() uses the previous frame's cull,
+	//    whose query result is normally ready by then, so culling lags one frame behind
+	//
+	// Gl objects are created on first use and only freed by destroy().
+	class gpu_instance_culler {
+	public:
+		// culls set (whose transforms map the mesh's bounding sphere center, radius into the
+		// space modelview takes to view space), see cull_frustum and cull_options
+		void cull(const instance_set &set, const glm::vec3 &center, float radius,
+			const glm::mat4 &modelview, const glm::mat4 &proj, float viewport_height, float pixel_threshold);
+
+		// draws mesh with the compact instances, pointing its instance attributes at them
+		// (reattach the instance_set to draw it unculled again)
+		void draw(gl_mesh &mesh);
+
+		// instances drawn by the last draw(), or -1 if only the gpu knows (indirect path)
+		long long last_drawn() const { return m_last_drawn; }
+
+		// instances given to the last cull()
+		size_t last_tested() const { return m_last_tested; }
+
+		// true if the query result goes straight to an indirect draw (after the first cull)
+		bool indirect() const { return m_indirect; }
+
+		void destroy();
+
+	private:
+		// one output buffer and the query counting what was written to it
+		struct output {
+			GLuint instances = 0; // see interleaved_instance_bytes
+			std::string key; // in resources()
+			GLuint query = 0;
+			size_t capacity = 0;
+			bool culled = false; // holds a cull's result (until drawn, on the indirect path)
+		};
+
+		// handles of the cull shader's uniforms (see program_reflection), found once in init
+		struct uniform_handles {
+			int planes = -1;
+			int depth_row = -1;
+			int bounds = -1;
+			int size_scale = -1;
+			int threshold = -1;
+			int format = -1;
+		};
+
+		GLuint m_program = 0;
+		uniform_handles m_uniforms;
+		GLuint m_vao = 0;
+		GLuint m_command = 0; // indirect draw command
+		bool m_indirect = false;
+		output m_outputs[2];
+		int m_current = 0; // output the last cull wrote
+		long long m_last_drawn = 0;
+		size_t m_last_tested = 0;
+
+		void init();
+	};
+}
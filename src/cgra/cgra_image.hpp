@@ -16,6 +16,7 @@
 
 // project
 #include <opengl.hpp>
+#include "cgra_gl_state.hpp"
 
 
 namespace cgra {
@@ -48,8 +49,7 @@ namespace cgra {
 			assert(size.x * size.y * 4 == data.size()); // check we have consistent size and data
 
 			if (!tex) glGenTextures(1, &tex);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, tex);
+			gl_state().bind_texture(0, GL_TEXTURE_2D, tex);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap.x);
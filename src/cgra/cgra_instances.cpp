@@ -0,0 +1,151 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+
+// project
+#include "cgra_gl_state.hpp"
+#include "cgra_instances.hpp"
+#include "cgra_parallel.hpp"
+#include "cgra_resource.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+		// instances are generated in fixed size blocks, each with its own random stream, so
+		// the result doesn't depend on how the blocks are spread over threads
+		const size_t instance_block = 4096;
+
+		void upload_buffer(GLuint &buffer, const string &key, size_t bytes, const void *data) {
+			if (!buffer) {
+				buffer = resources().acquire_buffer(key, GL_ARRAY_BUFFER, bytes, data);
+				return;
+			}
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, buffer);
+			glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STATIC_DRAW);
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, 0);
+			resources().set_bytes(resource_kind::buffer, buffer, bytes);
+		}
+	}
+
+
+	void instance_set::reserve(size_t count) {
+		transforms.reserve(count);
+		colors.reserve(count);
+	}
+
+
+	void instance_set::push_back(const mat4 &transform, const vec3 &color) {
+		transforms.push_back(transform);
+		colors.push_back(color);
+	}
+
+
+	void instance_set::clear() {
+		transforms.clear();
+		colors.clear();
+	}
+
+
+	void instance_set::upload() {
+		buffer_format = format;
+		if (format == instance_format::full) {
+			upload_buffer(transform_buffer, name + "/transforms", transforms.size() * sizeof(mat4), transforms.data());
+			upload_buffer(color_buffer, name + "/colors", colors.size() * sizeof(vec3), colors.data());
+			return;
+		}
+		vector<unsigned char> packed(transforms.size() * instance_transform_bytes(format));
+		pack_instance_transforms(format, transforms.data(), transforms.size(), packed.data());
+		upload_buffer(transform_buffer, name + "/transforms", packed.size(), packed.data());
+		packed.resize(colors.size() * instance_color_bytes(format));
+		pack_instance_colors(format, colors.data(), colors.size(), packed.data());
+		upload_buffer(color_buffer, name + "/colors", packed.size(), packed.data());
+	}
+
+
+	void * instance_set::map_transforms() {
+		if (transforms.empty()) return nullptr;
+		if (!transform_buffer) upload();
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, transform_buffer);
+		return glMapBufferRange(GL_ARRAY_BUFFER, 0, transforms.size() * instance_transform_bytes(buffer_format), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	}
+
+
+	bool instance_set::unmap_transforms() {
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, transform_buffer);
+		return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+	}
+
+
+	void instance_set::attach(gl_mesh &mesh) {
+		if (!transform_buffer || !color_buffer) upload();
+		GLuint t = resources().acquire(name + "/transforms");
+		GLuint c = resources().acquire(name + "/colors");
+		mesh.set_instance_buffers(t, c, GLsizei(size()), buffer_format);
+	}
+
+
+	void instance_set::destroy() {
+		if (transform_buffer) resources().release(resource_kind::buffer, transform_buffer);
+		if (color_buffer) resources().release(resource_kind::buffer, color_buffer);
+		transform_buffer = 0;
+		color_buffer = 0;
+	}
+
+
+	instance_set make_ring_instances(size_t count, uint32_t seed, const string &name, unsigned threads) {
+		instance_set set;
+		set.name = name;
+		if (count == 0) return set;
+		set.transforms.resize(count);
+		set.colors.resize(count);
+
+		//always load the first one as the central teapot, with the default color
+		set.transforms[0] = mat4(1.0f);
+		set.colors[0] = vec3(0.8, 1, 1);
+
+		const size_t blocks = (count + instance_block - 1) / instance_block;
+		if (threads == 0) threads = hardware_threads();
+		threads = unsigned(std::min<size_t>(threads, blocks));
+
+		parallel_tasks(threads, [&](unsigned k) {
+			for (size_t b = k; b < blocks; b += threads) {
+				seed_seq seq{seed, uint32_t(b)};
+				mt19937 rng(seq);
+				uniform_real_distribution<float> displacement_dist(-20.0f, 20.0f);
+				uniform_real_distribution<float> scale_dist(0.0f, 0.8f);
+				uniform_real_distribution<float> rotation_dist(0.0f, 360.0f);
+				uniform_real_distribution<float> color_dist(0.0f, 1.0f);
+
+				//got this transformation layout idea from tutorial slide links + some changes
+				const float radius = 70;
+				const size_t end = std::min(count, (b + 1) * instance_block);
+				for (size_t i = std::max<size_t>(b * instance_block, 1); i < end; i++) {
+					//translation - infinity ring around central teapot
+					float angle = float(i - 1) / 50.0f * 360.0f;
+					float displacement = displacement_dist(rng);
+					float x = sin(angle) * radius + displacement;
+					float y = tan(angle) * radius + displacement;
+					float z = cos(angle) * radius + displacement;
+					mat4 model = translate(mat4(1.0f), vec3(x, y, z));
+					model = glm::scale(model, vec3(scale_dist(rng)));
+					model = rotate(model, rotation_dist(rng), vec3(0.4f, 0.5f, 0.6f));
+					set.transforms[i] = model;
+					float r = color_dist(rng);
+					float g = color_dist(rng);
+					set.colors[i] = vec3(r, g, color_dist(rng));
+				}
+			}
+		});
+		return set;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+#include "cgra_mesh.hpp"
+
+
+namespace cgra {
+
+	// A set of instances to draw a mesh with, kept apart from the mesh so any number of
+	// meshes can share it and it can be any size. Transforms and colours are stored as
+	// separate arrays, each uploaded to its own gpu buffer (locations 4-7 and 3, see gl_mesh)
+	// in the layout given by format.
+	// The buffers are shared through resources() under name + "/transforms" and name + "/colors",
+	// so names must be unique between sets.
+	struct instance_set {
+		std::string name = "instances";
+		std::vector<glm::mat4> transforms;
+		std::vector<glm::vec3> colors;
+		instance_format format = instance_format::full; // takes effect on the next upload
+
+		GLuint transform_buffer = 0;
+		GLuint color_buffer = 0;
+		instance_format buffer_format = instance_format::full; // what the buffers hold
+
+		size_t size() const { return transforms.size(); }
+
+		void reserve(size_t count);
+		void push_back(const glm::mat4 &transform, const glm::vec3 &color);
+		void clear();
+
+		// copies the instances to the gpu buffers, creating them the first time. meshes already
+		// attached see the new data but keep their old instance count until attached again
+		void upload();
+
+		// maps the transform buffer for writing every transform in buffer_format (uploading first
+		// if needed). its old contents are thrown away, so the gpu doesn't have to finish drawing
+		// with them first. unmap before drawing, false if the contents were lost while mapped
+		// (upload again)
+		void * map_transforms();
+		bool unmap_transforms();
+
+		// points the mesh's instance attributes at this set's buffers (uploading first if needed)
+		// and sets its instance count. the mesh holds its own reference to the buffers
+		void attach(gl_mesh &mesh);
+
+		// releases the set's reference to the buffers (attached meshes keep theirs)
+		void destroy();
+	};
+
+
+	// The ring of instances around a central one at the origin that the demo has always used.
+	// The same count and seed always give the same instances, whatever the thread count.
+	instance_set make_ring_instances(size_t count, std::uint32_t seed, const std::string &name = "instances/ring", unsigned threads = 0);
+}
@@ -0,0 +1,106 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+
+// project
+#include "cgra_lod.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+namespace cgra {
+
+	void gl_lod_mesh::select(const vector<mat4> &transforms, const vector<vec3> &colors,
+		const mat4 &modelview, const mat4 &proj, float viewport_height, float pixel_error)
+	{
+		const size_t level_count = levels.size();
+		level_counts.assign(level_count, 0);
+		batch_transforms.resize(level_count);
+		batch_colors.resize(level_count);
+		for (size_t l = 0; l < level_count; ++l) {
+			batch_transforms[l].clear();
+			batch_colors[l].clear();
+		}
+		if (level_count == 0) return;
+
+		// pixels covered by one unit at a view depth of 1
+		const float pixels_per_unit = proj[1][1] * viewport_height * 0.5f;
+
+		for (size_t i = 0; i < transforms.size(); ++i) {
+			const mat4 m = modelview * transforms[i];
+			const float depth = -(m * vec4(bounds_center, 1)).z;
+			const float scale = std::max(length(vec3(m[0])), std::max(length(vec3(m[1])), length(vec3(m[2]))));
+
+			size_t level = 0;
+			// anything touching the camera plane gets the full mesh
+			if (depth > bounds_radius * scale) {
+				const float pixels = scale * pixels_per_unit / depth;
+				for (size_t l = level_count - 1; l > 0; --l) {
+					if (errors[l] * pixels <= pixel_error) {
+						level = l;
+						break;
+					}
+				}
+			}
+
+			batch_transforms[level].push_back(transforms[i]);
+			batch_colors[level].push_back(i < colors.size() ? colors[i] : vec3(1));
+		}
+
+		for (size_t l = 0; l < level_count; ++l) {
+			level_counts[l] = GLsizei(batch_transforms[l].size());
+			levels[l].update_instances(batch_transforms[l].data(), batch_colors[l].data(), batch_transforms[l].size());
+		}
+	}
+
+
+	void gl_lod_mesh::draw() {
+		for (size_t l = 0; l < levels.size() && l < level_counts.size(); ++l) {
+			levels[l].draw_instanced(level_counts[l]);
+		}
+	}
+
+
+	void gl_lod_mesh::destroy() {
+		for (gl_mesh &level : levels) {
+			level.destroy();
+		}
+		levels.clear();
+		errors.clear();
+		level_counts.clear();
+	}
+
+
+	gl_lod_mesh build_gl_lod_mesh(const vector<mesh_lod> &lods, const vertex_format &format) {
+		vector<gl_mesh> levels;
+		for (const mesh_lod &lod : lods) {
+			const mesh_builder &mb = lod.mesh;
+			levels.push_back(build_gl_mesh(mb.vertices.data(), mb.vertices.size(), mb.indices.data(), mb.indices.size(), mb.mode, format));
+		}
+		return build_gl_lod_mesh(lods, move(levels));
+	}
+
+	gl_lod_mesh build_gl_lod_mesh(const vector<mesh_lod> &lods, vector<gl_mesh> levels) {
+		gl_lod_mesh m;
+		m.levels = move(levels);
+		for (const mesh_lod &lod : lods) {
+			m.errors.push_back(lod.error);
+		}
+
+		if (!lods.empty() && !lods[0].mesh.vertices.empty()) {
+			const vector<mesh_vertex> &vertices = lods[0].mesh.vertices;
+			vec3 bmin = vertices[0].pos, bmax = vertices[0].pos;
+			for (const mesh_vertex &v : vertices) {
+				bmin = glm::min(bmin, v.pos);
+				bmax = glm::max(bmax, v.pos);
+			}
+			m.bounds_center = (bmin + bmax) * 0.5f;
+			for (const mesh_vertex &v : vertices) {
+				m.bounds_radius = std::max(m.bounds_radius, length(v.pos - m.bounds_center));
+			}
+		}
+		return m;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_mesh.hpp"
+#include "cgra_simplify.hpp"
+
+
+namespace cgra {
+
+	// A mesh with several levels of detail, drawn as one instanced batch per level.
+	// select() picks a level for every instance from how big its error is on screen
+	// and fills the instance buffers of each level before draw().
+	struct gl_lod_mesh {
+		std::vector<gl_mesh> levels;  // finest first
+		std::vector<float> errors;    // object space error of each level (see mesh_lod)
+
+		// bounding sphere of the finest level in object space
+		glm::vec3 bounds_center{0};
+		float bounds_radius = 0;
+
+		// how many instances each level drew after the last select()
+		std::vector<GLsizei> level_counts;
+
+		// per level instance lists, kept between frames to avoid reallocating
+		std::vector<std::vector<glm::mat4>> batch_transforms;
+		std::vector<std::vector<glm::vec3>> batch_colors;
+
+		// chooses the coarsest level whose error projects to at most pixel_error pixels
+		// for each instance and uploads the batches. modelview is applied before each transform
+		void select(const std::vector<glm::mat4> &transforms, const std::vector<glm::vec3> &colors,
+			const glm::mat4 &modelview, const glm::mat4 &proj, float viewport_height, float pixel_error);
+
+		// draws every non-empty batch
+		void draw();
+
+		// deletes the gl buffers of every level
+		void destroy();
+	};
+
+	// uploads every level of a LOD chain (see generate_lod_chain)
+	gl_lod_mesh build_gl_lod_mesh(const std::vector<mesh_lod> &lods, const vertex_format &format = {});
+
+	// puts together a LOD mesh from levels that are already on the gpu (one per lod, in the
+	// same order), for example ones streamed in by asset_stream
+	gl_lod_mesh build_gl_lod_mesh(const std::vector<mesh_lod> &lods, std::vector<gl_mesh> levels);
+}
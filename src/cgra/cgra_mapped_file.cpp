@@ -0,0 +1,107 @@
+
+// std
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+// platform
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// project
+#include "cgra_mapped_file.hpp"
+
+
+namespace cgra {
+
+	mapped_file::mapped_file(const std::string &filename) {
+		const auto fail = [&]() {
+			destroy();
+			std::cerr << "Error: could not map " << filename << std::endl;
+			throw std::runtime_error("Error: could not map file " + filename);
+		};
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) fail();
+		m_file = file;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size)) fail();
+		m_size = size_t(size.QuadPart);
+
+		// mapping a zero length file is an error on windows, leave it empty instead
+		if (m_size == 0) return;
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) fail();
+		m_mapping = mapping;
+
+		m_data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (!m_data) fail();
+#else
+		m_fd = ::open(filename.c_str(), O_RDONLY);
+		if (m_fd < 0) fail();
+
+		struct stat st;
+		if (::fstat(m_fd, &st) != 0) fail();
+		m_size = size_t(st.st_size);
+
+		// mmap rejects a zero length, leave it empty instead
+		if (m_size == 0) return;
+
+		void *addr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+		if (addr == MAP_FAILED) fail();
+		m_data = static_cast<const char *>(addr);
+
+		// we always read front to back, let the kernel read ahead aggressively
+		::madvise(addr, m_size, MADV_SEQUENTIAL);
+#endif
+	}
+
+
+	mapped_file::mapped_file(mapped_file &&other) noexcept {
+		*this = std::move(other);
+	}
+
+
+	mapped_file & mapped_file::operator=(mapped_file &&other) noexcept {
+		if (this != &other) {
+			destroy();
+			std::swap(m_data, other.m_data);
+			std::swap(m_size, other.m_size);
+#ifdef _WIN32
+			std::swap(m_file, other.m_file);
+			std::swap(m_mapping, other.m_mapping);
+#else
+			std::swap(m_fd, other.m_fd);
+#endif
+		}
+		return *this;
+	}
+
+
+	void mapped_file::destroy() noexcept {
+#ifdef _WIN32
+		if (m_data) UnmapViewOfFile(m_data);
+		if (m_mapping) CloseHandle(m_mapping);
+		if (m_file) CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = nullptr;
+#else
+		if (m_data) ::munmap(const_cast<char *>(m_data), m_size);
+		if (m_fd >= 0) ::close(m_fd);
+		m_fd = -1;
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+
+
+namespace cgra {
+
+	// Read-only memory mapping of an entire file. Does not allow copying (the
+	// mapping can't be owned by more than one thing) and unmaps the file when
+	// destroyed. The contents are exposed as a contiguous [begin(), end()) range
+	// of chars that is NOT null terminated.
+	class mapped_file {
+	private:
+		const char *m_data = nullptr;
+		size_t m_size = 0;
+#ifdef _WIN32
+		void *m_file = nullptr;
+		void *m_mapping = nullptr;
+#else
+		int m_fd = -1;
+#endif
+
+		void destroy() noexcept;
+
+	public:
+
+		// empty mapping
+		mapped_file() { }
+
+		// maps the given file, throws std::runtime_error if it can't be opened
+		explicit mapped_file(const std::string &filename);
+
+		// remove copy ctors
+		mapped_file(const mapped_file &) = delete;
+		mapped_file & operator=(const mapped_file &) = delete;
+
+		// define move ctors
+		mapped_file(mapped_file &&other) noexcept;
+		mapped_file & operator=(mapped_file &&other) noexcept;
+
+		~mapped_file() {
+			destroy();
+		}
+
+		const char * data() const noexcept { return m_data; }
+		const char * begin() const noexcept { return m_data; }
+		const char * end() const noexcept { return m_data + m_size; }
+		size_t size() const noexcept { return m_size; }
+		bool empty() const noexcept { return m_size == 0; }
+	};
+}
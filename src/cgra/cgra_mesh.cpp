@@ -1,16 +1,18 @@
 
 // std
+#include <cstring>
 #include <stdexcept>
 
 //glm
 #include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 // project
+#include "cgra_gl_state.hpp"
 #include "cgra_mesh.hpp"
-
-#include "cgra/cgra_image.hpp"
+#include "cgra_resource.hpp"
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/string_cast.hpp>
@@ -21,65 +23,505 @@ using namespace std;
 
 namespace cgra {
 
+	namespace {
+		vertex_layout make_vertex_layout(const vertex_format &format) {
+			vertex_layout l;
+			size_t offset = 0;
+
+			l.pos_offset = offset;
+			switch (format.position) {
+			case position_format::snorm16: l.pos_type = GL_SHORT; l.pos_normalized = GL_TRUE; offset += 8; break;
+			case position_format::half16: l.pos_type = GL_HALF_FLOAT; offset += 8; break;
+			default: offset += 12; break;
+			}
+
+			l.norm_offset = offset;
+			if (format.normal == normal_format::oct16) {
+				l.norm_type = GL_SHORT;
+				l.norm_size = 2;
+				l.norm_normalized = GL_TRUE;
+				offset += 4;
+			}
+			else {
+				offset += 12;
+			}
+
+			l.uv_offset = offset;
+			if (format.uv == uv_format::unorm16) {
+				l.uv_type = GL_UNSIGNED_SHORT;
+				l.uv_normalized = GL_TRUE;
+				offset += 4;
+			}
+			else {
+				offset += 8;
+			}
+
+			l.stride = GLsizei(offset);
+			return l;
+		}
+
+		// octahedral normal encoding (Cigolle et al. 2014), result in [-1, 1]
+		vec2 oct_encode(vec3 n) {
+			n /= (abs(n.x) + abs(n.y) + abs(n.z));
+			vec2 e(n.x, n.y);
+			if (n.z < 0) {
+				e = (1.0f - abs(vec2(n.y, n.x))) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+			}
+			return e;
+		}
+
+		template <typename T>
+		void store(unsigned char *dst, const T &value) {
+			memcpy(dst, &value, sizeof(T));
+		}
+
+		// points the per instance attributes of the bound vao at the colour and transform buffers
+		void set_instance_attributes(GLuint colVbo, GLuint instanceVbo, instance_format format) {
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, colVbo);
+			glEnableVertexAttribArray(3);
+			if (format == instance_format::full) {
+				glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)(0));
+			}
+			else {
+				glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4, (void *)(0));
+			}
+			glVertexAttribDivisor(3, 1);
+
+			//the columns of the mat4 attribute that the format fills, the rest are constant
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, instanceVbo);
+			const GLsizei stride = GLsizei(instance_transform_bytes(format));
+			const int columns = stride / int(sizeof(vec4));
+			for (int i = 0; i < 4; i++) {
+				if (i < columns) {
+					glEnableVertexAttribArray(4 + i);
+					glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, stride, (void *)(i * sizeof(vec4)));
+					glVertexAttribDivisor(4 + i, 1);
+				}
+				else {
+					glDisableVertexAttribArray(4 + i);
+				}
+			}
+		}
+
+		// the same for instances interleaved in one buffer, which are always in the full format
+		void set_interleaved_attributes(GLuint instanceVbo) {
+			const GLsizei stride = GLsizei(interleaved_instance_bytes);
+			gl_state().bind_buffer(GL_ARRAY_BUFFER, instanceVbo);
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void *)(sizeof(mat4)));
+			glVertexAttribDivisor(3, 1);
+			for (int i = 0; i < 4; i++) {
+				glEnableVertexAttribArray(4 + i);
+				glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, stride, (void *)(i * sizeof(vec4)));
+				glVertexAttribDivisor(4 + i, 1);
+			}
+		}
+
+		// a mesh without instance buffers is drawn once at the origin in the default colour
+		// (3 to 7 are set every time, drawing from their arrays leaves them undefined)
+		void set_instance_constants(GLuint instanceVbo, instance_format format) {
+			if (instanceVbo) {
+				gl_state().vertex_attrib(10, vec4(float(format), 0, 0, 1));
+				// the bottom row of the affine matrix, which the shader reads transposed
+				if (format == instance_format::affine) glVertexAttrib4f(7, 0, 0, 0, 1);
+				return;
+			}
+			gl_state().vertex_attrib(10, vec4(float(instance_format::full), 0, 0, 1));
+			glVertexAttrib3f(3, 0.8f, 1.0f, 1.0f);
+			for (int i = 0; i < 4; i++) {
+				vec4 column(0);
+				column[i] = 1;
+				glVertexAttrib4fv(4 + i, value_ptr(column));
+			}
+		}
+
+		// rotation quaternion (xyzw) of an orthonormal matrix
+		vec4 rotation_quaternion(const mat3 &r) {
+			// r[column][row]
+			const float trace = r[0][0] + r[1][1] + r[2][2];
+			if (trace > 0) {
+				const float s = std::sqrt(trace + 1) * 2;
+				return vec4((r[1][2] - r[2][1]) / s, (r[2][0] - r[0][2]) / s, (r[0][1] - r[1][0]) / s, 0.25f * s);
+			}
+			if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+				const float s = std::sqrt(1 + r[0][0] - r[1][1] - r[2][2]) * 2;
+				return vec4(0.25f * s, (r[1][0] + r[0][1]) / s, (r[2][0] + r[0][2]) / s, (r[1][2] - r[2][1]) / s);
+			}
+			if (r[1][1] > r[2][2]) {
+				const float s = std::sqrt(1 + r[1][1] - r[0][0] - r[2][2]) * 2;
+				return vec4((r[1][0] + r[0][1]) / s, 0.25f * s, (r[2][1] + r[1][2]) / s, (r[2][0] - r[0][2]) / s);
+			}
+			const float s = std::sqrt(1 + r[2][2] - r[0][0] - r[1][1]) * 2;
+			return vec4((r[2][0] + r[0][2]) / s, (r[2][1] + r[1][2]) / s, 0.25f * s, (r[0][1] - r[1][0]) / s);
+		}
+
+		// instance buffers from the registry are shared, anything else belongs to the mesh
+		void release_buffer(GLuint &buffer) {
+			if (buffer && !resources().release(resource_kind::buffer, buffer)) {
+				gl_state().forget_buffer(buffer);
+				glDeleteBuffers(1, &buffer);
+			}
+			buffer = 0;
+		}
+	}
+
+
 	void gl_mesh::draw() {
-		if (vao == 0) return;
-		// bind our VAO which sets up all our buffers and data for us
-		glBindVertexArray(vao);
-		// tell opengl to draw our VAO using the draw mode and how many verticies to render
         if(!drawInstances){
-            glDrawElementsInstanced(mode, index_count, GL_UNSIGNED_INT, 0, 1);
+            draw_instanced(1);
         } else{
-            glDrawElementsInstanced(mode, index_count, GL_UNSIGNED_INT, 0, 100);
+            draw_instanced(instance_count);
         }
 	}
 
+	void gl_mesh::draw_instanced(GLsizei count) {
+		if (vao == 0 || count <= 0) return;
+		// bind our VAO which sets up all our buffers and data for us (skipped if it already is)
+		gl_state().bind_vertex_array(vao);
+		// constant attributes for decoding quantized vertices (not part of the VAO state)
+		gl_state().vertex_attrib(8, position_decode_scale);
+		gl_state().vertex_attrib(9, vec4(position_decode_offset, 1));
+		set_instance_constants(instanceVbo, instanceFormat);
+		// tell opengl to draw our VAO using the draw mode and how many verticies to render
+		glDrawElementsInstanced(mode, index_count, index_type, 0, count);
+	}
+
+	void gl_mesh::draw_indirect(GLuint buffer, size_t offset) {
+		if (vao == 0) return;
+		gl_state().bind_vertex_array(vao);
+		gl_state().vertex_attrib(8, position_decode_scale);
+		gl_state().vertex_attrib(9, vec4(position_decode_offset, 1));
+		set_instance_constants(instanceVbo, instanceFormat);
+		gl_state().bind_buffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+		glDrawElementsIndirect(mode, index_type, (const void *)(offset));
+	}
+
+	void gl_mesh::draw_ranges(const GLsizei *counts, const void *const *offsets, GLsizei range_count) {
+		if (vao == 0 || range_count <= 0) return;
+		gl_state().bind_vertex_array(vao);
+		gl_state().vertex_attrib(8, position_decode_scale);
+		gl_state().vertex_attrib(9, vec4(position_decode_offset, 1));
+		set_instance_constants(instanceVbo, instanceFormat);
+		glMultiDrawElements(mode, counts, index_type, offsets, range_count);
+	}
+
+	void gl_mesh::update_instances(const mat4 *transforms, const vec3 *colors, size_t count, instance_format format) {
+		if (vao == 0 || count == 0) return;
+		// the shared instance buffers must not change under the other meshes, swap in our own
+		if (!instanceVbo || !colVbo || resources().contains(resource_kind::buffer, instanceVbo) || resources().contains(resource_kind::buffer, colVbo)) {
+			release_buffer(instanceVbo);
+			release_buffer(colVbo);
+			glGenBuffers(1, &instanceVbo);
+			glGenBuffers(1, &colVbo);
+			instanceFormat = format;
+			gl_state().bind_vertex_array(vao);
+			set_instance_attributes(colVbo, instanceVbo, format);
+			gl_state().bind_vertex_array(0);
+		}
+		else if (format != instanceFormat) {
+			instanceFormat = format;
+			gl_state().bind_vertex_array(vao);
+			set_instance_attributes(colVbo, instanceVbo, format);
+			gl_state().bind_vertex_array(0);
+		}
+
+		// the full format goes straight from the arrays, the others are packed first
+		const void *transform_data = transforms;
+		const void *color_data = colors;
+		if (format != instance_format::full) {
+			packedTransforms.resize(count * instance_transform_bytes(format));
+			packedColors.resize(count * instance_color_bytes(format));
+			pack_instance_transforms(format, transforms, count, packedTransforms.data());
+			pack_instance_colors(format, colors, count, packedColors.data());
+			transform_data = packedTransforms.data();
+			color_data = packedColors.data();
+		}
+
+		// orphan and refill, the driver hands back fresh memory if the old buffer is still in use
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, instanceVbo);
+		glBufferData(GL_ARRAY_BUFFER, count * instance_transform_bytes(format), transform_data, GL_STREAM_DRAW);
+		gl_state().bind_buffer(GL_ARRAY_BUFFER, colVbo);
+		glBufferData(GL_ARRAY_BUFFER, count * instance_color_bytes(format), color_data, GL_STREAM_DRAW);
+		instance_count = GLsizei(count);
+	}
+
+	void gl_mesh::set_instance_buffers(GLuint transforms, GLuint colors, GLsizei count, instance_format format) {
+		// when reattaching the same buffers this drops the reference taken last time
+		release_buffer(instanceVbo);
+		release_buffer(colVbo);
+		instanceVbo = transforms;
+		colVbo = colors;
+		instance_count = count;
+		instanceFormat = format;
+		if (vao == 0) return;
+		gl_state().bind_vertex_array(vao);
+		set_instance_attributes(colVbo, instanceVbo, format);
+		gl_state().bind_vertex_array(0);
+	}
+
+	void gl_mesh::set_interleaved_instances(GLuint instances, GLsizei count) {
+		release_buffer(instanceVbo);
+		release_buffer(colVbo);
+		instanceVbo = instances;
+		instance_count = count;
+		instanceFormat = instance_format::full;
+		if (vao == 0) return;
+		gl_state().bind_vertex_array(vao);
+		set_interleaved_attributes(instanceVbo);
+		gl_state().bind_vertex_array(0);
+	}
+
+	void gl_mesh::clear_instance_buffers() {
+		release_buffer(instanceVbo);
+		release_buffer(colVbo);
+		instance_count = 0;
+		instanceFormat = instance_format::full;
+		if (vao == 0) return;
+		gl_state().bind_vertex_array(vao);
+		for (int i = 3; i < 8; i++) glDisableVertexAttribArray(i);
+		gl_state().bind_vertex_array(0);
+	}
+
 	void gl_mesh::destroy() {
 		// delete the data buffers
+		gl_state().forget_vertex_array(vao);
+		gl_state().forget_buffer(vbo);
+		gl_state().forget_buffer(ibo);
 		glDeleteVertexArrays(1, &vao);
 		glDeleteBuffers(1, &vbo);
 		glDeleteBuffers(1, &ibo);
-        glDeleteBuffers(1, &colVbo);
-        glDeleteBuffers(1, &instanceVbo);
+        release_buffer(colVbo);
+        release_buffer(instanceVbo);
 	}
 
 
 	gl_mesh mesh_builder::build() const {
+		return build_gl_mesh(vertices.data(), vertices.size(), indices.data(), indices.size(), mode, format);
+	}
+
+
+	namespace {
+		// everything in a packed_mesh except the data
+		packed_mesh describe_mesh(const mesh_vertex *vertices, size_t vertex_count, size_t index_count, GLenum mode, const vertex_format &format_) {
+			packed_mesh pm;
+			pm.mode = mode;
+			pm.vertex_count = vertex_count;
+			pm.index_count = index_count;
+
+			// unorm16 uvs can only hold [0, 1], keep floats for anything tiled
+			pm.format = format_;
+			if (pm.format.uv == uv_format::unorm16) {
+				for (size_t i = 0; i < vertex_count; ++i) {
+					const vec2 uv = vertices[i].uv;
+					if (uv.x < 0 || uv.y < 0 || uv.x > 1 || uv.y > 1) {
+						pm.format.uv = uv_format::float32;
+						break;
+					}
+				}
+			}
+			pm.layout = make_vertex_layout(pm.format);
+
+			// snorm16 positions are stored relative to the bounds so they use the full range
+			if (pm.format.position == position_format::snorm16) {
+				vec3 bmin{0}, bmax{0};
+				if (vertex_count) {
+					bmin = bmax = vertices[0].pos;
+					for (size_t i = 0; i < vertex_count; ++i) {
+						bmin = glm::min(bmin, vertices[i].pos);
+						bmax = glm::max(bmax, vertices[i].pos);
+					}
+				}
+				vec3 extent = (bmax - bmin) * 0.5f;
+				for (int i = 0; i < 3; ++i) if (extent[i] <= 0) extent[i] = 1;
+				pm.position_decode_scale = vec4(extent, 0);
+				pm.position_decode_offset = (bmin + bmax) * 0.5f;
+			}
+			if (pm.format.normal == normal_format::oct16) {
+				pm.position_decode_scale.w = 1;
+			}
+
+			// half the index bandwidth when every vertex fits in 16 bits
+			pm.index_type = (pm.format.short_indices && vertex_count <= 65536) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+			return pm;
+		}
+	}
+
+
+	packed_mesh pack_mesh(const mesh_vertex *vertices, size_t vertex_count, const GLuint *indices, size_t index_count, GLenum mode, const vertex_format &format_) {
+		packed_mesh pm = describe_mesh(vertices, vertex_count, index_count, mode, format_);
+		const vertex_format &format = pm.format;
+		const vertex_layout &layout = pm.layout;
+
+		if (format.position == position_format::float32 && format.normal == normal_format::float32 && format.uv == uv_format::float32) {
+			pm.vertex_data.assign(reinterpret_cast<const unsigned char *>(vertices), reinterpret_cast<const unsigned char *>(vertices + vertex_count));
+		}
+		else {
+			const vec3 center = pm.position_decode_offset;
+			const vec3 extent = vec3(pm.position_decode_scale);
+
+			// pack every vertex into the smaller layout
+			pm.vertex_data.assign(vertex_count * layout.stride, 0);
+			for (size_t i = 0; i < vertex_count; ++i) {
+				const mesh_vertex &v = vertices[i];
+				unsigned char *dst = pm.vertex_data.data() + i * layout.stride;
+
+				switch (format.position) {
+				case position_format::snorm16: {
+					const vec3 p = (v.pos - center) / extent;
+					const uint16_t q[4] = { packSnorm1x16(p.x), packSnorm1x16(p.y), packSnorm1x16(p.z), 0 };
+					store(dst + layout.pos_offset, q);
+					break;
+				}
+				case position_format::half16: {
+					const uint16_t q[4] = { packHalf1x16(v.pos.x), packHalf1x16(v.pos.y), packHalf1x16(v.pos.z), 0 };
+					store(dst + layout.pos_offset, q);
+					break;
+				}
+				default:
+					store(dst + layout.pos_offset, v.pos);
+					break;
+				}
+
+				if (format.normal == normal_format::oct16) {
+					const float len = length(v.norm);
+					const vec2 e = len > 0 ? oct_encode(v.norm / len) : vec2(0);
+					const uint16_t q[2] = { packSnorm1x16(e.x), packSnorm1x16(e.y) };
+					store(dst + layout.norm_offset, q);
+				}
+				else {
+					store(dst + layout.norm_offset, v.norm);
+				}
+
+				if (format.uv == uv_format::unorm16) {
+					const uint16_t q[2] = { packUnorm1x16(v.uv.x), packUnorm1x16(v.uv.y) };
+					store(dst + layout.uv_offset, q);
+				}
+				else {
+					store(dst + layout.uv_offset, v.uv);
+				}
+			}
+		}
+
+		if (pm.index_type == GL_UNSIGNED_SHORT) {
+			pm.index_data.resize(index_count * sizeof(GLushort));
+			GLushort *dst = reinterpret_cast<GLushort *>(pm.index_data.data());
+			for (size_t i = 0; i < index_count; ++i) dst[i] = GLushort(indices[i]);
+		}
+		else {
+			pm.index_data.assign(reinterpret_cast<const unsigned char *>(indices), reinterpret_cast<const unsigned char *>(indices + index_count));
+		}
+		return pm;
+	}
+
+
+	size_t instance_transform_bytes(instance_format format) {
+		switch (format) {
+		case instance_format::affine: return 3 * sizeof(vec4);
+		case instance_format::pos_quat: return 2 * sizeof(vec4);
+		default: return sizeof(mat4);
+		}
+	}
+
+
+	size_t instance_color_bytes(instance_format format) {
+		return (format == instance_format::full) ? sizeof(vec3) : 4;
+	}
+
+
+	void pack_instance_transform(instance_format format, const mat4 &transform, void *dst) {
+		if (format == instance_format::affine) {
+			// rows, so each is a vec4
+			const vec4 rows[3] = {
+				vec4(transform[0][0], transform[1][0], transform[2][0], transform[3][0]),
+				vec4(transform[0][1], transform[1][1], transform[2][1], transform[3][1]),
+				vec4(transform[0][2], transform[1][2], transform[2][2], transform[3][2])
+			};
+			memcpy(dst, rows, sizeof(rows));
+		}
+		else if (format == instance_format::pos_quat) {
+			// a mirroring transform keeps a proper rotation with a negative scale
+			mat3 rotation(transform);
+			float scale = length(rotation[0]);
+			if (determinant(rotation) < 0) scale = -scale;
+			const vec4 packed[2] = {
+				vec4(vec3(transform[3]), scale),
+				rotation_quaternion(scale != 0 ? mat3(rotation[0] / scale, rotation[1] / scale, rotation[2] / scale) : mat3(1))
+			};
+			memcpy(dst, packed, sizeof(packed));
+		}
+		else {
+			memcpy(dst, &transform, sizeof(mat4));
+		}
+	}
+
+
+	void pack_instance_transforms(instance_format format, const mat4 *transforms, size_t count, void *dst) {
+		if (format == instance_format::full) {
+			memcpy(dst, transforms, count * sizeof(mat4));
+			return;
+		}
+		unsigned char *out = static_cast<unsigned char *>(dst);
+		const size_t bytes = instance_transform_bytes(format);
+		for (size_t i = 0; i < count; ++i) pack_instance_transform(format, transforms[i], out + i * bytes);
+	}
+
+
+	void pack_instance_colors(instance_format format, const vec3 *colors, size_t count, void *dst) {
+		if (format == instance_format::full) {
+			memcpy(dst, colors, count * sizeof(vec3));
+			return;
+		}
+		unsigned char *out = static_cast<unsigned char *>(dst);
+		for (size_t i = 0; i < count; ++i) {
+			const vec3 c = glm::clamp(colors[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+			out[4 * i + 0] = (unsigned char)(c.x);
+			out[4 * i + 1] = (unsigned char)(c.y);
+			out[4 * i + 2] = (unsigned char)(c.z);
+			out[4 * i + 3] = 255;
+		}
+	}
+
+
+	mat4 unpack_instance_transform(instance_format format, const void *src) {
+		mat4 t(1);
+		if (format == instance_format::affine) {
+			vec4 rows[3];
+			memcpy(rows, src, sizeof(rows));
+			for (int c = 0; c < 4; ++c) t[c] = vec4(rows[0][c], rows[1][c], rows[2][c], c == 3 ? 1.0f : 0.0f);
+		}
+		else if (format == instance_format::pos_quat) {
+			vec4 packed[2];
+			memcpy(packed, src, sizeof(packed));
+			const float s = packed[0].w;
+			const vec4 q = packed[1];
+			t[0] = vec4(1 - 2 * (q.y * q.y + q.z * q.z), 2 * (q.x * q.y + q.w * q.z), 2 * (q.x * q.z - q.w * q.y), 0) * s;
+			t[1] = vec4(2 * (q.x * q.y - q.w * q.z), 1 - 2 * (q.x * q.x + q.z * q.z), 2 * (q.y * q.z + q.w * q.x), 0) * s;
+			t[2] = vec4(2 * (q.x * q.z + q.w * q.y), 2 * (q.y * q.z - q.w * q.x), 1 - 2 * (q.x * q.x + q.y * q.y), 0) * s;
+			t[3] = vec4(vec3(packed[0]), 1);
+		}
+		else {
+			memcpy(&t, src, sizeof(mat4));
+		}
+		return t;
+	}
+
+
+	gl_mesh build_gl_mesh(const mesh_vertex *vertices, size_t vertex_count, const GLuint *indices, size_t index_count, GLenum mode, const vertex_format &format) {
+		packed_mesh pm = describe_mesh(vertices, vertex_count, index_count, mode, format);
+		const bool full_precision = pm.format.position == position_format::float32
+			&& pm.format.normal == normal_format::float32 && pm.format.uv == uv_format::float32;
+
+		// upload straight from the arrays when nothing needs converting
+		if (full_precision && pm.index_type == GL_UNSIGNED_INT) {
+			return build_gl_mesh(pm, vertices, indices);
+		}
+		pm = pack_mesh(vertices, vertex_count, indices, index_count, mode, format);
+		return build_gl_mesh(pm, pm.vertex_data.data(), pm.index_data.data());
+	}
+
+
+	gl_mesh build_gl_mesh(const packed_mesh &pm, const void *vertex_data, const void *index_data) {
         gl_mesh m;
-        //populate transformation matrices for instancing
-        m.instanceColors.clear();
-        m.transformations.push_back(mat4(1.0f));   //always load the first one as the central teapot
-        m.instanceColors.push_back(vec3(0.8, 1, 1)); //always load the central teapot as default color
-        
-        //got this transformation layout idea from tutorial slide links + some changes
-        
-        srand(static_cast<unsigned int>(glfwGetTime())); // get semi-random number
-        float radius = 70;
-        float offset = 20;
-        for (unsigned int i = 0; i <99; i++){
-            mat4 model = mat4(1.0f);
-            //translation - infinity ring around central teapot
-            float angle = (float)i / (float)50 * 360.0f;
-            float displacement = (rand() % (int)(offset * 200)) / 100.0f - offset;
-            float x = sin(angle) * radius + displacement;
-            float y = tan(angle) * radius + displacement;
-            float z = cos(angle) * radius + displacement;
-            model = translate(model, vec3(x, y, z));
-            //scale
-            float scale = (rand() % 40) / 50.0;
-            model = glm::scale(model, vec3(scale));
-            //rotation
-            float rotation = (rand() % 360);
-            model = rotate(model, rotation, vec3(0.4f, 0.5f, 0.6f));
-
-            m.transformations.push_back(model);
-            
-            m.instanceColors.push_back(vec3(static_cast <float> (rand()) / static_cast <float> (RAND_MAX), static_cast <float> (rand()) / static_cast <float> (RAND_MAX),static_cast <float> (rand()) / static_cast <float> (RAND_MAX)));
-        }
-        
-        //load texture using help from image_hpp
-        cgra::rgba_image texture_data("res/textures/checkerboard.jpg");
-        //if not opening, please set custom work directory to work folder
-        m.m_texture = texture_data.uploadTexture();
         
         glGenVertexArrays(1, &m.vao); // VAO stores information about how the buffers are set up
         glGenBuffers(1, &m.vbo); // VBO stores the vertex data
@@ -87,66 +529,52 @@ namespace cgra {
 
         // VAO
         //
-        glBindVertexArray(m.vao);
+        gl_state().bind_vertex_array(m.vao);
 
 
         // VBO (single buffer, interleaved)
         //
-        glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
-        // upload ALL the vertex data in one buffer
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(mesh_vertex), &vertices[0], GL_STATIC_DRAW);
+        const vertex_layout &layout = pm.layout;
+        gl_state().bind_buffer(GL_ARRAY_BUFFER, m.vbo);
+        // upload ALL the vertex data in one buffer (or just allocate it if there's no data yet)
+        glBufferData(GL_ARRAY_BUFFER, pm.vertex_count * layout.stride, vertex_data, GL_STATIC_DRAW);
 
         // this buffer will use location=0 when we use our VAO
         glEnableVertexAttribArray(0);
-        // tell opengl how to treat data in location=0 - the data is treated in lots of 3 (3 floats = vec3)
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void *)(offsetof(mesh_vertex, pos)));
+        // tell opengl how to treat data in location=0 - the data is treated in lots of 3 (eg. 3 floats = vec3)
+        glVertexAttribPointer(0, 3, layout.pos_type, layout.pos_normalized, layout.stride, (void *)(layout.pos_offset));
         //glVertexAttribDivisor(0,1);
 
         // do the same thing for Normals but bind it to location=1
         glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void *)(offsetof(mesh_vertex, norm)));
+        glVertexAttribPointer(1, layout.norm_size, layout.norm_type, layout.norm_normalized, layout.stride, (void *)(layout.norm_offset));
 
-        // do the same thing for UVs but bind it to location=2 - the data is treated in lots of 2 (2 floats = vec2)
+        // do the same thing for UVs but bind it to location=2 - the data is treated in lots of 2 (eg. 2 floats = vec2)
         glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void *)(offsetof(mesh_vertex, uv)));
-
-        //color vbo
-        glGenBuffers(1,&m.colVbo);
-        glBindVertexArray(m.vao);
-        glBindBuffer(GL_ARRAY_BUFFER, m.colVbo);
-        glBufferData(GL_ARRAY_BUFFER, m.instanceColors.size() * sizeof(glm::vec3), &m.instanceColors[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void *)(sizeof(vec3)));
-        glVertexAttribDivisor(3, 1);
-        
-        //instance vbo
-        glGenBuffers(1, &m.instanceVbo); //instance vbo
-        glBindVertexArray(m.vao);
-        
-        glBindBuffer(GL_ARRAY_BUFFER, m.instanceVbo);
-        glBufferData(GL_ARRAY_BUFFER, m.transformations.size() * sizeof(glm::mat4), &m.transformations[0], GL_STATIC_DRAW);
-        
-        //for a mat4 attribute
-        for (int i = 0; i < 4; i++) {
-          glEnableVertexAttribArray(4 + i);
-          glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void *)(i * sizeof(vec4)));
-          glVertexAttribDivisor(4 + i, 1);
-        }
+        glVertexAttribPointer(2, 2, layout.uv_type, layout.uv_normalized, layout.stride, (void *)(layout.uv_offset));
+
+        m.vertex_stride = layout.stride;
+        m.position_decode_scale = pm.position_decode_scale;
+        m.position_decode_offset = pm.position_decode_offset;
+
+        //no instance vbos yet, see instance_set::attach
         
         
         // IBO
         //
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+        gl_state().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
         // upload the indices for drawing primitives
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), &indices[0], GL_STATIC_DRAW);
+        const size_t index_size = (pm.index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_size * pm.index_count, index_data, GL_STATIC_DRAW);
 
 
         // set the index count and draw modes
-        m.index_count = indices.size();
-        m.mode = mode;
+        m.index_count = int(pm.index_count);
+        m.index_type = pm.index_type;
+        m.mode = pm.mode;
 
         // clean up by binding VAO 0 (good practice)
-        glBindVertexArray(0);
+        gl_state().bind_vertex_array(0);
 
         return m;
 	}
@@ -16,38 +16,134 @@
 
 namespace cgra {
 
+	// How each vertex attribute is stored on the gpu, chosen per mesh (see vertex_format).
+	// The shader decodes everything back to the float values in mesh_vertex.
+	enum class position_format {
+		float32, // 3 x float (12 bytes)
+		snorm16, // 4 x normalized short relative to the mesh bounds (8 bytes)
+		half16   // 4 x half float (8 bytes)
+	};
+
+	enum class normal_format {
+		float32, // 3 x float (12 bytes)
+		oct16    // octahedral encoding in 2 x normalized short (4 bytes)
+	};
+
+	enum class uv_format {
+		float32, // 2 x float (8 bytes)
+		unorm16  // 2 x normalized unsigned short (4 bytes), float32 is used if any uv is outside [0, 1]
+	};
+
+	struct vertex_format {
+		position_format position = position_format::float32;
+		normal_format normal = normal_format::float32;
+		uv_format uv = uv_format::float32;
+
+		// use GL_UNSIGNED_SHORT indices when every vertex can be addressed with them
+		bool short_indices = true;
+
+		// 16 bytes per vertex instead of 32
+		static vertex_format compact() {
+			return { position_format::snorm16, normal_format::oct16, uv_format::unorm16, true };
+		}
+	};
+
+	// How the per instance attributes are stored on the gpu, chosen per instance_set. The
+	// compact formats only hold a rotation, uniform scale and translation, the shader rebuilds
+	// the mat4 (see gl_mesh).
+	enum class instance_format {
+		full,    // mat4 (64 bytes) and a float colour (12 bytes)
+		affine,  // top three rows of the mat4 (48 bytes) and an RGBA8 colour (4 bytes)
+		pos_quat // translation and scale, then a rotation quaternion xyzw (32 bytes) and an RGBA8 colour (4 bytes)
+	};
+
+	size_t instance_transform_bytes(instance_format format);
+	size_t instance_color_bytes(instance_format format);
+
+	// an instance with its colour interleaved, the full format's mat4 then vec3 in one 76 byte
+	// record (see gl_mesh::set_interleaved_instances)
+	const size_t interleaved_instance_bytes = sizeof(glm::mat4) + sizeof(glm::vec3);
+
+	// packs transforms or colours into the layout of format, dst must hold count * bytes
+	void pack_instance_transforms(instance_format format, const glm::mat4 *transforms, size_t count, void *dst);
+	void pack_instance_colors(instance_format format, const glm::vec3 *colors, size_t count, void *dst);
+
+	// a single transform, for writing straight into a mapped buffer
+	void pack_instance_transform(instance_format format, const glm::mat4 &transform, void *dst);
+
+	// the transform the shader rebuilds from a packed one
+	glm::mat4 unpack_instance_transform(instance_format format, const void *src);
+
+
 	// A data structure for holding buffer IDs and other information related to drawing.
 	// Also has a helper functions for drawing the mesh and deleting the gl buffers.
-	// location 1 : positions (vec3)
-	// location 2 : normals (vec3)
-	// location 3 : uv (vec2)
+	// location 0 : positions (vec3, see position_decode)
+	// location 1 : normals (vec3, or octahedral vec2)
+	// location 2 : uv (vec2)
+	// location 3 : instance colour (vec3, per instance, see instance_set)
+	// location 4-7 : instance transform (mat4, per instance, laid out by instance_format)
+	// location 8 : position decode scale (vec4, w is 1 for octahedral normals), constant
+	// location 9 : position decode offset (vec3), constant
+	// location 10 : instance format (float of the instance_format), constant
 	struct gl_mesh {
 		GLuint vao = 0;
 		GLuint vbo = 0;
 		GLuint ibo = 0;
 		GLenum mode = 0; // mode to draw in, eg: GL_TRIANGLES
 		int index_count = 0; // how many indicies to draw (no primitives)
+		GLenum index_type = GL_UNSIGNED_INT; // GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+		GLsizei vertex_stride = 0; // bytes per vertex in the vbo
+
+		// quantized positions are decoded as offset + scale * position in the shader
+		// these are set as constant vertex attributes in draw() so they follow the mesh
+		// regardless of which shader program is bound
+		glm::vec4 position_decode_scale{1, 1, 1, 0};
+		glm::vec3 position_decode_offset{0};
 
 		// calls the draw function on mesh data
 		void draw();
 
-		// deletes the gl buffers (cleans up all the data)
+		// draws the first count instances in the instance buffers
+		// a mesh without instance buffers draws once, untransformed
+		void draw_instanced(GLsizei count);
+
+		// draws with the parameters in a DrawElementsIndirectCommand at offset bytes into
+		// buffer, needs GL 4.0 or ARB_draw_indirect
+		void draw_indirect(GLuint buffer, size_t offset = 0);
+
+		// draws a single instance of several index ranges (byte offsets), see cull_meshlets
+		void draw_ranges(const GLsizei *counts, const void *const *offsets, GLsizei range_count);
+
+		// replaces the contents of the instance buffers, used for per frame instance batches
+		// the first call swaps any shared instance buffers (see instance_set) for the mesh's own
+		void update_instances(const glm::mat4 *transforms, const glm::vec3 *colors, size_t count,
+			instance_format format = instance_format::full);
+
+		// uses the given buffers for the instance attributes, taking over one reference to each
+		// if they are shared through resources(). the previous instance buffers are released
+		void set_instance_buffers(GLuint transforms, GLuint colors, GLsizei count,
+			instance_format format = instance_format::full);
+
+		// the same for one buffer of interleaved instances (as gpu_instance_culler writes them),
+		// which becomes instanceVbo with colVbo left 0
+		void set_interleaved_instances(GLuint instances, GLsizei count);
+
+		// releases the instance buffers and turns their attributes off, leaving the default
+		// instance (for shaders that make their instances, which must not read past a buffer)
+		void clear_instance_buffers();
+
+		// deletes the gl buffers (cleans up all the data), shared buffers are released instead
 		void destroy();
         
         //whether to draw instances
         bool drawInstances = false;
-        //instance vbo here!!!
-        
-        //list of transformations
-        std::vector<glm::mat4> transformations;
+        //instance vbos, set by instance_set::attach or update_instances
         GLuint instanceVbo = 0;
-        
-        //list of colours
-        std::vector<glm::vec3> instanceColors;
-        GLuint colVbo = 0;
-        
-        //textures
-        GLuint m_texture = 0;
+        GLuint colVbo = 0; // 0 if the colours are interleaved in instanceVbo
+        GLsizei instance_count = 0; // instances in the instance vbos
+        instance_format instanceFormat = instance_format::full; // layout of the instance vbos
+        //packed instances for the smaller formats, refilled by every update_instances
+        std::vector<unsigned char> packedTransforms, packedColors;
         
         //bounding box
         //std::vector<glm::mat4> boundingBoxTransformations;
@@ -69,6 +165,7 @@ namespace cgra {
 		GLenum mode = GL_TRIANGLES;
 		std::vector<mesh_vertex> vertices;
 		std::vector<unsigned int> indices;
+		vertex_format format; // how build() packs the vertices
 
 		mesh_builder() {}
 
@@ -110,5 +207,42 @@ namespace cgra {
 		}
 	};
 
+
+	// Creates the gl buffers for a mesh straight from vertex and index arrays in memory
+	// (for example a memory mapped file) without going through a mesh_builder.
+	gl_mesh build_gl_mesh(const mesh_vertex *vertices, size_t vertex_count, const GLuint *indices, size_t index_count, GLenum mode, const vertex_format &format = {});
+
+
+	// byte offsets and gl types of each vertex attribute for a vertex_format
+	struct vertex_layout {
+		GLsizei stride = 0;
+		size_t pos_offset = 0, norm_offset = 0, uv_offset = 0;
+		GLenum pos_type = GL_FLOAT, norm_type = GL_FLOAT, uv_type = GL_FLOAT;
+		GLint norm_size = 3;
+		GLboolean pos_normalized = GL_FALSE, norm_normalized = GL_FALSE, uv_normalized = GL_FALSE;
+	};
+
+	// Vertex and index data already in the layout the gpu buffers use
+	struct packed_mesh {
+		GLenum mode = GL_TRIANGLES;
+		vertex_format format;  // what was actually used (unorm16 uvs may have fallen back to float32)
+		vertex_layout layout;
+		size_t vertex_count = 0;
+		size_t index_count = 0;
+		GLenum index_type = GL_UNSIGNED_INT;
+		glm::vec4 position_decode_scale{1, 1, 1, 0};
+		glm::vec3 position_decode_offset{0};
+		std::vector<unsigned char> vertex_data; // vertex_count * layout.stride bytes
+		std::vector<unsigned char> index_data;  // index_count indices of index_type
+	};
+
+	// packs a mesh into its gpu layout. makes no gl calls so it can run on any thread
+	packed_mesh pack_mesh(const mesh_vertex *vertices, size_t vertex_count, const GLuint *indices, size_t index_count, GLenum mode, const vertex_format &format = {});
+
+	// Creates the gl objects for a packed mesh from the given data (normally pm.vertex_data
+	// and pm.index_data). If the data pointers are null the buffers are only allocated, to be
+	// filled later with glBufferSubData or glCopyBufferSubData (see asset_stream).
+	gl_mesh build_gl_mesh(const packed_mesh &pm, const void *vertex_data, const void *index_data);
+
 }
 
@@ -0,0 +1,346 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_mesh_optimize.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+namespace cgra {
+
+	namespace {
+
+		// Forsyth scoring constants (the values from the original paper)
+		const int forsyth_cache_size = 32;
+		const float forsyth_decay_power = 1.5f;
+		const float forsyth_last_tri_score = 0.75f;
+		const float forsyth_valence_scale = 2.0f;
+		const float forsyth_valence_power = 0.5f;
+		const int forsyth_valence_table_size = 32;
+
+		struct forsyth_tables {
+			float cache[forsyth_cache_size];
+			float valence[forsyth_valence_table_size];
+
+			forsyth_tables() {
+				for (int i = 0; i < forsyth_cache_size; ++i) {
+					// the last triangle's three vertices get a fixed score so the next triangle
+					// doesn't just reuse the same edge (which gives long thin strips)
+					cache[i] = (i < 3) ? forsyth_last_tri_score
+						: pow(1.f - float(i - 3) / (forsyth_cache_size - 3), forsyth_decay_power);
+				}
+				valence[0] = 0;
+				for (int i = 1; i < forsyth_valence_table_size; ++i) {
+					valence[i] = forsyth_valence_scale * pow(float(i), -forsyth_valence_power);
+				}
+			}
+		};
+
+		float forsyth_score(const forsyth_tables &t, int cache_pos, unsigned remaining) {
+			// no triangles left to use this vertex
+			if (remaining == 0) return -1.f;
+			float score = (cache_pos >= 0) ? t.cache[cache_pos] : 0.f;
+			score += (remaining < unsigned(forsyth_valence_table_size)) ? t.valence[remaining]
+				: forsyth_valence_scale * pow(float(remaining), -forsyth_valence_power);
+			return score;
+		}
+
+
+		// FIFO cache simulation, returns the number of misses for one triangle
+		// timestamps hold when each vertex last entered the cache
+		struct fifo_cache {
+			vector<unsigned> timestamps;
+			unsigned time;
+			unsigned size;
+
+			fifo_cache(size_t vertex_count, unsigned size_) : timestamps(vertex_count, 0), time(size_ + 1), size(size_) { }
+
+			void reset() {
+				// pushes every vertex out of the cache without touching the array
+				time += size + 1;
+			}
+
+			unsigned triangle(const GLuint *tri) {
+				unsigned misses = 0;
+				for (int k = 0; k < 3; ++k) {
+					if (time - timestamps[tri[k]] > size) {
+						timestamps[tri[k]] = time++;
+						misses++;
+					}
+				}
+				return misses;
+			}
+		};
+	}
+
+
+	vertex_cache_stats analyze_vertex_cache(const GLuint *indices, size_t index_count, size_t vertex_count, unsigned cache_size) {
+		vertex_cache_stats stats;
+		if (index_count < 3 || vertex_count == 0) return stats;
+
+		fifo_cache cache(vertex_count, cache_size);
+		size_t misses = 0;
+		for (size_t i = 0; i + 2 < index_count; i += 3) {
+			misses += cache.triangle(indices + i);
+		}
+
+		// only count vertices the index buffer actually uses
+		vector<bool> used(vertex_count, false);
+		size_t used_count = 0;
+		for (size_t i = 0; i < index_count; ++i) {
+			if (!used[indices[i]]) {
+				used[indices[i]] = true;
+				used_count++;
+			}
+		}
+
+		stats.acmr = float(misses) / float(index_count / 3);
+		stats.atvr = float(misses) / float(used_count);
+		return stats;
+	}
+
+
+	void optimize_vertex_cache(vector<GLuint> &indices, size_t vertex_count) {
+		static const forsyth_tables tables;
+
+		const size_t tri_count = indices.size() / 3;
+		if (tri_count == 0) return;
+
+		// triangle adjacency per vertex (compressed rows)
+		// live_count is how many at the front of each row haven't been emitted
+		vector<unsigned> live_count(vertex_count, 0);
+		for (size_t i = 0; i < tri_count * 3; ++i) live_count[indices[i]]++;
+
+		vector<unsigned> offsets(vertex_count + 1, 0);
+		for (size_t v = 0; v < vertex_count; ++v) offsets[v + 1] = offsets[v] + live_count[v];
+
+		vector<unsigned> adjacency(tri_count * 3);
+		{
+			vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t t = 0; t < tri_count; ++t) {
+				for (int k = 0; k < 3; ++k) adjacency[fill[indices[t * 3 + k]]++] = unsigned(t);
+			}
+		}
+
+		vector<int> cache_pos(vertex_count, -1);
+		vector<float> vertex_score(vertex_count);
+		for (size_t v = 0; v < vertex_count; ++v) {
+			vertex_score[v] = forsyth_score(tables, -1, live_count[v]);
+		}
+
+		vector<float> tri_score(tri_count);
+		vector<bool> emitted(tri_count, false);
+		for (size_t t = 0; t < tri_count; ++t) {
+			tri_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+		}
+
+		// the cache holds up to forsyth_cache_size entries plus the 3 pushed in by a new triangle
+		vector<GLuint> cache, new_cache;
+		cache.reserve(forsyth_cache_size + 3);
+		new_cache.reserve(forsyth_cache_size + 3);
+
+		vector<GLuint> result;
+		result.reserve(tri_count * 3);
+
+		const auto update_vertex = [&](GLuint v) {
+			float score = forsyth_score(tables, cache_pos[v], live_count[v]);
+			float delta = score - vertex_score[v];
+			vertex_score[v] = score;
+			for (unsigned a = offsets[v]; a < offsets[v] + live_count[v]; ++a) {
+				tri_score[adjacency[a]] += delta;
+			}
+		};
+
+		size_t best = size_t(max_element(tri_score.begin(), tri_score.end()) - tri_score.begin());
+		size_t cursor = 0;
+
+		for (size_t emitted_count = 0; emitted_count < tri_count; ++emitted_count) {
+			const GLuint *tri = &indices[best * 3];
+			result.insert(result.end(), tri, tri + 3);
+			emitted[best] = true;
+
+			// remove the triangle from each of its vertices' live adjacency
+			for (int k = 0; k < 3; ++k) {
+				GLuint v = tri[k];
+				unsigned *row = &adjacency[offsets[v]];
+				unsigned *last = row + live_count[v] - 1;
+				*find(row, last + 1, unsigned(best)) = *last;
+				*last = unsigned(best);
+				live_count[v]--;
+			}
+
+			// push the triangle's vertices to the front of the LRU cache
+			new_cache.assign(tri, tri + 3);
+			for (GLuint v : cache) {
+				if (v != tri[0] && v != tri[1] && v != tri[2]) new_cache.push_back(v);
+			}
+			swap(cache, new_cache);
+
+			// anything pushed off the end loses its cache score
+			for (size_t i = forsyth_cache_size; i < cache.size(); ++i) {
+				cache_pos[cache[i]] = -1;
+				update_vertex(cache[i]);
+			}
+			if (cache.size() > size_t(forsyth_cache_size)) cache.resize(forsyth_cache_size);
+
+			for (size_t i = 0; i < cache.size(); ++i) {
+				cache_pos[cache[i]] = int(i);
+				update_vertex(cache[i]);
+			}
+
+			// the next triangle is the best one touching the cache
+			float best_score = -1e30f;
+			bool found = false;
+			for (GLuint v : cache) {
+				for (unsigned a = offsets[v]; a < offsets[v] + live_count[v]; ++a) {
+					unsigned t = adjacency[a];
+					if (tri_score[t] > best_score) {
+						best_score = tri_score[t];
+						best = t;
+						found = true;
+					}
+				}
+			}
+
+			// nothing in the cache has triangles left, carry on from the next unused triangle
+			if (!found) {
+				while (cursor < tri_count && emitted[cursor]) cursor++;
+				if (cursor == tri_count) break;
+				best = cursor;
+			}
+		}
+
+		indices.swap(result);
+	}
+
+
+	void optimize_overdraw(vector<GLuint> &indices, const vector<mesh_vertex> &vertices, float threshold) {
+		const unsigned cache_size = 16;
+		const size_t tri_count = indices.size() / 3;
+		if (tri_count == 0) return;
+
+		fifo_cache cache(vertices.size(), cache_size);
+
+		// hard boundaries are where the cache order already starts over (all three vertices miss)
+		vector<size_t> hard;
+		for (size_t t = 0; t < tri_count; ++t) {
+			if (cache.triangle(&indices[t * 3]) == 3) hard.push_back(t);
+		}
+		hard.push_back(tri_count);
+		if (hard.front() != 0) hard.insert(hard.begin(), 0);
+
+		// soft boundaries split each hard cluster further, as long as each piece
+		// (with a cold cache) is no worse than threshold times the whole cluster's acmr
+		vector<size_t> clusters;
+		for (size_t h = 0; h + 1 < hard.size(); ++h) {
+			size_t start = hard[h];
+			size_t end = hard[h + 1];
+			if (start == end) continue;
+
+			cache.reset();
+			size_t cluster_misses = 0;
+			for (size_t t = start; t < end; ++t) cluster_misses += cache.triangle(&indices[t * 3]);
+			float limit = threshold * float(cluster_misses) / float(end - start);
+
+			cache.reset();
+			size_t piece_start = start;
+			size_t piece_misses = 0;
+			clusters.push_back(start);
+			for (size_t t = start; t < end; ++t) {
+				piece_misses += cache.triangle(&indices[t * 3]);
+				if (t + 1 < end && float(piece_misses) / float(t + 1 - piece_start) <= limit) {
+					clusters.push_back(t + 1);
+					piece_start = t + 1;
+					piece_misses = 0;
+					cache.reset();
+				}
+			}
+		}
+		clusters.push_back(tri_count);
+
+		// sort key is how far each cluster faces out from the middle of the mesh
+		vec3 mesh_centroid{0};
+		float mesh_area = 0;
+		vector<vec3> cluster_centroid(clusters.size() - 1, vec3(0));
+		vector<vec3> cluster_normal(clusters.size() - 1, vec3(0));
+		vector<float> cluster_area(clusters.size() - 1, 0);
+		for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+			for (size_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+				const vec3 &a = vertices[indices[t * 3]].pos;
+				const vec3 &b = vertices[indices[t * 3 + 1]].pos;
+				const vec3 &d = vertices[indices[t * 3 + 2]].pos;
+				vec3 n = cross(b - a, d - a);
+				float area = length(n);
+				cluster_centroid[c] += (a + b + d) * (area / 3.f);
+				cluster_normal[c] += n;
+				cluster_area[c] += area;
+			}
+			mesh_centroid += cluster_centroid[c];
+			mesh_area += cluster_area[c];
+		}
+		if (mesh_area > 0) mesh_centroid /= mesh_area;
+
+		vector<float> sort_key(clusters.size() - 1, 0);
+		for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+			if (cluster_area[c] <= 0) continue;
+			vec3 centroid = cluster_centroid[c] / cluster_area[c];
+			float nl = length(cluster_normal[c]);
+			if (nl > 0) sort_key[c] = dot(centroid - mesh_centroid, cluster_normal[c] / nl);
+		}
+
+		vector<size_t> order(clusters.size() - 1);
+		iota(order.begin(), order.end(), size_t(0));
+		stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) { return sort_key[x] > sort_key[y]; });
+
+		vector<GLuint> result;
+		result.reserve(indices.size());
+		for (size_t c : order) {
+			result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+		}
+		indices.swap(result);
+	}
+
+
+	void optimize_vertex_fetch(mesh_builder &mb) {
+		const GLuint unused = GLuint(-1);
+		vector<GLuint> remap(mb.vertices.size(), unused);
+		vector<mesh_vertex> vertices;
+		vertices.reserve(mb.vertices.size());
+
+		for (GLuint &i : mb.indices) {
+			if (remap[i] == unused) {
+				remap[i] = GLuint(vertices.size());
+				vertices.push_back(mb.vertices[i]);
+			}
+			i = remap[i];
+		}
+
+		// vertices no index refers to are dropped
+		mb.vertices.swap(vertices);
+	}
+
+
+	mesh_optimize_stats optimize_mesh(mesh_builder &mb) {
+		mesh_optimize_stats stats;
+		stats.before = analyze_vertex_cache(mb.indices.data(), mb.indices.size(), mb.vertices.size());
+		if (mb.mode != GL_TRIANGLES) {
+			stats.after = stats.before;
+			return stats;
+		}
+
+		optimize_vertex_cache(mb.indices, mb.vertices.size());
+		optimize_overdraw(mb.indices, mb.vertices);
+		optimize_vertex_fetch(mb);
+
+		stats.after = analyze_vertex_cache(mb.indices.data(), mb.indices.size(), mb.vertices.size());
+		return stats;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// std
+#include <vector>
+
+// project
+#include "cgra_mesh.hpp"
+
+
+namespace cgra {
+
+	// post-transform vertex cache efficiency of an index buffer
+	// acmr : average cache miss ratio, vertex shader runs per triangle (0.5 is ideal, 3 is worst)
+	// atvr : average transformed vertex ratio, vertex shader runs per vertex (1 is ideal)
+	struct vertex_cache_stats {
+		float acmr = 0;
+		float atvr = 0;
+	};
+
+	struct mesh_optimize_stats {
+		vertex_cache_stats before;
+		vertex_cache_stats after;
+	};
+
+	// simulates a FIFO post-transform cache of the given size over a triangle list
+	vertex_cache_stats analyze_vertex_cache(const GLuint *indices, size_t index_count, size_t vertex_count, unsigned cache_size = 16);
+
+	// reorders triangles to maximise post-transform cache hits (Forsyth's linear-speed algorithm)
+	void optimize_vertex_cache(std::vector<GLuint> &indices, size_t vertex_count);
+
+	// reorders clusters of triangles (as produced by optimize_vertex_cache) so outward facing
+	// clusters come first, reducing overdraw from any view direction (Sander et al. 2007).
+	// clusters are only split where it costs no more than threshold times the cache misses
+	void optimize_overdraw(std::vector<GLuint> &indices, const std::vector<mesh_vertex> &vertices, float threshold = 1.05f);
+
+	// reorders the vertex array into the order the index buffer first uses them
+	// (improves pre-transform vertex fetch locality) and rewrites the indices to match
+	void optimize_vertex_fetch(mesh_builder &mb);
+
+	// runs all of the above on a triangle list mesh, in that order. call before mesh_builder::build()
+	mesh_optimize_stats optimize_mesh(mesh_builder &mb);
+}
@@ -0,0 +1,249 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_meshlet.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+namespace cgra {
+
+	namespace {
+
+		// how many new vertices a triangle facing the opposite way to the meshlet is worth
+		const float cone_weight = 1.0f;
+
+		// bounds and normal cone for the triangles of one meshlet
+		void compute_bounds(meshlet &m, const GLuint *indices, const vector<mesh_vertex> &vertices) {
+			const size_t tri_count = m.index_count / 3;
+
+			vec3 bmin = vertices[indices[0]].pos, bmax = bmin;
+			for (size_t i = 0; i < m.index_count; ++i) {
+				bmin = glm::min(bmin, vertices[indices[i]].pos);
+				bmax = glm::max(bmax, vertices[indices[i]].pos);
+			}
+			m.center = (bmin + bmax) * 0.5f;
+			m.radius = 0;
+			for (size_t i = 0; i < m.index_count; ++i) {
+				m.radius = std::max(m.radius, length(vertices[indices[i]].pos - m.center));
+			}
+
+			// average of the unit face normals, then the widest angle from it
+			vector<vec3> normals;
+			normals.reserve(tri_count);
+			vec3 axis{0};
+			for (size_t t = 0; t < tri_count; ++t) {
+				const vec3 a = vertices[indices[t * 3]].pos;
+				const vec3 b = vertices[indices[t * 3 + 1]].pos;
+				const vec3 c = vertices[indices[t * 3 + 2]].pos;
+				const vec3 n = cross(b - a, c - a);
+				const float l = length(n);
+				if (l <= 0) continue; // degenerate triangles can never be seen
+				normals.push_back(n / l);
+				axis += n / l;
+			}
+
+			const float axis_length = length(axis);
+			if (normals.empty() || axis_length <= 0) {
+				m.cone_axis = vec3(0, 0, 1);
+				m.cone_cutoff = 1;
+				return;
+			}
+			m.cone_axis = axis / axis_length;
+
+			float min_dot = 1;
+			for (const vec3 &n : normals) {
+				min_dot = std::min(min_dot, dot(n, m.cone_axis));
+			}
+
+			// sin of the cone's half angle, the test in cull_meshlets needs the view direction
+			// to be more than 90 degrees from every normal
+			m.cone_cutoff = (min_dot <= 0) ? 1 : sqrt(1 - min_dot * min_dot);
+		}
+	}
+
+
+	vector<meshlet> build_meshlets(mesh_builder &mb, size_t max_vertices, size_t max_triangles) {
+		vector<meshlet> meshlets;
+		if (mb.mode != GL_TRIANGLES) return meshlets;
+
+		const size_t vertex_count = mb.vertices.size();
+		const size_t tri_count = mb.indices.size() / 3;
+		if (tri_count == 0) return meshlets;
+		max_vertices = std::max(max_vertices, size_t(3));
+		max_triangles = std::max(max_triangles, size_t(1));
+
+		// triangle adjacency per vertex (compressed rows)
+		vector<unsigned> offsets(vertex_count + 1, 0);
+		for (size_t i = 0; i < tri_count * 3; ++i) offsets[mb.indices[i] + 1]++;
+		for (size_t v = 0; v < vertex_count; ++v) offsets[v + 1] += offsets[v];
+		vector<unsigned> adjacency(tri_count * 3);
+		{
+			vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t t = 0; t < tri_count; ++t) {
+				for (int k = 0; k < 3; ++k) adjacency[fill[mb.indices[t * 3 + k]]++] = unsigned(t);
+			}
+		}
+
+		vector<vec3> face_normals(tri_count);
+		for (size_t t = 0; t < tri_count; ++t) {
+			const vec3 a = mb.vertices[mb.indices[t * 3]].pos;
+			const vec3 b = mb.vertices[mb.indices[t * 3 + 1]].pos;
+			const vec3 c = mb.vertices[mb.indices[t * 3 + 2]].pos;
+			const vec3 n = cross(b - a, c - a);
+			const float l = length(n);
+			face_normals[t] = l > 0 ? n / l : vec3(0);
+		}
+
+		vector<bool> emitted(tri_count, false);
+		vector<unsigned> in_meshlet(vertex_count, ~0u); // id of the meshlet a vertex was last added to
+		vector<GLuint> result;
+		result.reserve(tri_count * 3);
+
+		size_t cursor = 0;
+		size_t emitted_count = 0;
+		vector<GLuint> meshlet_vertices;
+		meshlet_vertices.reserve(max_vertices);
+
+		while (emitted_count < tri_count) {
+			const unsigned id = unsigned(meshlets.size());
+			meshlet m;
+			m.index_offset = GLuint(result.size());
+			meshlet_vertices.clear();
+			vec3 cone{0};
+
+			// seed with the next triangle in the existing order
+			while (emitted[cursor]) cursor++;
+			size_t next = cursor;
+
+			while (next != size_t(-1)) {
+				const GLuint *tri = &mb.indices[next * 3];
+				for (int k = 0; k < 3; ++k) {
+					if (in_meshlet[tri[k]] != id) {
+						in_meshlet[tri[k]] = id;
+						meshlet_vertices.push_back(tri[k]);
+					}
+				}
+				result.insert(result.end(), tri, tri + 3);
+				emitted[next] = true;
+				emitted_count++;
+				m.index_count += 3;
+				if (m.index_count / 3 >= max_triangles) break;
+
+				cone += face_normals[next];
+
+				// the neighbour that fits and adds the fewest new vertices, weighted
+				// by how far its normal is from the meshlet's to keep the cone narrow
+				next = size_t(-1);
+				float best_score = numeric_limits<float>::max();
+				const float cone_length = length(cone);
+				const vec3 axis = cone_length > 0 ? cone / cone_length : vec3(0);
+				for (GLuint v : meshlet_vertices) {
+					for (unsigned a = offsets[v]; a < offsets[v + 1]; ++a) {
+						const unsigned t = adjacency[a];
+						if (emitted[t]) continue;
+						const GLuint *candidate = &mb.indices[t * 3];
+						int new_vertices = 0;
+						for (int k = 0; k < 3; ++k) new_vertices += (in_meshlet[candidate[k]] != id);
+						if (meshlet_vertices.size() + new_vertices > max_vertices) continue;
+						const float score = float(new_vertices) + cone_weight * (1 - dot(face_normals[t], axis));
+						if (score < best_score) {
+							best_score = score;
+							next = t;
+						}
+					}
+				}
+			}
+
+			m.vertex_count = GLuint(meshlet_vertices.size());
+			compute_bounds(m, &result[m.index_offset], mb.vertices);
+			meshlets.push_back(m);
+		}
+
+		mb.indices.swap(result);
+		return meshlets;
+	}
+
+
+	void cull_meshlets(const vector<meshlet> &meshlets, const mat4 &modelview, const mat4 &proj,
+		size_t index_size, meshlet_draw_list &out)
+	{
+		out.counts.clear();
+		out.offsets.clear();
+		out.meshlets = 0;
+		out.triangles = 0;
+
+		// frustum planes in view space (Gribb and Hartmann), left right bottom top near far
+		vec4 planes[6];
+		const mat4 m = transpose(proj);
+		planes[0] = m[3] + m[0];
+		planes[1] = m[3] - m[0];
+		planes[2] = m[3] + m[1];
+		planes[3] = m[3] - m[1];
+		planes[4] = m[3] + m[2];
+		planes[5] = m[3] - m[2];
+		for (vec4 &p : planes) p /= length(vec3(p));
+
+		const float scale = std::max(length(vec3(modelview[0])), std::max(length(vec3(modelview[1])), length(vec3(modelview[2]))));
+
+		// camera position in object space for the cone test
+		const vec3 camera = vec3(inverse(modelview) * vec4(0, 0, 0, 1));
+
+		GLuint range_start = 0, range_end = 0;
+		bool open = false;
+		const auto flush = [&]() {
+			if (!open) return;
+			out.counts.push_back(GLsizei(range_end - range_start));
+			out.offsets.push_back(reinterpret_cast<const void *>(size_t(range_start) * index_size));
+			open = false;
+		};
+
+		for (const meshlet &ml : meshlets) {
+			bool visible = true;
+
+			// backfacing cone
+			const vec3 to_center = ml.center - camera;
+			if (ml.cone_cutoff < 1 && dot(to_center, ml.cone_axis) >= ml.cone_cutoff * length(to_center) + ml.radius) {
+				visible = false;
+			}
+
+			// outside any frustum plane
+			if (visible) {
+				const vec4 center = modelview * vec4(ml.center, 1);
+				const float radius = ml.radius * scale;
+				for (const vec4 &p : planes) {
+					if (dot(vec3(p), vec3(center)) + p.w < -radius) {
+						visible = false;
+						break;
+					}
+				}
+			}
+
+			if (!visible) {
+				flush();
+				continue;
+			}
+
+			out.meshlets++;
+			out.triangles += ml.index_count / 3;
+			if (open && range_end == ml.index_offset) {
+				range_end += ml.index_count;
+			}
+			else {
+				flush();
+				range_start = ml.index_offset;
+				range_end = ml.index_offset + ml.index_count;
+				open = true;
+			}
+		}
+		flush();
+	}
+}
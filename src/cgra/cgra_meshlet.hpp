@@ -0,0 +1,57 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_mesh.hpp"
+
+
+namespace cgra {
+
+	// A small cluster of triangles that is culled as a whole. The triangles are a contiguous
+	// range of the mesh's index buffer (after build_meshlets has reordered it).
+	struct meshlet {
+		GLuint index_offset = 0; // first index in the index buffer
+		GLuint index_count = 0;
+		GLuint vertex_count = 0; // unique vertices used
+
+		// bounding sphere (object space)
+		glm::vec3 center{0};
+		float radius = 0;
+
+		// normal cone, every triangle is backfacing when seen from a point p with
+		// dot(center - p, cone_axis) >= cone_cutoff * length(center - p) + radius
+		// cone_cutoff is 1 (never backfacing) when the normals spread over more than a hemisphere
+		glm::vec3 cone_axis{0, 0, 1};
+		float cone_cutoff = 1;
+	};
+
+	// Partitions a triangle list into meshlets of at most max_vertices and max_triangles and
+	// reorders mb.indices so each meshlet is contiguous. Meshlets are grown from a seed triangle
+	// by adding the neighbouring triangle that brings in the fewest new vertices and is closest
+	// to facing the same way, so they stay compact and their normal cones stay narrow. Seeds
+	// follow the existing triangle order, so run optimize_mesh first to keep the vertex cache
+	// order mostly intact.
+	std::vector<meshlet> build_meshlets(mesh_builder &mb, size_t max_vertices = 64, size_t max_triangles = 124);
+
+
+	// Index ranges left after culling, in the form glMultiDrawElements takes.
+	// Adjacent visible meshlets are merged into a single range.
+	struct meshlet_draw_list {
+		std::vector<GLsizei> counts;
+		std::vector<const void *> offsets; // byte offsets into the index buffer
+		size_t meshlets = 0;               // meshlets that survived culling
+		size_t triangles = 0;              // triangles in the ranges
+	};
+
+	// Culls meshlets that are entirely outside the view frustum or entirely backfacing for one
+	// view of the mesh. modelview takes the mesh's object space to view space and must not
+	// contain non-uniform scale (the cone test is done in object space). index_size is the size
+	// of one index in the gpu index buffer (see gl_mesh::index_type).
+	void cull_meshlets(const std::vector<meshlet> &meshlets, const glm::mat4 &modelview, const glm::mat4 &proj,
+		size_t index_size, meshlet_draw_list &out);
+}
@@ -0,0 +1,185 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// glm
+#include <glm/gtc/constants.hpp>
+
+// project
+#include "cgra_normals.hpp"
+#include "cgra_parallel.hpp"
+#include "cgra_simd.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+namespace cgra {
+
+	namespace {
+
+		using namespace simd;
+
+		const int block = vfloat::width;
+
+		// acos to within 7e-5 radians (Abramowitz and Stegun 4.4.45)
+		inline vfloat vacos(vfloat x) {
+			const vfloat ax = vmin(vabs(x), vfloat(1.f));
+			vfloat p = vfloat(-0.0187293f) * ax + vfloat(0.0742610f);
+			p = p * ax - vfloat(0.2121144f);
+			p = p * ax + vfloat(1.5707288f);
+			const vfloat r = vsqrt(vfloat(1.f) - ax) * p;
+			return if_negative(x, vfloat(pi<float>()) - r, r);
+		}
+
+		// angle between two vectors given their dot product and squared lengths
+		inline vfloat vangle(vfloat d, vfloat l0, vfloat l1) {
+			const vfloat denom = vsqrt(vmax(l0 * l1, vfloat(1e-30f)));
+			return vacos(vmax(vmin(d / denom, vfloat(1.f)), vfloat(-1.f)));
+		}
+
+		// weighted face normals for one block of triangles, corners in SoA
+		// out: nx ny nz (the face normal) and wa wb wc (its weight at each corner)
+		struct face_block {
+			alignas(32) float ax[block], ay[block], az[block];
+			alignas(32) float bx[block], by[block], bz[block];
+			alignas(32) float cx[block], cy[block], cz[block];
+			alignas(32) float nx[block], ny[block], nz[block];
+			alignas(32) float wa[block], wb[block], wc[block];
+
+			void compute(normal_weighting weighting) {
+				const vfloat pax = vfloat::load(ax), pay = vfloat::load(ay), paz = vfloat::load(az);
+				const vfloat e1x = vfloat::load(bx) - pax, e1y = vfloat::load(by) - pay, e1z = vfloat::load(bz) - paz;
+				const vfloat e2x = vfloat::load(cx) - pax, e2y = vfloat::load(cy) - pay, e2z = vfloat::load(cz) - paz;
+
+				// cross product, its length is twice the triangle's area
+				vfloat x = e1y * e2z - e1z * e2y;
+				vfloat y = e1z * e2x - e1x * e2z;
+				vfloat z = e1x * e2y - e1y * e2x;
+
+				const vfloat one(1.f);
+				vfloat w0 = one, w1 = one, w2 = one;
+
+				if (weighting != normal_weighting::area) {
+					// unit length, degenerate faces are zeroed
+					const vfloat len = vsqrt(x * x + y * y + z * z);
+					const vfloat inv = if_positive(len, one / vmax(len, vfloat(1e-30f)));
+					x = x * inv;
+					y = y * inv;
+					z = z * inv;
+				}
+
+				if (weighting == normal_weighting::angle) {
+					// angles at a and b, the angle at c is whatever is left of pi
+					const vfloat e3x = e2x - e1x, e3y = e2y - e1y, e3z = e2z - e1z; // c - b
+					const vfloat l1 = e1x * e1x + e1y * e1y + e1z * e1z;
+					const vfloat l2 = e2x * e2x + e2y * e2y + e2z * e2z;
+					const vfloat l3 = e3x * e3x + e3y * e3y + e3z * e3z;
+					w0 = vangle(e1x * e2x + e1y * e2y + e1z * e2z, l1, l2);
+					w1 = vangle(vfloat(0.f) - (e1x * e3x + e1y * e3y + e1z * e3z), l1, l3);
+					w2 = vmax(vfloat(pi<float>()) - w0 - w1, vfloat(0.f));
+				}
+
+				x.store(nx);
+				y.store(ny);
+				z.store(nz);
+				w0.store(wa);
+				w1.store(wb);
+				w2.store(wc);
+			}
+		};
+
+		// triangles per thread before it's worth starting another
+		const size_t min_triangles_per_thread = 1 << 16;
+
+		// cap on the memory of the per-thread accumulators
+		const size_t max_accumulator_bytes = size_t(256) << 20;
+	}
+
+
+	void generate_normals(const vector<vec3> &positions, const GLuint *indices, size_t index_count,
+		vector<vec3> &normals, normal_weighting weighting, unsigned threads)
+	{
+		const size_t position_count = positions.size();
+		const size_t tri_count = index_count / 3;
+		normals.assign(position_count, vec3(0));
+		if (position_count == 0 || tri_count == 0) return;
+
+		if (threads == 0) threads = hardware_threads();
+		threads = unsigned(std::min<size_t>(threads, std::max<size_t>(1, tri_count / min_triangles_per_thread)));
+		threads = unsigned(std::min<size_t>(threads, std::max<size_t>(1, max_accumulator_bytes / (position_count * sizeof(vec3)))));
+
+		// structure of arrays copy of the positions, so a block of corners loads as lanes
+		vector<float> xs(position_count), ys(position_count), zs(position_count);
+		parallel_tasks(threads, [&](unsigned k) {
+			const size_t begin = position_count * k / threads;
+			const size_t end = position_count * (k + 1) / threads;
+			for (size_t i = begin; i < end; ++i) {
+				xs[i] = positions[i].x;
+				ys[i] = positions[i].y;
+				zs[i] = positions[i].z;
+			}
+		});
+
+		// thread 0 accumulates straight into the output
+		vector<vector<vec3>> accumulators(threads - 1, vector<vec3>(position_count, vec3(0)));
+
+		parallel_tasks(threads, [&](unsigned k) {
+			vector<vec3> &acc = (k == 0) ? normals : accumulators[k - 1];
+			const size_t begin = tri_count * k / threads;
+			const size_t end = tri_count * (k + 1) / threads;
+
+			face_block fb;
+			GLuint corners[block][3];
+			bool valid[block];
+
+			for (size_t t0 = begin; t0 < end; t0 += block) {
+				const int count = int(std::min<size_t>(block, end - t0));
+
+				// gather the corners, unused lanes and bad triangles are all zero
+				for (int l = 0; l < block; ++l) {
+					const GLuint *tri = (l < count) ? indices + (t0 + l) * 3 : nullptr;
+					valid[l] = tri && tri[0] < position_count && tri[1] < position_count && tri[2] < position_count;
+					if (valid[l]) {
+						corners[l][0] = tri[0];
+						corners[l][1] = tri[1];
+						corners[l][2] = tri[2];
+						fb.ax[l] = xs[tri[0]]; fb.ay[l] = ys[tri[0]]; fb.az[l] = zs[tri[0]];
+						fb.bx[l] = xs[tri[1]]; fb.by[l] = ys[tri[1]]; fb.bz[l] = zs[tri[1]];
+						fb.cx[l] = xs[tri[2]]; fb.cy[l] = ys[tri[2]]; fb.cz[l] = zs[tri[2]];
+					}
+					else {
+						fb.ax[l] = fb.ay[l] = fb.az[l] = 0;
+						fb.bx[l] = fb.by[l] = fb.bz[l] = 0;
+						fb.cx[l] = fb.cy[l] = fb.cz[l] = 0;
+					}
+				}
+
+				fb.compute(weighting);
+
+				// scatter into this thread's accumulator
+				for (int l = 0; l < count; ++l) {
+					if (!valid[l]) continue;
+					const vec3 n(fb.nx[l], fb.ny[l], fb.nz[l]);
+					acc[corners[l][0]] += n * fb.wa[l];
+					acc[corners[l][1]] += n * fb.wb[l];
+					acc[corners[l][2]] += n * fb.wc[l];
+				}
+			}
+		});
+
+		// sum the accumulators and normalize, split by vertex
+		parallel_tasks(threads, [&](unsigned k) {
+			const size_t begin = position_count * k / threads;
+			const size_t end = position_count * (k + 1) / threads;
+			for (size_t i = begin; i < end; ++i) {
+				vec3 n = normals[i];
+				for (const vector<vec3> &acc : accumulators) n += acc[i];
+				const float l = length(n);
+				normals[i] = (l > 0) ? n / l : vec3(0);
+			}
+		});
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	// how much each face contributes to the normals of its corners
+	enum class normal_weighting {
+		uniform, // every face the same
+		area,    // by face area, big faces dominate
+		angle    // by the angle of the face at that corner (Thurmer and Wuthrich), independent of tessellation
+	};
+
+	// Generates smooth vertex normals for a triangle list indexing into positions. Face
+	// normals are computed several triangles at a time with SSE/AVX from structure of arrays
+	// copies of the positions and scattered into per-thread accumulators, which are then
+	// summed and normalized in parallel. threads = 0 uses every hardware thread (small meshes
+	// always use one). Triangles with out of range indices are skipped and vertices no face
+	// touches get a zero normal. normals is resized to positions.size().
+	void generate_normals(const std::vector<glm::vec3> &positions, const GLuint *indices, size_t index_count,
+		std::vector<glm::vec3> &normals, normal_weighting weighting = normal_weighting::area, unsigned threads = 0);
+}
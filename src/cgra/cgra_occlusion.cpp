@@ -0,0 +1,258 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// project
+#include "cgra_occlusion.hpp"
+#include "cgra_simd.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		using namespace simd;
+
+		// rows of the depth buffer per rasterizer task
+		const int band_rows = 16;
+
+		// instances per occlusion test task
+		const size_t test_chunk = 4096;
+
+		// a triangle set up for rasterizing, in pixels with y up
+		struct raster_triangle {
+			float a[3], b[3], c[3]; // edge functions a * x + b * y + c, >= 0 inside
+			float z0, dzdx, dzdy;   // depth plane at the origin
+			int xmin, xmax, ymin, ymax;
+		};
+
+		// sets up a screen space triangle, false if it is back facing or misses the buffer
+		bool setup_triangle(const vec3 &v0, const vec3 &v1, const vec3 &v2, int width, int height, raster_triangle &t) {
+			const float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+			if (!(area > 0)) return false;
+
+			const float xmin = std::min(v0.x, std::min(v1.x, v2.x)), xmax = std::max(v0.x, std::max(v1.x, v2.x));
+			const float ymin = std::min(v0.y, std::min(v1.y, v2.y)), ymax = std::max(v0.y, std::max(v1.y, v2.y));
+			// pixels whose centers could be inside
+			t.xmin = std::max(0, int(std::ceil(xmin - 0.5f)));
+			t.xmax = std::min(width - 1, int(std::floor(xmax - 0.5f)));
+			t.ymin = std::max(0, int(std::ceil(ymin - 0.5f)));
+			t.ymax = std::min(height - 1, int(std::floor(ymax - 0.5f)));
+			if (t.xmin > t.xmax || t.ymin > t.ymax) return false;
+
+			const vec3 *v[3] = { &v0, &v1, &v2 };
+			for (int e = 0; e < 3; ++e) {
+				const vec3 &p = *v[e], &q = *v[(e + 1) % 3];
+				t.a[e] = p.y - q.y;
+				t.b[e] = q.x - p.x;
+				t.c[e] = -(t.a[e] * p.x + t.b[e] * p.y);
+			}
+			t.dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+			t.dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+			t.z0 = v0.z - t.dzdx * v0.x - t.dzdy * v0.y;
+			return true;
+		}
+
+		// fills the rows [row_begin, row_end) of the triangle into depth (width floats per row)
+		void rasterize_rows(const raster_triangle &t, float *depth, int width, int row_begin, int row_end) {
+			const int y0 = std::max(t.ymin, row_begin), y1 = std::min(t.ymax + 1, row_end);
+			if (y0 >= y1) return;
+
+			// lane offsets of the pixel centers in a run
+			alignas(32) float lane[vfloat::width];
+			for (int l = 0; l < vfloat::width; ++l) lane[l] = float(l) + 0.5f;
+			const vfloat lanes = vfloat::load(lane);
+			const vfloat zero(0.f);
+			const vfloat a0(t.a[0]), a1(t.a[1]), a2(t.a[2]), dzdx(t.dzdx);
+
+			// runs start on a multiple of the simd width, the buffer width is a multiple of 8
+			const int x_begin = t.xmin / vfloat::width * vfloat::width;
+			for (int y = y0; y < y1; ++y) {
+				const float py = float(y) + 0.5f;
+				const vfloat r0(t.b[0] * py + t.c[0]), r1(t.b[1] * py + t.c[1]), r2(t.b[2] * py + t.c[2]);
+				const vfloat rz(t.z0 + t.dzdy * py);
+				float *row = depth + size_t(y) * width;
+				for (int x = x_begin; x <= t.xmax; x += vfloat::width) {
+					const vfloat px = vfloat(float(x)) + lanes;
+					const vfloat outside = vless(a0 * px + r0, zero) | vless(a1 * px + r1, zero) | vless(a2 * px + r2, zero);
+					if (vbits(outside) == (1 << vfloat::width) - 1) continue;
+					const vfloat old = vfloat::loadu(row + x);
+					const vfloat z = rz + dzdx * px;
+					select(outside, old, vmin(old, z)).storeu(row + x);
+				}
+			}
+		}
+	}
+
+
+	occluder_mesh make_occluder_mesh(const mesh_builder &mb) {
+		occluder_mesh m;
+		m.positions.resize(mb.vertices.size());
+		for (size_t i = 0; i < mb.vertices.size(); ++i) m.positions[i] = mb.vertices[i].pos;
+		m.indices.assign(mb.indices.begin(), mb.indices.begin() + mb.indices.size() / 3 * 3);
+		return m;
+	}
+
+
+	void occlusion_buffer::render(const occluder_mesh &mesh, const instance_set &instances, const vector<uint32_t> &candidates,
+		const mat4 &modelview, const mat4 &proj, const occlusion_options &options, task_pool &pool)
+	{
+		const auto start = chrono::steady_clock::now();
+		const int width = std::max(8, (options.width + 7) / 8 * 8);
+		const int height = std::max(1, options.height);
+		m_view_proj = proj * modelview;
+		m_stats = occlusion_stats();
+
+		m_levels.resize(1);
+		m_sizes.assign(1, ivec2(width, height));
+		m_levels[0].assign(size_t(width) * height, 1.f);
+
+		// the nearest candidates in front of the camera
+		vector<pair<float, uint32_t>> nearest;
+		nearest.reserve(candidates.size());
+		for (uint32_t i : candidates) {
+			const float depth = -(modelview * instances.transforms[i][3]).z;
+			if (depth > 0) nearest.emplace_back(depth, i);
+		}
+		const size_t occluders = std::min(options.max_occluders, nearest.size());
+		partial_sort(nearest.begin(), nearest.begin() + occluders, nearest.end());
+		m_stats.occluders = occluders;
+
+		// set up the triangles of every occluder, skipping any that reach behind the camera
+		const size_t tris = mesh.triangles();
+		vector<raster_triangle> triangles(occluders * tris);
+		vector<uint8_t> valid(occluders * tris, 0);
+		pool.run(unsigned(occluders), [&](unsigned o) {
+			const mat4 m = m_view_proj * instances.transforms[nearest[o].second];
+			vector<vec3> screen(mesh.positions.size());
+			vector<uint8_t> in_front(mesh.positions.size());
+			for (size_t v = 0; v < mesh.positions.size(); ++v) {
+				const vec4 clip = m * vec4(mesh.positions[v], 1);
+				// in front of the near plane, anything closer is clipped away when drawn for real
+				in_front[v] = clip.w > 1e-5f && clip.z > -clip.w;
+				const float inv_w = in_front[v] ? 1 / clip.w : 0.f;
+				screen[v] = vec3((clip.x * inv_w * 0.5f + 0.5f) * width, (clip.y * inv_w * 0.5f + 0.5f) * height, clip.z * inv_w);
+			}
+			for (size_t t = 0; t < tris; ++t) {
+				const uint32_t i0 = mesh.indices[3 * t], i1 = mesh.indices[3 * t + 1], i2 = mesh.indices[3 * t + 2];
+				if (!in_front[i0] || !in_front[i1] || !in_front[i2]) continue;
+				valid[o * tris + t] = setup_triangle(screen[i0], screen[i1], screen[i2], width, height, triangles[o * tris + t]);
+			}
+		});
+
+		// compact the triangles that are left
+		size_t kept = 0;
+		for (size_t t = 0; t < triangles.size(); ++t) {
+			if (valid[t]) triangles[kept++] = triangles[t];
+		}
+		triangles.resize(kept);
+		m_stats.triangles = kept;
+
+		// each band of rows is only written by its own task
+		float *depth = m_levels[0].data();
+		const int bands = (height + band_rows - 1) / band_rows;
+		pool.run(unsigned(bands), [&](unsigned band) {
+			const int row_begin = int(band) * band_rows, row_end = std::min(height, row_begin + band_rows);
+			for (const raster_triangle &t : triangles) {
+				if (t.ymax < row_begin || t.ymin >= row_end) continue;
+				rasterize_rows(t, depth, width, row_begin, row_end);
+			}
+		});
+
+		build_hierarchy();
+		m_stats.raster_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+
+	void occlusion_buffer::build_hierarchy() {
+		while (m_sizes.back().x > 1 || m_sizes.back().y > 1) {
+			const ivec2 size = m_sizes.back();
+			const ivec2 half((size.x + 1) / 2, (size.y + 1) / 2);
+			vector<float> next(size_t(half.x) * half.y);
+			const vector<float> &prev = m_levels.back();
+			for (int y = 0; y < half.y; ++y) {
+				const int y0 = 2 * y, y1 = std::min(2 * y + 1, size.y - 1);
+				for (int x = 0; x < half.x; ++x) {
+					const int x0 = 2 * x, x1 = std::min(2 * x + 1, size.x - 1);
+					next[size_t(y) * half.x + x] = std::max(
+						std::max(prev[size_t(y0) * size.x + x0], prev[size_t(y0) * size.x + x1]),
+						std::max(prev[size_t(y1) * size.x + x0], prev[size_t(y1) * size.x + x1]));
+				}
+			}
+			m_levels.push_back(std::move(next));
+			m_sizes.push_back(half);
+		}
+	}
+
+
+	bool occlusion_buffer::occluded(const aabb &box) const {
+		if (m_levels.empty() || box.empty()) return false;
+
+		// screen rectangle and nearest depth of the box's corners
+		vec2 lo(numeric_limits<float>::infinity()), hi(-numeric_limits<float>::infinity());
+		float nearest = numeric_limits<float>::infinity();
+		for (int c = 0; c < 8; ++c) {
+			const vec3 p((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+			const vec4 clip = m_view_proj * vec4(p, 1);
+			// reaching behind the camera, treat as visible
+			if (clip.w <= 1e-5f) return false;
+			const vec3 ndc = vec3(clip) / clip.w;
+			lo = min(lo, vec2(ndc));
+			hi = max(hi, vec2(ndc));
+			nearest = std::min(nearest, ndc.z);
+		}
+
+		const int width = m_sizes[0].x, height = m_sizes[0].y;
+		int x0 = int(std::floor((lo.x * 0.5f + 0.5f) * width)), x1 = int(std::floor((hi.x * 0.5f + 0.5f) * width));
+		int y0 = int(std::floor((lo.y * 0.5f + 0.5f) * height)), y1 = int(std::floor((hi.y * 0.5f + 0.5f) * height));
+		if (x1 < 0 || y1 < 0 || x0 >= width || y0 >= height) return false;
+		x0 = std::max(x0, 0);
+		y0 = std::max(y0, 0);
+		x1 = std::min(x1, width - 1);
+		y1 = std::min(y1, height - 1);
+
+		// the level where the rectangle covers at most 2x2 texels
+		int l = 0;
+		while (l + 1 < levels() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)) l++;
+		const vector<float> &level = m_levels[l];
+		const int level_width = m_sizes[l].x;
+		float farthest = 0;
+		for (int y = y0 >> l; y <= (y1 >> l); ++y) {
+			for (int x = x0 >> l; x <= (x1 >> l); ++x) {
+				farthest = std::max(farthest, level[size_t(y) * level_width + x]);
+			}
+		}
+		return nearest > farthest;
+	}
+
+
+	void occlusion_buffer::cull(const instance_set &instances, const aabb &local_box, vector<uint32_t> &visible, task_pool &pool) {
+		const auto start = chrono::steady_clock::now();
+		const size_t count = visible.size();
+		vector<uint8_t> hidden(count, 0);
+		const unsigned chunks = unsigned((count + test_chunk - 1) / test_chunk);
+		const auto test = [&](unsigned c) {
+			for (size_t i = c * test_chunk; i < std::min(count, (c + 1) * test_chunk); ++i) {
+				hidden[i] = occluded(transform_aabb(local_box, instances.transforms[visible[i]]));
+			}
+		};
+		if (chunks > 1 && pool.size() > 1) pool.run(chunks, test);
+		else for (unsigned c = 0; c < chunks; ++c) test(c);
+
+		size_t kept = 0;
+		for (size_t i = 0; i < count; ++i) {
+			if (!hidden[i]) visible[kept++] = visible[i];
+		}
+		visible.resize(kept);
+
+		m_stats.tested = count;
+		m_stats.occluded = count - kept;
+		m_stats.test_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+}
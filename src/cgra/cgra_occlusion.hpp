@@ -0,0 +1,95 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_bvh.hpp"
+#include "cgra_instances.hpp"
+#include "cgra_parallel.hpp"
+
+
+namespace cgra {
+
+	// Triangles an instance is drawn with as an occluder, usually a coarse LOD of its mesh
+	struct occluder_mesh {
+		std::vector<glm::vec3> positions;
+		std::vector<std::uint32_t> indices; // triangle list
+
+		size_t triangles() const { return indices.size() / 3; }
+	};
+
+	// the positions and triangles of a GL_TRIANGLES mesh
+	occluder_mesh make_occluder_mesh(const mesh_builder &mb);
+
+
+	struct occlusion_options {
+		// size of the depth buffer, much smaller than the screen (width is rounded up to a multiple of 8)
+		int width = 256;
+		int height = 128;
+
+		// the nearest this many candidates are drawn as occluders
+		size_t max_occluders = 32;
+	};
+
+	struct occlusion_stats {
+		size_t occluders = 0;
+		size_t triangles = 0; // occluder triangles rasterized (front facing, in front of the camera)
+		size_t tested = 0;
+		size_t occluded = 0;
+		double raster_ms = 0; // drawing the occluders and building the hierarchy
+		double test_ms = 0;
+	};
+
+	// Occlusion culling on the cpu with a small software depth buffer.
+	//
+	// render() draws the nearest instances as occluders into the depth buffer and builds a
+	// hierarchical-z chain from it, where each level is half the size of the one before and holds
+	// the farthest depth of the four texels under it. The buffer is split into bands of rows, one
+	// task each, and each task walks every triangle touching its band, filling SSE/AVX wide runs of
+	// pixels at a time.
+	//
+	// cull() then projects the box around each instance and compares its nearest depth with the
+	// farthest depth of the (at most 2x2) texels of the level where the box covers 2 texels or
+	// less. If the box is behind all of them the instance is hidden. Depths are ndc z, 1 where
+	// nothing has been drawn.
+	//
+	// Occluders are drawn at pixel centers and a coarse LOD can stick out of the mesh a little,
+	// so instances right at the silhouette of an occluder can be culled while a sliver of them
+	// should still show.
+	class occlusion_buffer {
+	public:
+		// draws the nearest max_occluders of candidates (indices into instances, in front of the
+		// camera) with mesh. modelview takes the space the instance transforms map to to view space
+		void render(const occluder_mesh &mesh, const instance_set &instances, const std::vector<std::uint32_t> &candidates,
+			const glm::mat4 &modelview, const glm::mat4 &proj, const occlusion_options &options, task_pool &pool = default_task_pool());
+
+		// removes the instances whose box (local_box through their transform) is hidden from
+		// visible, keeping the order of the rest
+		void cull(const instance_set &instances, const aabb &local_box, std::vector<std::uint32_t> &visible,
+			task_pool &pool = default_task_pool());
+
+		// true if box (in the space the instance transforms map to) is certainly hidden
+		bool occluded(const aabb &box) const;
+
+		int levels() const { return int(m_levels.size()); }
+		int level_width(int l) const { return m_sizes[l].x; }
+		int level_height(int l) const { return m_sizes[l].y; }
+		// rows from the bottom of the screen up
+		const std::vector<float> & level(int l) const { return m_levels[l]; }
+
+		const occlusion_stats & stats() const { return m_stats; }
+
+	private:
+		std::vector<std::vector<float>> m_levels;
+		std::vector<glm::ivec2> m_sizes;
+		glm::mat4 m_view_proj{1};
+		occlusion_stats m_stats;
+
+		void build_hierarchy();
+	};
+}
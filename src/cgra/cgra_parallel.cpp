@@ -0,0 +1,155 @@
+
+// project
+#include "cgra_parallel.hpp"
+
+
+using namespace std;
+
+
+namespace cgra {
+
+	namespace {
+		uint64_t make_range(unsigned begin, unsigned end) { return uint64_t(begin) | (uint64_t(end) << 32); }
+		unsigned range_begin(uint64_t r) { return unsigned(r); }
+		unsigned range_end(uint64_t r) { return unsigned(r >> 32); }
+	}
+
+
+	task_pool::task_pool(unsigned threads) {
+		if (threads == 0) threads = hardware_threads();
+		m_ranges.reset(new task_range[threads]);
+		for (unsigned i = 1; i < threads; ++i) {
+			m_workers.emplace_back([this, i] { worker(i); });
+		}
+	}
+
+
+	task_pool::~task_pool() {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (thread &t : m_workers) {
+			t.join();
+		}
+	}
+
+
+	void task_pool::worker(unsigned self) {
+		unsigned seen = 0;
+		while (true) {
+			{
+				unique_lock<mutex> lock(m_mutex);
+				m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+				if (m_stop) return;
+				seen = m_generation;
+			}
+			work(self);
+			{
+				lock_guard<mutex> lock(m_mutex);
+				if (--m_busy == 0) m_done.notify_one();
+			}
+		}
+	}
+
+
+	void task_pool::work(unsigned self) {
+		// own tasks first, then other threads' until there are none left anywhere
+		unsigned i;
+		do {
+			while (pop(self, i)) {
+				try {
+					(*m_fn)(i);
+				}
+				catch (...) {
+					m_errors[i] = current_exception();
+				}
+			}
+		} while (steal(self));
+	}
+
+
+	bool task_pool::pop(unsigned self, unsigned &task) {
+		atomic<uint64_t> &range = m_ranges[self].range;
+		uint64_t r = range.load();
+		while (range_begin(r) < range_end(r)) {
+			if (range.compare_exchange_weak(r, make_range(range_begin(r) + 1, range_end(r)))) {
+				task = range_begin(r);
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	bool task_pool::steal(unsigned self) {
+		const unsigned threads = size();
+		for (unsigned k = 1; k < threads; ++k) {
+			atomic<uint64_t> &victim = m_ranges[(self + k) % threads].range;
+			uint64_t r = victim.load();
+			while (range_begin(r) < range_end(r)) {
+				// the back half, rounded up so a single task left can be taken
+				const unsigned middle = range_end(r) - (range_end(r) - range_begin(r) + 1) / 2;
+				if (victim.compare_exchange_weak(r, make_range(range_begin(r), middle))) {
+					// nobody takes from an empty range, so this thread's can just be replaced
+					m_ranges[self].range = make_range(middle, range_end(r));
+					m_steals++;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+
+	void task_pool::run(unsigned count, const function<void(unsigned)> &fn) {
+		if (count == 0) return;
+		lock_guard<mutex> run_lock(m_run_mutex);
+
+		m_errors.assign(count, nullptr);
+		m_fn = &fn;
+		m_steals = 0;
+
+		// not worth waking the workers for a single task
+		const bool wake = count > 1 && !m_workers.empty();
+
+		// an even share of the tasks each, in order (everything for the caller without the workers)
+		const unsigned threads = wake ? size() : 1;
+		for (unsigned t = 0; t < size(); ++t) {
+			if (t >= threads) {
+				m_ranges[t].range = make_range(0, 0);
+				continue;
+			}
+			const unsigned begin = unsigned(uint64_t(count) * t / threads);
+			const unsigned end = unsigned(uint64_t(count) * (t + 1) / threads);
+			m_ranges[t].range = make_range(begin, end);
+		}
+		if (wake) {
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_busy = unsigned(m_workers.size());
+				m_generation++;
+			}
+			m_wake.notify_all();
+		}
+
+		work(0);
+
+		if (wake) {
+			unique_lock<mutex> lock(m_mutex);
+			m_done.wait(lock, [this] { return m_busy == 0; });
+		}
+		m_fn = nullptr;
+
+		for (exception_ptr &e : m_errors) {
+			if (e) rethrow_exception(e);
+		}
+	}
+
+
+	task_pool & default_task_pool() {
+		static task_pool pool;
+		return pool;
+	}
+}
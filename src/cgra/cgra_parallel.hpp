@@ -0,0 +1,113 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace cgra {
+
+	// number of threads worth running at once, always at least 1
+	inline unsigned hardware_threads() {
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+
+	// runs fn(i) for every i in [0, count), each on its own thread
+	// the calling thread runs task 0 and waits for the rest to finish.
+	// the first exception thrown by any task is rethrown on the calling thread
+	template <typename Fn>
+	inline void parallel_tasks(unsigned count, Fn &&fn) {
+		if (count == 0) return;
+
+		std::vector<std::exception_ptr> errors(count);
+		const auto run = [&](unsigned i) {
+			try {
+				fn(i);
+			}
+			catch (...) {
+				errors[i] = std::current_exception();
+			}
+		};
+
+		std::vector<std::thread> workers;
+		workers.reserve(count - 1);
+		for (unsigned i = 1; i < count; ++i) {
+			workers.emplace_back(run, i);
+		}
+		run(0);
+		for (std::thread &t : workers) {
+			t.join();
+		}
+
+		for (std::exception_ptr &e : errors) {
+			if (e) std::rethrow_exception(e);
+		}
+	}
+
+	// A fixed set of worker threads for work that runs every frame, where starting threads
+	// each time (as parallel_tasks does) would cost more than the work itself.
+	// run() has the same behaviour as parallel_tasks, but count can be much larger than the
+	// number of threads. Each thread starts on its own contiguous share of the tasks, taking them
+	// from the front in order, and a thread that runs out steals the back half of what another
+	// has left. Neighbouring tasks usually run on the same thread, and uneven tasks still keep
+	// every thread busy until the end.
+	// Only one run() happens at a time, it must not be called from inside a task.
+	class task_pool {
+	public:
+		// threads = 0 uses every hardware thread, the caller of run() counts as one of them
+		explicit task_pool(unsigned threads = 0);
+		~task_pool();
+
+		task_pool(const task_pool &) = delete;
+		task_pool & operator=(const task_pool &) = delete;
+
+		// threads working on a run, including the caller
+		unsigned size() const { return unsigned(m_workers.size()) + 1; }
+
+		// runs fn(i) for every i in [0, count) and waits for them all to finish
+		// the first exception thrown by any task is rethrown on the calling thread
+		void run(unsigned count, const std::function<void(unsigned)> &fn);
+
+		// times a thread took tasks from another in the last run
+		unsigned steals() const { return m_steals; }
+
+	private:
+		// the tasks [begin, end) a thread has left, as begin | end << 32 so both change together.
+		// each on its own cache line
+		struct alignas(64) task_range {
+			std::atomic<std::uint64_t> range{0};
+		};
+
+		std::vector<std::thread> m_workers;
+		std::unique_ptr<task_range[]> m_ranges; // one per thread, the caller's first
+		std::mutex m_run_mutex; // one run at a time
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+		unsigned m_generation = 0;
+		bool m_stop = false;
+
+		// the current run
+		const std::function<void(unsigned)> *m_fn = nullptr;
+		std::atomic<unsigned> m_steals{0};
+		unsigned m_busy = 0; // workers still in the current run
+		std::vector<std::exception_ptr> m_errors;
+
+		void worker(unsigned self);
+		void work(unsigned self);
+		bool pop(unsigned self, unsigned &task);
+		bool steal(unsigned self);
+	};
+
+	// a pool shared by everything in the program, started the first time it is used
+	task_pool & default_task_pool();
+}
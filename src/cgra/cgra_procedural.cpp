@@ -0,0 +1,146 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+
+// project
+#include "cgra_procedural.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+
+		// instances per bounds or picking task
+		const uint32_t procedural_chunk = 16384;
+
+		// a bijection of 32 bit integers where every input bit affects every output bit
+		// (the same as ringHash in default_vert.glsl)
+		uint32_t hash(uint32_t x) {
+			x ^= x >> 16;
+			x *= 0x7feb352du;
+			x ^= x >> 15;
+			x *= 0x846ca68bu;
+			x ^= x >> 16;
+			return x;
+		}
+
+		// the k-th random number of instance, in [0, 1)
+		float unit(uint32_t seed, uint32_t instance, uint32_t k) {
+			return float(hash(instance ^ hash(seed + k * 0x9e3779b9u)) >> 8) / float(1 << 24);
+		}
+
+		// ray against a sphere, the distance along it to the sphere's near side (0 if it starts
+		// inside), or infinity if it misses
+		float sphere_distance(const ray &r, const vec3 &center, float radius) {
+			const vec3 oc = r.origin - center;
+			const float a = dot(r.direction, r.direction);
+			const float b = dot(oc, r.direction);
+			const float c = dot(oc, oc) - radius * radius;
+			const float disc = b * b - a * c;
+			if (!(disc >= 0) || a == 0) return numeric_limits<float>::infinity();
+			const float root = std::sqrt(disc);
+			if (-b + root < 0) return numeric_limits<float>::infinity();
+			return std::max(0.0f, (-b - root) / a);
+		}
+
+		// translation (xyz) and scale (w) of an instance other than the first, which is all
+		// picking needs to rule most of them out
+		vec4 ring_position_scale(uint32_t seed, uint32_t instance) {
+			// 7.2 radians (about a fiftieth of 360) further round the ring each time as always,
+			// counted in 32 bit fixed point turns that the cpu and gpu both get exactly right
+			// (a float index would run out of precision after 2^24 instances)
+			const uint32_t turns = (instance - 1) * 0x255ab960u;
+			const float angle = float(turns >> 8) * (6.28318531f / float(1 << 24));
+			const float radius = 70;
+			const float displacement = 40 * unit(seed, instance, 0) - 20;
+			const float s = std::sin(angle), c = std::cos(angle);
+			const vec3 position = vec3(s, s / c, c) * radius + displacement; // s / c is the tangent
+			return vec4(position, 0.8f * unit(seed, instance, 1));
+		}
+	}
+
+
+	mat4 procedural_ring_transform(uint32_t seed, uint32_t instance) {
+		// the first is the central teapot
+		if (instance == 0) return mat4(1.0f);
+
+		const vec4 ps = ring_position_scale(seed, instance);
+		mat4 model = translate(mat4(1.0f), vec3(ps));
+		model = glm::scale(model, vec3(ps.w));
+		return rotate(model, 6.28318531f * unit(seed, instance, 2), vec3(0.4f, 0.5f, 0.6f));
+	}
+
+
+	vec3 procedural_ring_color(uint32_t seed, uint32_t instance) {
+		if (instance == 0) return vec3(0.8f, 1, 1);
+		return vec3(unit(seed, instance, 3), unit(seed, instance, 4), unit(seed, instance, 5));
+	}
+
+
+	aabb procedural_ring_bounds(uint32_t seed, uint32_t count, const aabb &local, task_pool &pool) {
+		const unsigned tasks = unsigned((uint64_t(count) + procedural_chunk - 1) / procedural_chunk);
+		vector<aabb> boxes(tasks);
+		pool.run(tasks, [&](unsigned task) {
+			const uint32_t first = task * procedural_chunk;
+			const uint32_t end = uint32_t(std::min<uint64_t>(uint64_t(first) + procedural_chunk, count));
+			for (uint32_t i = first; i < end; ++i) {
+				boxes[task].extend(transform_aabb(local, procedural_ring_transform(seed, i)));
+			}
+		});
+
+		aabb bounds;
+		for (const aabb &b : boxes) bounds.extend(b);
+		return bounds;
+	}
+
+
+	ray_hit pick_procedural_ring(const ray &r, const mesh_bvh &mesh, uint32_t seed, uint32_t count, task_pool &pool) {
+		const aabb local = mesh.bounds();
+		if (local.empty()) return ray_hit();
+		// around the origin rather than the box, so the rotation doesn't move it
+		const float radius = length(glm::max(abs(local.min), abs(local.max)));
+
+		const unsigned tasks = unsigned((uint64_t(count) + procedural_chunk - 1) / procedural_chunk);
+		vector<ray_hit> hits(tasks);
+		pool.run(tasks, [&](unsigned task) {
+			ray_hit &hit = hits[task];
+			const uint32_t first = task * procedural_chunk;
+			const uint32_t end = uint32_t(std::min<uint64_t>(uint64_t(first) + procedural_chunk, count));
+			for (uint32_t i = first; i < end; ++i) {
+				// the scale is uniform, so the sphere only needs moving and scaling
+				const vec4 ps = (i == 0) ? vec4(0, 0, 0, 1) : ring_position_scale(seed, i);
+				if (!(ps.w > 0)) continue;
+				if (!(sphere_distance(r, vec3(ps), radius * ps.w) < hit.t)) continue;
+
+				// the ray in object space, with the direction unnormalized so t means the same
+				const mat4 inv = inverse(procedural_ring_transform(seed, i));
+				ray object;
+				object.origin = vec3(inv * vec4(r.origin, 1));
+				object.direction = vec3(inv * vec4(r.direction, 0));
+				float t;
+				uint32_t triangle;
+				if (mesh.intersect(object, hit.t, t, triangle)) {
+					hit.t = t;
+					hit.instance = i;
+					hit.triangle = triangle;
+				}
+			}
+		});
+
+		ray_hit closest;
+		for (const ray_hit &h : hits) {
+			if (h.hit() && h.t < closest.t) closest = h;
+		}
+		if (closest.hit()) closest.position = r.origin + closest.t * r.direction;
+		return closest;
+	}
+}
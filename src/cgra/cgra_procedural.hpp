@@ -0,0 +1,41 @@
+#pragma once
+
+// std
+#include <cstdint>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_bvh.hpp"
+#include "cgra_parallel.hpp"
+
+
+namespace cgra {
+
+	// The ring of instances computed from nothing but their index and a seed, so they can be
+	// drawn without any per instance memory: res/shaders/default_vert.glsl does the same from
+	// gl_InstanceID when uProceduralInstances is set. These are the cpu side of that, for bounds
+	// and picking, and agree with the shader up to float rounding (sin and cos differ a little
+	// between cpu and gpu).
+	//
+	// The layout is the one make_ring_instances has always used (instance 0 in the middle, the
+	// rest on sin/tan/cos curves with random displacement, scale and rotation), but the random
+	// numbers come from a counter based hash of the index instead of a random stream, so any
+	// instance can be made on its own.
+
+	// the transform of instance with seed
+	glm::mat4 procedural_ring_transform(std::uint32_t seed, std::uint32_t instance);
+
+	// the colour of instance with seed
+	glm::vec3 procedural_ring_color(std::uint32_t seed, std::uint32_t instance);
+
+	// the box around instances [0, count) of a mesh whose object space box is local
+	aabb procedural_ring_bounds(std::uint32_t seed, std::uint32_t count, const aabb &local, task_pool &pool = default_task_pool());
+
+	// closest of instances [0, count) of mesh hit by r. with nothing stored there is no bvh over
+	// the instances, so each is tested against the bounding sphere of mesh first (spread over
+	// pool), and only those hit go through mesh
+	ray_hit pick_procedural_ring(const ray &r, const mesh_bvh &mesh, std::uint32_t seed, std::uint32_t count,
+		task_pool &pool = default_task_pool());
+}
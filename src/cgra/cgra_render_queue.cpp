@@ -0,0 +1,135 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+// project
+#include "cgra_render_queue.hpp"
+
+
+using namespace std;
+
+
+namespace cgra {
+
+	namespace {
+
+		const int pass_shift = 61;
+		const int program_shift = 53;
+		const int material_shift = 43;
+		const int mesh_shift = 33;
+		const int depth_shift = 20;
+
+		// 11 bit digits, 4 passes over the 44 bits above the sequence with the counts still
+		// fitting in the cache
+		const int radix_bits = 11;
+		const int radix_passes = (64 - int(render_key_sequence_bits) + radix_bits - 1) / radix_bits;
+		const int radix_size = 1 << radix_bits;
+		const uint64_t radix_mask = radix_size - 1;
+
+		uint64_t field(uint32_t value, int bits, int shift) {
+			return (uint64_t(value) & ((uint64_t(1) << bits) - 1)) << shift;
+		}
+
+		// the bits of a positive float sort the same as the float, the top 13 of them are its
+		// exponent and 5 bits of mantissa
+		uint32_t depth_bucket(float depth) {
+			if (!(depth > 0)) depth = 0;
+			uint32_t bits;
+			memcpy(&bits, &depth, sizeof(bits));
+			return bits >> 18;
+		}
+	}
+
+
+	uint64_t render_key(render_pass pass, uint32_t program, uint32_t material, uint32_t mesh, float depth) {
+		uint32_t d = depth_bucket(depth);
+		if (pass == render_pass::transparent) d = 0x1fff - d;
+		return field(uint32_t(pass), 3, pass_shift)
+			| field(program, 8, program_shift)
+			| field(material, 10, material_shift)
+			| field(mesh, 10, mesh_shift)
+			| field(d, 13, depth_shift);
+	}
+
+
+	void render_queue::clear() {
+		m_packets.clear();
+		m_keys.clear();
+		for (auto &ids : m_ids) ids.clear();
+	}
+
+
+	uint32_t render_queue::dense_id(int field, uint32_t name) {
+		// a name seen before keeps its id
+		return m_ids[field].emplace(name, uint32_t(m_ids[field].size())).first->second;
+	}
+
+
+	uint64_t render_queue::make_key(render_pass pass, uint32_t program, uint32_t material, uint32_t mesh, float depth) {
+		return render_key(pass, dense_id(0, program), dense_id(1, material), dense_id(2, mesh), depth);
+	}
+
+
+	void render_queue::submit(uint64_t key, const render_packet &packet) {
+		const uint64_t sequence = m_packets.size();
+		if (sequence > render_key_sequence_mask) throw length_error("render_queue: too many packets");
+		m_keys.push_back((key & ~render_key_sequence_mask) | sequence);
+		m_packets.push_back(packet);
+	}
+
+
+	void render_queue::sort() {
+		const auto start = chrono::steady_clock::now();
+		const size_t n = m_keys.size();
+		m_sort_passes = 0;
+
+		if (n > 1) {
+			// the counts for every digit in one read of the keys
+			m_counts.assign(radix_passes * radix_size, 0);
+			for (const uint64_t key : m_keys) {
+				for (int d = 0; d < radix_passes; d++) {
+					m_counts[d * radix_size + ((key >> (render_key_sequence_bits + radix_bits * d)) & radix_mask)]++;
+				}
+			}
+
+			// least significant digit first, each pass is stable so the earlier ones (and the
+			// sequence, which the keys start out sorted by) still hold
+			m_scratch.resize(n);
+			uint64_t *src = m_keys.data();
+			uint64_t *dst = m_scratch.data();
+			for (int d = 0; d < radix_passes; d++) {
+				const int shift = int(render_key_sequence_bits) + radix_bits * d;
+				uint32_t *counts = &m_counts[d * radix_size];
+				// every key has the same digit here (the program, material and mesh fields
+				// often do), the pass wouldn't move anything
+				if (counts[(src[0] >> shift) & radix_mask] == n) continue;
+
+				uint32_t offset = 0;
+				for (int c = 0; c < radix_size; c++) {
+					const uint32_t count = counts[c];
+					counts[c] = offset;
+					offset += count;
+				}
+				for (size_t i = 0; i < n; i++) {
+					dst[counts[(src[i] >> shift) & radix_mask]++] = src[i];
+				}
+				swap(src, dst);
+				m_sort_passes++;
+			}
+			if (src != m_keys.data()) m_keys.swap(m_scratch);
+		}
+
+		m_sort_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+
+	void render_queue::execute() const {
+		for (const uint64_t key : m_keys) {
+			const render_packet &p = m_packets[key & render_key_sequence_mask];
+			p.draw(p.object, p.arg);
+		}
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+
+namespace cgra {
+
+	// Passes are drawn in this order. Opaque packets with the same state are drawn front to
+	// back (so early depth testing rejects as much as it can), transparent ones back to front
+	enum class render_pass : std::uint32_t {
+		opaque,
+		lines,       // depth tested lines over the opaque geometry (grid, axis, boxes)
+		transparent
+	};
+
+	// A sort key for a packet, from the most significant field down:
+	//   pass 3 bits | program 8 | material 10 | mesh 10 | depth bucket 13 | 20 left for the queue
+	// so packets sharing a program, then a material (texture), then a mesh are drawn together,
+	// which keeps the state changes down, and depth only orders packets that share all three.
+	// program, material and mesh are small ids that are the same for packets sharing that state,
+	// below 256 for programs and 1024 for the others (only those bits are kept, use
+	// render_queue::make_key for gl names). depth is the distance in front of the camera, in
+	// buckets about 3% of it wide
+	std::uint64_t render_key(render_pass pass, std::uint32_t program, std::uint32_t material, std::uint32_t mesh, float depth);
+
+	// the bits of a key render_key leaves for render_queue (which numbers the packets there)
+	const std::uint64_t render_key_sequence_bits = 20;
+	const std::uint64_t render_key_sequence_mask = (std::uint64_t(1) << render_key_sequence_bits) - 1;
+
+	// A draw, as a function and what it draws, small enough to copy around freely.
+	// a lambda without captures converts to draw
+	struct render_packet {
+		void (*draw)(void *object, std::uint32_t arg) = nullptr;
+		void *object = nullptr;
+		std::uint32_t arg = 0;
+	};
+
+
+	// Packets submitted in any order, radix sorted by key and then drawn. Packets with equal
+	// keys are drawn in the order they were submitted.
+	//
+	// Each packet's number goes in the low bits of its key, so the sort moves 8 bytes a packet
+	// and only has to sort by the bits above (the packets start out in number order). At most
+	// 2^20 packets can be queued at once
+	class render_queue {
+	public:
+		void clear();
+
+		// throws std::length_error if the queue is full
+		void submit(std::uint64_t key, const render_packet &packet);
+
+		void submit(std::uint64_t key, void (*draw)(void *, std::uint32_t), void *object, std::uint32_t arg = 0) {
+			submit(key, render_packet{ draw, object, arg });
+		}
+
+		// render_key for gl names (or any other ids). program, material and mesh are swapped for
+		// ids numbered in the order this queue first sees them since the last clear, so names that
+		// differ never share a field. past 256 programs or 1024 materials or meshes the ids wrap
+		// around, which only costs state changes
+		std::uint64_t make_key(render_pass pass, std::uint32_t program, std::uint32_t material, std::uint32_t mesh, float depth);
+
+		// sorts the packets by key, skipping the radix passes over bytes that all keys share
+		void sort();
+
+		// draws every packet, in key order if sort has been called since the last submit
+		void execute() const;
+
+		size_t size() const { return m_keys.size(); }
+
+		// key of the i-th packet in draw order, as given to submit
+		std::uint64_t key(size_t i) const { return m_keys[i] & ~render_key_sequence_mask; }
+
+		// the i-th packet in draw order
+		const render_packet & packet(size_t i) const { return m_packets[m_keys[i] & render_key_sequence_mask]; }
+
+		// time the last sort took, and how many of its radix passes it needed
+		double sort_ms() const { return m_sort_ms; }
+		int sort_passes() const { return m_sort_passes; }
+
+	private:
+		std::vector<render_packet> m_packets;
+		std::vector<std::uint64_t> m_keys; // with the packet's index in the sequence bits
+		std::vector<std::uint64_t> m_scratch;
+		std::vector<std::uint32_t> m_counts; // of each digit value, for every radix pass
+		std::unordered_map<std::uint32_t, std::uint32_t> m_ids[3]; // program, material and mesh ids by name, see make_key
+		double m_sort_ms = 0;
+		int m_sort_passes = 0;
+
+		std::uint32_t dense_id(int field, std::uint32_t name);
+	};
+}
@@ -0,0 +1,157 @@
+
+// std
+#include <iostream>
+#include <stdexcept>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_gl_state.hpp"
+#include "cgra_image.hpp"
+#include "cgra_resource.hpp"
+#include "cgra_shader.hpp"
+
+
+using namespace std;
+
+
+namespace cgra {
+
+	namespace {
+		void delete_object(resource_kind kind, GLuint id) {
+			switch (kind) {
+			case resource_kind::texture: gl_state().forget_texture(id); glDeleteTextures(1, &id); break;
+			case resource_kind::buffer: gl_state().forget_buffer(id); glDeleteBuffers(1, &id); break;
+			case resource_kind::shader: forget_reflection(id); gl_state().forget_program(id); glDeleteProgram(id); break;
+			}
+		}
+	}
+
+
+	GLuint resource_registry::add(const string &key, resource_kind kind, GLuint id, size_t bytes) {
+		resource_info &info = m_resources[key];
+		info.kind = kind;
+		info.id = id;
+		info.bytes = bytes;
+		info.refs = 1;
+		m_keys[{kind, id}] = key;
+		return id;
+	}
+
+
+	GLuint resource_registry::acquire(const string &key) {
+		auto it = m_resources.find(key);
+		if (it == m_resources.end()) return 0;
+		it->second.refs++;
+		return it->second.id;
+	}
+
+
+	GLuint resource_registry::acquire_texture(const string &filename) {
+		if (GLuint id = acquire(filename)) return id;
+		rgba_image image(filename);
+		// a full mip chain adds about a third
+		size_t bytes = image.data.size() * 4 / 3;
+		return add(filename, resource_kind::texture, image.uploadTexture(), bytes);
+	}
+
+
+	GLuint resource_registry::acquire_shader(const string &vertex_filename, const string &fragment_filename) {
+		string key = vertex_filename + "|" + fragment_filename;
+		if (GLuint id = acquire(key)) return id;
+		shader_builder sb;
+		sb.set_shader(GL_VERTEX_SHADER, vertex_filename);
+		sb.set_shader(GL_FRAGMENT_SHADER, fragment_filename);
+		return add(key, resource_kind::shader, sb.build(), 0);
+	}
+
+
+	GLuint resource_registry::acquire_buffer(const string &key, GLenum target, size_t bytes, const void *data, GLenum usage) {
+		if (GLuint id = acquire(key)) return id;
+		GLuint id = 0;
+		glGenBuffers(1, &id);
+		gl_state().bind_buffer(target, id);
+		glBufferData(target, bytes, data, usage);
+		gl_state().bind_buffer(target, 0);
+		return add(key, resource_kind::buffer, id, bytes);
+	}
+
+
+	GLuint resource_registry::adopt(const string &key, resource_kind kind, GLuint id, size_t bytes) {
+		if (GLuint existing = acquire(key)) {
+			if (existing != id) delete_object(kind, id);
+			return existing;
+		}
+		return add(key, kind, id, bytes);
+	}
+
+
+	bool resource_registry::release(const string &key) {
+		auto it = m_resources.find(key);
+		if (it == m_resources.end()) return false;
+		if (--it->second.refs <= 0) {
+			delete_object(it->second.kind, it->second.id);
+			m_keys.erase({it->second.kind, it->second.id});
+			m_resources.erase(it);
+		}
+		return true;
+	}
+
+
+	bool resource_registry::release(resource_kind kind, GLuint id) {
+		auto it = m_keys.find({kind, id});
+		if (it == m_keys.end()) return false;
+		string key = it->second; // release erases it
+		return release(key);
+	}
+
+
+	void resource_registry::set_bytes(resource_kind kind, GLuint id, size_t bytes) {
+		auto it = m_keys.find({kind, id});
+		if (it != m_keys.end()) m_resources[it->second].bytes = bytes;
+	}
+
+
+	bool resource_registry::contains(resource_kind kind, GLuint id) const {
+		return m_keys.count({kind, id}) > 0;
+	}
+
+
+	size_t resource_registry::bytes(resource_kind kind) const {
+		size_t total = 0;
+		for (const auto &r : m_resources)
+			if (r.second.kind == kind) total += r.second.bytes;
+		return total;
+	}
+
+
+	size_t resource_registry::total_bytes() const {
+		size_t total = 0;
+		for (const auto &r : m_resources) total += r.second.bytes;
+		return total;
+	}
+
+
+	void resource_registry::clear() {
+		for (const auto &r : m_resources) delete_object(r.second.kind, r.second.id);
+		m_resources.clear();
+		m_keys.clear();
+	}
+
+
+	resource_registry & resources() {
+		static resource_registry registry;
+		return registry;
+	}
+
+
+	const char * resource_kind_name(resource_kind kind) {
+		switch (kind) {
+		case resource_kind::texture: return "texture";
+		case resource_kind::buffer: return "buffer";
+		case resource_kind::shader: return "shader";
+		}
+		return "";
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+// std
+#include <map>
+#include <string>
+#include <utility>
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	enum class resource_kind {
+		texture,
+		buffer,
+		shader
+	};
+
+	struct resource_info {
+		resource_kind kind = resource_kind::buffer;
+		GLuint id = 0;
+		size_t bytes = 0; // gpu memory used, estimated for textures (mipmaps) and 0 for shaders
+		int refs = 0;
+	};
+
+
+	// Reference counted gl objects shared by key, so the same file or data is only decoded and
+	// uploaded once however many meshes or models use it. Keys are file names for textures and
+	// shaders and any unique name for buffers. Every acquire must be matched by a release, the
+	// object is deleted when the last reference goes.
+	//
+	// Only use from the thread that owns the gl context.
+	class resource_registry {
+	public:
+		resource_registry() { }
+		resource_registry(const resource_registry &) = delete;
+		resource_registry & operator=(const resource_registry &) = delete;
+
+		// texture from an image file (see rgba_image), decoded and uploaded with mipmaps the first time
+		GLuint acquire_texture(const std::string &filename);
+
+		// program from a vertex and fragment shader file, compiled and linked the first time
+		GLuint acquire_shader(const std::string &vertex_filename, const std::string &fragment_filename);
+
+		// buffer holding bytes of data, uploaded to target the first time the key is used (later
+		// calls ignore bytes and data). shared buffers must not be written to, see gl_mesh::update_instances
+		GLuint acquire_buffer(const std::string &key, GLenum target, size_t bytes, const void *data, GLenum usage = GL_STATIC_DRAW);
+
+		// takes ownership of an object created elsewhere (eg. by asset_stream) and holds one
+		// reference to it. if the key is already taken the existing object is acquired instead,
+		// and id is deleted
+		GLuint adopt(const std::string &key, resource_kind kind, GLuint id, size_t bytes);
+
+		// adds a reference to an existing object, returns 0 (and adds nothing) if the key isn't registered
+		GLuint acquire(const std::string &key);
+
+		// drops one reference, returns false if the key or object isn't registered
+		bool release(const std::string &key);
+		bool release(resource_kind kind, GLuint id);
+
+		// updates the size of an object after its storage has been reallocated
+		void set_bytes(resource_kind kind, GLuint id, size_t bytes);
+
+		// true if id is shared through the registry (rather than owned by its user)
+		bool contains(resource_kind kind, GLuint id) const;
+
+		size_t bytes(resource_kind kind) const;
+		size_t total_bytes() const;
+
+		// every live object by key
+		const std::map<std::string, resource_info> & resources() const { return m_resources; }
+
+		// deletes everything regardless of references
+		void clear();
+
+	private:
+		std::map<std::string, resource_info> m_resources;
+		std::map<std::pair<resource_kind, GLuint>, std::string> m_keys;
+
+		GLuint add(const std::string &key, resource_kind kind, GLuint id, size_t bytes);
+	};
+
+	// the registry shared by everything in the program
+	resource_registry & resources();
+
+	// name of the registry key kind, for display
+	const char * resource_kind_name(resource_kind kind);
+}
@@ -1,12 +1,18 @@
 
 // std
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
 // project
+#include "cgra_frame_uniforms.hpp"
 #include "cgra_shader.hpp"
 #include <opengl.hpp>
 
@@ -62,6 +68,130 @@ void printProgramInfoLog(GLuint obj) {
 
 namespace cgra {
 
+	namespace {
+
+		// reflections of the programs made so far, by program
+		std::map<GLuint, program_reflection> & reflections() {
+			static std::map<GLuint, program_reflection> r;
+			return r;
+		}
+
+		std::vector<shader_variable> active_variables(GLuint program, bool uniforms) {
+			GLint count = 0, max_length = 0;
+			glGetProgramiv(program, uniforms ? GL_ACTIVE_UNIFORMS : GL_ACTIVE_ATTRIBUTES, &count);
+			glGetProgramiv(program, uniforms ? GL_ACTIVE_UNIFORM_MAX_LENGTH : GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+
+			std::vector<shader_variable> variables(count);
+			std::vector<char> name(std::max(max_length, 1) + 1);
+			for (GLint i = 0; i < count; i++) {
+				shader_variable &v = variables[i];
+				GLsizei length = 0;
+				if (uniforms) glGetActiveUniform(program, GLuint(i), GLsizei(name.size()), &length, &v.size, &v.type, name.data());
+				else glGetActiveAttrib(program, GLuint(i), GLsizei(name.size()), &length, &v.size, &v.type, name.data());
+				v.name.assign(name.data(), length);
+				if (v.name.size() > 3 && v.name.compare(v.name.size() - 3, 3, "[0]") == 0) v.name.resize(v.name.size() - 3);
+				v.location = uniforms ? glGetUniformLocation(program, v.name.c_str()) : glGetAttribLocation(program, v.name.c_str());
+			}
+			return variables;
+		}
+	}
+
+
+	program_reflection::program_reflection(GLuint program) : m_program(program) {
+		if (!program) return;
+		m_uniforms = active_variables(program, true);
+		m_attributes = active_variables(program, false);
+		m_values.resize(m_uniforms.size());
+	}
+
+
+	int program_reflection::uniform(const std::string &name) const {
+		for (size_t i = 0; i < m_uniforms.size(); i++) {
+			if (m_uniforms[i].name == name) return m_uniforms[i].location < 0 ? -1 : int(i);
+		}
+		return -1;
+	}
+
+
+	GLint program_reflection::attribute(const std::string &name) const {
+		for (const shader_variable &a : m_attributes) {
+			if (a.name == name) return a.location;
+		}
+		return -1;
+	}
+
+
+	GLint program_reflection::changed(int uniform, const void *data, size_t bytes) {
+		if (uniform < 0 || size_t(uniform) >= m_uniforms.size()) return -1;
+		std::vector<unsigned char> &value = m_values[uniform];
+		if (value.size() == bytes && std::memcmp(value.data(), data, bytes) == 0) {
+			m_skipped++;
+			return -1;
+		}
+		value.assign(static_cast<const unsigned char *>(data), static_cast<const unsigned char *>(data) + bytes);
+		m_uploads++;
+		return m_uniforms[uniform].location;
+	}
+
+
+	void program_reflection::set(int uniform, float v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniform1f(l, v);
+	}
+
+	void program_reflection::set(int uniform, int v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniform1i(l, v);
+	}
+
+	void program_reflection::set(int uniform, unsigned v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniform1ui(l, v);
+	}
+
+	void program_reflection::set(int uniform, const glm::vec2 &v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniform2fv(l, 1, glm::value_ptr(v));
+	}
+
+	void program_reflection::set(int uniform, const glm::vec3 &v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniform3fv(l, 1, glm::value_ptr(v));
+	}
+
+	void program_reflection::set(int uniform, const glm::vec4 &v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniform4fv(l, 1, glm::value_ptr(v));
+	}
+
+	void program_reflection::set(int uniform, const glm::mat3 &v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniformMatrix3fv(l, 1, false, glm::value_ptr(v));
+	}
+
+	void program_reflection::set(int uniform, const glm::mat4 &v) {
+		GLint l = changed(uniform, &v, sizeof(v));
+		if (l >= 0) glUniformMatrix4fv(l, 1, false, glm::value_ptr(v));
+	}
+
+	void program_reflection::set(int uniform, const glm::vec4 *v, int count) {
+		GLint l = changed(uniform, v, count * sizeof(glm::vec4));
+		if (l >= 0) glUniform4fv(l, count, glm::value_ptr(v[0]));
+	}
+
+
+	program_reflection & reflection(GLuint program) {
+		auto it = reflections().find(program);
+		if (it == reflections().end()) it = reflections().emplace(program, program_reflection(program)).first;
+		return it->second;
+	}
+
+
+	void forget_reflection(GLuint program) {
+		reflections().erase(program);
+	}
+
+
 	void shader_builder::set_shader(GLenum type, const std::string &filename) {
 		std::ifstream fileStream(filename);
 
@@ -172,6 +302,13 @@ namespace cgra {
 		printProgramInfoLog(program); // print warnings and errors
 		if (!link_status) throw shader_link_error();
 
+		// a program that reads the frame's uniforms reads them from the one buffer
+		GLuint frame_block = glGetUniformBlockIndex(program, "FrameData");
+		if (frame_block != GL_INVALID_INDEX) glUniformBlockBinding(program, frame_block, frame_uniform_binding);
+
+		// linking resets every uniform, so any values kept from before are gone too
+		reflections()[program] = program_reflection(program);
+
 		return program;
 	}
 
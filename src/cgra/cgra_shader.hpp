@@ -5,6 +5,10 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
 
 // project
 #include <opengl.hpp>
@@ -12,6 +16,72 @@
 
 namespace cgra {
 
+	// an active uniform or attribute of a linked program, as the driver describes it
+	struct shader_variable {
+		std::string name; // without the [0] of an array
+		GLenum type = 0;  // GL_FLOAT_VEC3 etc.
+		GLint size = 0;   // elements of an array, otherwise 1
+		GLint location = -1; // -1 for uniforms in a block
+	};
+
+	// The active uniforms and attributes of a program, queried once when it is linked, and the
+	// last value given to each uniform so setting one to the value it already has costs nothing.
+	//
+	// Look a uniform's handle up once with uniform() and keep it, then set it through the handle
+	// with the program in use. Handles of uniforms the program doesn't have (or that the driver
+	// optimized away) are -1, and setting them does nothing. Values set with glUniform* directly
+	// aren't seen here, so use one or the other for a program.
+	class program_reflection {
+	public:
+		program_reflection() { }
+		explicit program_reflection(GLuint program);
+
+		GLuint program() const { return m_program; }
+		const std::vector<shader_variable> & uniforms() const { return m_uniforms; }
+		const std::vector<shader_variable> & attributes() const { return m_attributes; }
+
+		// handle of the uniform called name, -1 if it isn't active
+		int uniform(const std::string &name) const;
+
+		// location of the attribute called name, -1 if it isn't active
+		GLint attribute(const std::string &name) const;
+
+		// the program must be in use. arrays are set from their first element
+		void set(int uniform, float v);
+		void set(int uniform, int v); // also bools and samplers
+		void set(int uniform, unsigned v);
+		void set(int uniform, const glm::vec2 &v);
+		void set(int uniform, const glm::vec3 &v);
+		void set(int uniform, const glm::vec4 &v);
+		void set(int uniform, const glm::mat3 &v);
+		void set(int uniform, const glm::mat4 &v);
+		void set(int uniform, const glm::vec4 *v, int count);
+
+		// glUniform calls made and left out as redundant since the program was linked
+		size_t uploads() const { return m_uploads; }
+		size_t skipped() const { return m_skipped; }
+
+	private:
+		GLuint m_program = 0;
+		std::vector<shader_variable> m_uniforms;
+		std::vector<shader_variable> m_attributes;
+		std::vector<std::vector<unsigned char>> m_values; // by uniform, empty until first set
+		size_t m_uploads = 0;
+		size_t m_skipped = 0;
+
+		// location of uniform if the bytes differ from its last value (which they replace),
+		// otherwise -1
+		GLint changed(int uniform, const void *data, size_t bytes);
+	};
+
+	// the reflection build() made for program, or a new one if it didn't make program. stays
+	// valid until the program is forgotten or built again
+	program_reflection & reflection(GLuint program);
+
+	// drops program's reflection, for when the program is deleted
+	void forget_reflection(GLuint program);
+
+
 	class shader_builder {
 	private:
 		std::map<GLenum, std::shared_ptr<gl_object>> m_shaders;
@@ -21,6 +91,7 @@ namespace cgra {
 		void set_shader(GLenum type, const std::string &filename);
 		void set_shader_source(GLenum type, const std::string &shadersource);
 
+		// links the program and reflects its uniforms and attributes (see reflection())
 		GLuint build(GLuint program = 0);
 	};
 
@@ -0,0 +1,114 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <cmath>
+
+// simd
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+
+namespace cgra {
+
+	// Thin wrappers over SSE/AVX picked at compile time (configure with CGRA_AVX2 for AVX)
+	namespace simd {
+
+		// A lane of floats as wide as the compiler lets us (AVX 8, SSE 4, otherwise 1) with just
+		// enough operations for the kernels that use it. load and store need 32 byte alignment
+#if defined(__AVX__)
+		struct vfloat {
+			static const int width = 8;
+			__m256 v;
+			vfloat() { }
+			vfloat(__m256 v_) : v(v_) { }
+			explicit vfloat(float f) : v(_mm256_set1_ps(f)) { }
+			static vfloat load(const float *p) { return _mm256_load_ps(p); }
+			static vfloat loadu(const float *p) { return _mm256_loadu_ps(p); }
+			void store(float *p) const { _mm256_store_ps(p, v); }
+			void storeu(float *p) const { _mm256_storeu_ps(p, v); }
+		};
+		inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+		inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+		inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+		inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+		inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+		inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+		inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+		inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+		// a > 0 ? b : 0
+		inline vfloat if_positive(vfloat a, vfloat b) { return _mm256_and_ps(_mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_GT_OQ), b.v); }
+		// a < 0 ? b : c
+		inline vfloat if_negative(vfloat a, vfloat b, vfloat c) { return _mm256_blendv_ps(c.v, b.v, _mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_LT_OQ)); }
+		inline vfloat operator&(vfloat a, vfloat b) { return _mm256_and_ps(a.v, b.v); }
+		inline vfloat operator|(vfloat a, vfloat b) { return _mm256_or_ps(a.v, b.v); }
+		// comparisons give a mask, all bits set in lanes where they hold
+		inline vfloat vless(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+		inline vfloat vgreater(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+		// bit l is set if lane l of a mask is set
+		inline int vbits(vfloat m) { return _mm256_movemask_ps(m.v); }
+		// mask ? a : b
+		inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		struct vfloat {
+			static const int width = 4;
+			__m128 v;
+			vfloat() { }
+			vfloat(__m128 v_) : v(v_) { }
+			explicit vfloat(float f) : v(_mm_set1_ps(f)) { }
+			static vfloat load(const float *p) { return _mm_load_ps(p); }
+			static vfloat loadu(const float *p) { return _mm_loadu_ps(p); }
+			void store(float *p) const { _mm_store_ps(p, v); }
+			void storeu(float *p) const { _mm_storeu_ps(p, v); }
+		};
+		inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+		inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+		inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+		inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+		inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+		inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+		inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+		inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+		inline vfloat if_positive(vfloat a, vfloat b) { return _mm_and_ps(_mm_cmpgt_ps(a.v, _mm_setzero_ps()), b.v); }
+		inline vfloat if_negative(vfloat a, vfloat b, vfloat c) {
+			const __m128 mask = _mm_cmplt_ps(a.v, _mm_setzero_ps());
+			return _mm_or_ps(_mm_and_ps(mask, b.v), _mm_andnot_ps(mask, c.v));
+		}
+		inline vfloat operator&(vfloat a, vfloat b) { return _mm_and_ps(a.v, b.v); }
+		inline vfloat operator|(vfloat a, vfloat b) { return _mm_or_ps(a.v, b.v); }
+		inline vfloat vless(vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+		inline vfloat vgreater(vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+		inline int vbits(vfloat m) { return _mm_movemask_ps(m.v); }
+		inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+#else
+		struct vfloat {
+			static const int width = 1;
+			float v;
+			vfloat() { }
+			explicit vfloat(float f) : v(f) { }
+			static vfloat load(const float *p) { return vfloat(*p); }
+			static vfloat loadu(const float *p) { return vfloat(*p); }
+			void store(float *p) const { *p = v; }
+			void storeu(float *p) const { *p = v; }
+		};
+		inline vfloat operator+(vfloat a, vfloat b) { return vfloat(a.v + b.v); }
+		inline vfloat operator-(vfloat a, vfloat b) { return vfloat(a.v - b.v); }
+		inline vfloat operator*(vfloat a, vfloat b) { return vfloat(a.v * b.v); }
+		inline vfloat operator/(vfloat a, vfloat b) { return vfloat(a.v / b.v); }
+		inline vfloat vsqrt(vfloat a) { return vfloat(std::sqrt(a.v)); }
+		inline vfloat vmin(vfloat a, vfloat b) { return vfloat(std::min(a.v, b.v)); }
+		inline vfloat vmax(vfloat a, vfloat b) { return vfloat(std::max(a.v, b.v)); }
+		inline vfloat vabs(vfloat a) { return vfloat(std::fabs(a.v)); }
+		inline vfloat if_positive(vfloat a, vfloat b) { return vfloat(a.v > 0 ? b.v : 0.f); }
+		inline vfloat if_negative(vfloat a, vfloat b, vfloat c) { return a.v < 0 ? b : c; }
+		// masks are 1 or 0 in the single lane
+		inline vfloat operator&(vfloat a, vfloat b) { return vfloat(float(a.v != 0 && b.v != 0)); }
+		inline vfloat operator|(vfloat a, vfloat b) { return vfloat(float(a.v != 0 || b.v != 0)); }
+		inline vfloat vless(vfloat a, vfloat b) { return vfloat(float(a.v < b.v)); }
+		inline vfloat vgreater(vfloat a, vfloat b) { return vfloat(float(a.v > b.v)); }
+		inline int vbits(vfloat m) { return m.v != 0 ? 1 : 0; }
+		inline vfloat select(vfloat mask, vfloat a, vfloat b) { return mask.v != 0 ? a : b; }
+#endif
+	}
+}
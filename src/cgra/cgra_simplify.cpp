@@ -0,0 +1,402 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_mesh_optimize.hpp"
+#include "cgra_simplify.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+namespace cgra {
+
+	namespace {
+
+		// symmetric 4x4 matrix (upper triangle) for the sum of squared distances to a set of planes
+		struct quadric {
+			double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+			double a11 = 0, a12 = 0, a13 = 0;
+			double a22 = 0, a23 = 0;
+			double a33 = 0;
+
+			quadric() { }
+
+			// plane n.x + d = 0 with a unit normal
+			quadric(dvec3 n, double d, double w = 1) {
+				a00 = w * n.x * n.x; a01 = w * n.x * n.y; a02 = w * n.x * n.z; a03 = w * n.x * d;
+				a11 = w * n.y * n.y; a12 = w * n.y * n.z; a13 = w * n.y * d;
+				a22 = w * n.z * n.z; a23 = w * n.z * d;
+				a33 = w * d * d;
+			}
+
+			quadric & operator+=(const quadric &q) {
+				a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+				a11 += q.a11; a12 += q.a12; a13 += q.a13;
+				a22 += q.a22; a23 += q.a23;
+				a33 += q.a33;
+				return *this;
+			}
+
+			double error(dvec3 p) const {
+				const double x = p.x, y = p.y, z = p.z;
+				const double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+					+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+					+ a22 * z * z + 2 * a23 * z
+					+ a33;
+				return std::max(e, 0.0);
+			}
+		};
+
+		quadric operator+(quadric a, const quadric &b) {
+			return a += b;
+		}
+
+
+		struct position_hash {
+			size_t operator()(const vec3 &p) const {
+				uint32_t h[3];
+				memcpy(h, &p, sizeof(h));
+				return size_t(h[0]) * 73856093u ^ size_t(h[1]) * 19349663u ^ size_t(h[2]) * 83492791u;
+			}
+		};
+
+		struct collapse {
+			float cost;
+			GLuint from, to;         // position ids, from is merged into to
+			unsigned from_stamp, to_stamp;
+
+			bool operator>(const collapse &c) const { return cost > c.cost; }
+		};
+
+		const unsigned no_vertex = ~0u;
+
+		// minimum cosine between a triangle normal before and after a collapse
+		const float max_normal_change = 0.25f;
+
+
+		// State of one simplification run. Vertices (mesh_vertex) that share a position
+		// are grouped into one "position" so seams stay closed, and all the topology and
+		// error tracking is done per position.
+		class simplifier {
+		private:
+			const mesh_builder &m_mb;
+
+			vector<GLuint> m_indices;             // current triangles, vertex ids
+			vector<bool> m_tri_alive;
+			size_t m_alive = 0;
+
+			vector<GLuint> m_position_of;         // vertex id -> position id
+			vector<vec3> m_positions;
+			vector<vector<GLuint>> m_tris_of;     // position id -> triangles (may hold dead ones)
+			vector<quadric> m_quadrics;
+			vector<bool> m_border;
+			vector<bool> m_locked;
+			vector<bool> m_removed;
+			vector<unsigned> m_stamp;
+
+			priority_queue<collapse, vector<collapse>, greater<collapse>> m_heap;
+			float m_error = 0;
+
+			GLuint pos(GLuint tri, int k) const { return m_position_of[m_indices[tri * 3 + k]]; }
+
+			bool has_position(GLuint tri, GLuint p) const {
+				return pos(tri, 0) == p || pos(tri, 1) == p || pos(tri, 2) == p;
+			}
+
+			void push(GLuint from, GLuint to) {
+				if (m_locked[from]) return;
+				const quadric q = m_quadrics[from] + m_quadrics[to];
+				m_heap.push({ float(q.error(dvec3(m_positions[to]))), from, to, m_stamp[from], m_stamp[to] });
+			}
+
+			// drops dead triangles from a position's list
+			void prune(GLuint p) {
+				vector<GLuint> &tris = m_tris_of[p];
+				tris.erase(remove_if(tris.begin(), tris.end(), [&](GLuint t) { return !m_tri_alive[t]; }), tris.end());
+			}
+
+			bool try_collapse(const collapse &c);
+
+		public:
+			explicit simplifier(const mesh_builder &mb);
+
+			size_t index_count() const { return m_alive * 3; }
+			float error() const { return m_error; }
+
+			// collapses the cheapest edges until at most target_index_count indices are left,
+			// returns false if it ran out of edges first
+			bool run(size_t target_index_count);
+
+			// the current mesh with unused vertices removed
+			mesh_builder result() const;
+		};
+
+
+		simplifier::simplifier(const mesh_builder &mb) : m_mb(mb), m_indices(mb.indices) {
+			const size_t vertex_count = mb.vertices.size();
+			const size_t tri_count = m_indices.size() / 3;
+			m_indices.resize(tri_count * 3);
+
+			// group vertices by position
+			m_position_of.resize(vertex_count);
+			unordered_map<vec3, GLuint, position_hash> position_ids;
+			position_ids.reserve(vertex_count);
+			for (size_t i = 0; i < vertex_count; ++i) {
+				auto it = position_ids.emplace(mb.vertices[i].pos, GLuint(m_positions.size()));
+				if (it.second) m_positions.push_back(mb.vertices[i].pos);
+				m_position_of[i] = it.first->second;
+			}
+
+			const size_t position_count = m_positions.size();
+
+			m_tris_of.resize(position_count);
+			m_quadrics.resize(position_count);
+			m_border.assign(position_count, false);
+			m_locked.assign(position_count, false);
+			m_removed.assign(position_count, false);
+			m_stamp.assign(position_count, 0);
+			m_tri_alive.assign(tri_count, true);
+			m_alive = tri_count;
+
+			// count how many triangles use each edge to find borders and non-manifold edges
+			unordered_map<uint64_t, unsigned> edge_use;
+			edge_use.reserve(tri_count * 3);
+			const auto edge_key = [](GLuint a, GLuint b) {
+				return a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+			};
+
+			for (size_t t = 0; t < tri_count; ++t) {
+				const GLuint p0 = pos(GLuint(t), 0), p1 = pos(GLuint(t), 1), p2 = pos(GLuint(t), 2);
+				if (p0 == p1 || p1 == p2 || p2 == p0) {
+					// already degenerate
+					m_tri_alive[t] = false;
+					m_alive--;
+					continue;
+				}
+
+				m_tris_of[p0].push_back(GLuint(t));
+				m_tris_of[p1].push_back(GLuint(t));
+				m_tris_of[p2].push_back(GLuint(t));
+				edge_use[edge_key(p0, p1)]++;
+				edge_use[edge_key(p1, p2)]++;
+				edge_use[edge_key(p2, p0)]++;
+
+				// plane quadric, unweighted so sqrt(error) bounds the distance to every plane
+				const dvec3 a(m_positions[p0]), b(m_positions[p1]), c(m_positions[p2]);
+				const dvec3 n = cross(b - a, c - a);
+				const double len = length(n);
+				if (len <= 0) continue;
+				const quadric q(n / len, -dot(n / len, a));
+				m_quadrics[p0] += q;
+				m_quadrics[p1] += q;
+				m_quadrics[p2] += q;
+			}
+
+			for (size_t t = 0; t < tri_count; ++t) {
+				if (!m_tri_alive[t]) continue;
+				for (int k = 0; k < 3; ++k) {
+					const GLuint pa = pos(GLuint(t), k), pb = pos(GLuint(t), (k + 1) % 3);
+					const unsigned use = edge_use[edge_key(pa, pb)];
+					if (use == 1) {
+						m_border[pa] = m_border[pb] = true;
+
+						// a plane through the border edge perpendicular to the triangle keeps
+						// the border from sliding inwards
+						const dvec3 a(m_positions[pa]), b(m_positions[pb]), c(m_positions[pos(GLuint(t), (k + 2) % 3)]);
+						const dvec3 face = cross(b - a, c - a);
+						dvec3 n = cross(b - a, face);
+						const double len = length(n);
+						if (len > 0) {
+							n /= len;
+							const quadric q(n, -dot(n, a));
+							m_quadrics[pa] += q;
+							m_quadrics[pb] += q;
+						}
+					}
+					else if (use > 2) {
+						m_locked[pa] = m_locked[pb] = true;
+					}
+				}
+			}
+
+			// every edge in both directions
+			for (size_t t = 0; t < tri_count; ++t) {
+				if (!m_tri_alive[t]) continue;
+				for (int k = 0; k < 3; ++k) {
+					const GLuint pa = pos(GLuint(t), k), pb = pos(GLuint(t), (k + 1) % 3);
+					push(pa, pb);
+					push(pb, pa);
+				}
+			}
+		}
+
+
+		bool simplifier::try_collapse(const collapse &c) {
+			const GLuint u = c.from, v = c.to;
+			prune(u);
+			const vector<GLuint> &tris = m_tris_of[u];
+
+			// triangles on the collapsed edge
+			unsigned shared = 0;
+			for (GLuint t : tris) {
+				if (has_position(t, v)) shared++;
+			}
+			if (shared == 0) return false;
+
+			// border vertices may only move along the border
+			if (m_border[u] && (shared != 1 || !m_border[v])) return false;
+
+			// every vertex at u needs a vertex at v to merge into, taken from a triangle on the
+			// edge so the uvs/normals on that side of any seam are kept
+			vector<pair<GLuint, GLuint>> remap;
+			for (GLuint t : tris) {
+				if (!has_position(t, v)) continue;
+				GLuint from = no_vertex, to = no_vertex;
+				for (int k = 0; k < 3; ++k) {
+					if (pos(t, k) == u) from = m_indices[t * 3 + k];
+					if (pos(t, k) == v) to = m_indices[t * 3 + k];
+				}
+				auto it = find_if(remap.begin(), remap.end(), [&](const pair<GLuint, GLuint> &r) { return r.first == from; });
+				if (it == remap.end()) remap.emplace_back(from, to);
+			}
+
+			const auto remapped = [&](GLuint vertex) {
+				for (const auto &r : remap) if (r.first == vertex) return r.second;
+				return no_vertex;
+			};
+
+			// check the remaining triangles don't flip or collapse to nothing
+			const vec3 target = m_positions[v];
+			for (GLuint t : tris) {
+				if (has_position(t, v)) continue;
+
+				vec3 p[3], q[3];
+				for (int k = 0; k < 3; ++k) {
+					p[k] = m_positions[pos(t, k)];
+					q[k] = (pos(t, k) == u) ? target : p[k];
+					if (pos(t, k) == u && remapped(m_indices[t * 3 + k]) == no_vertex) return false;
+				}
+				const vec3 n0 = cross(p[1] - p[0], p[2] - p[0]);
+				const vec3 n1 = cross(q[1] - q[0], q[2] - q[0]);
+				const float l0 = length(n0), l1 = length(n1);
+				if (l1 <= 0 || (l0 > 0 && dot(n0, n1) < max_normal_change * l0 * l1)) return false;
+			}
+
+			// apply it
+			for (GLuint t : tris) {
+				if (has_position(t, v)) {
+					m_tri_alive[t] = false;
+					m_alive--;
+					continue;
+				}
+				for (int k = 0; k < 3; ++k) {
+					GLuint &index = m_indices[t * 3 + k];
+					if (m_position_of[index] == u) index = remapped(index);
+				}
+				m_tris_of[v].push_back(t);
+			}
+
+			m_removed[u] = true;
+			m_tris_of[u].clear();
+			m_quadrics[v] += m_quadrics[u];
+			m_locked[v] = m_locked[v] || m_locked[u];
+			m_stamp[v]++;
+			m_error = std::max(m_error, sqrt(c.cost));
+
+			// the error of every edge around v changed
+			prune(v);
+			for (GLuint t : m_tris_of[v]) {
+				for (int k = 0; k < 3; ++k) {
+					const GLuint w = pos(t, k);
+					if (w == v) continue;
+					push(w, v);
+					push(v, w);
+				}
+			}
+			return true;
+		}
+
+
+		bool simplifier::run(size_t target_index_count) {
+			while (m_alive * 3 > target_index_count) {
+				if (m_heap.empty()) return false;
+				const collapse c = m_heap.top();
+				m_heap.pop();
+
+				// skip anything that has changed since it was queued
+				if (m_removed[c.from] || m_removed[c.to]) continue;
+				if (m_stamp[c.from] != c.from_stamp || m_stamp[c.to] != c.to_stamp) continue;
+
+				try_collapse(c);
+			}
+			return true;
+		}
+
+
+		mesh_builder simplifier::result() const {
+			mesh_builder out(m_mb.mode);
+			vector<GLuint> new_index(m_mb.vertices.size(), no_vertex);
+			out.indices.reserve(m_alive * 3);
+			for (size_t t = 0; t < m_tri_alive.size(); ++t) {
+				if (!m_tri_alive[t]) continue;
+				for (int k = 0; k < 3; ++k) {
+					const GLuint i = m_indices[t * 3 + k];
+					if (new_index[i] == no_vertex) {
+						new_index[i] = GLuint(out.vertices.size());
+						out.vertices.push_back(m_mb.vertices[i]);
+					}
+					out.indices.push_back(new_index[i]);
+				}
+			}
+			return out;
+		}
+	}
+
+
+	mesh_builder simplify_mesh(const mesh_builder &mb, size_t target_index_count, float *result_error) {
+		if (mb.mode != GL_TRIANGLES) {
+			if (result_error) *result_error = 0;
+			return mb;
+		}
+		simplifier s(mb);
+		s.run(target_index_count);
+		if (result_error) *result_error = s.error();
+		return s.result();
+	}
+
+
+	vector<mesh_lod> generate_lod_chain(const mesh_builder &mb, const vector<float> &ratios) {
+		vector<mesh_lod> lods;
+		lods.push_back({ mb, 0 });
+		if (mb.mode != GL_TRIANGLES) return lods;
+
+		vector<float> sorted = ratios;
+		sort(sorted.begin(), sorted.end(), greater<float>());
+
+		// one run, taking a copy of the mesh each time it gets down to the next target
+		simplifier s(mb);
+		const size_t triangle_count = mb.indices.size() / 3;
+		for (float ratio : sorted) {
+			const size_t target = size_t(double(triangle_count) * glm::clamp(ratio, 0.f, 1.f)) * 3;
+			const bool reached = s.run(target);
+			if (s.index_count() < lods.back().mesh.indices.size()) {
+				mesh_lod lod{ s.result(), s.error() };
+				optimize_mesh(lod.mesh);
+				lods.push_back(std::move(lod));
+			}
+			if (!reached) break;
+		}
+		return lods;
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// std
+#include <vector>
+
+// project
+#include "cgra_mesh.hpp"
+
+
+namespace cgra {
+
+	// one level of detail of a mesh
+	// error is an object space bound on how far the simplified surface moved from the
+	// planes of the original triangles (0 for the original mesh)
+	struct mesh_lod {
+		mesh_builder mesh;
+		float error = 0;
+	};
+
+	// Quadric error metric simplification (Garland and Heckbert 1997) of a triangle list.
+	// Edges are collapsed into one of their end points so no new vertices are made, uv and
+	// normal seams are collapsed along the seam, and open borders only collapse along the border.
+	// Stops at target_index_count or when nothing else can be collapsed without folding a triangle.
+	mesh_builder simplify_mesh(const mesh_builder &mb, size_t target_index_count, float *result_error = nullptr);
+
+	// Generates a chain of LODs from one simplification run. The first level is the original
+	// mesh, then one level for each ratio of the original triangle count (largest ratio first).
+	// Levels that could not be simplified any further are left out. Each level is run through
+	// optimize_mesh so it draws as well as the original.
+	std::vector<mesh_lod> generate_lod_chain(const mesh_builder &mb, const std::vector<float> &ratios = { 0.5f, 0.25f, 0.1f, 0.03f });
+}
@@ -0,0 +1,304 @@
+
+// std
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+// project
+#include "cgra_tmesh.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+namespace cgra {
+
+	namespace {
+		const char tmesh_magic[4] = { 'T', 'M', 'S', 'H' };
+
+		// bump whenever the layout of the file or of mesh_vertex changes
+		const uint32_t tmesh_version = 1;
+
+		static_assert(sizeof(tmesh_header) == 80, "tmesh_header must have no padding");
+
+		size_t align16(size_t n) {
+			return (n + 15) & ~size_t(15);
+		}
+
+		bool valid_draw_mode(uint32_t mode) {
+			switch (mode) {
+			case GL_POINTS:
+			case GL_LINES:
+			case GL_LINE_LOOP:
+			case GL_LINE_STRIP:
+			case GL_TRIANGLES:
+			case GL_TRIANGLE_STRIP:
+			case GL_TRIANGLE_FAN:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		inline uint64_t rotl64(uint64_t x, int r) {
+			return (x << r) | (x >> (64 - r));
+		}
+
+		inline uint64_t fmix64(uint64_t k) {
+			k ^= k >> 33;
+			k *= 0xFF51AFD7ED558CCDull;
+			k ^= k >> 33;
+			k *= 0xC4CEB9FE1A85EC53ull;
+			k ^= k >> 33;
+			return k;
+		}
+	}
+
+
+	uint64_t hash_bytes(const void *data, size_t size) {
+		const uint64_t k1 = 0x87C37B91114253D5ull;
+		const uint64_t k2 = 0x4CF5AD432745937Full;
+
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		const size_t total = size;
+
+		// four independent lanes of 8 bytes so the multiplies can overlap
+		uint64_t h[4] = { 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull };
+		for (; size >= 32; p += 32, size -= 32) {
+			for (int lane = 0; lane < 4; ++lane) {
+				uint64_t w;
+				memcpy(&w, p + lane * 8, 8);
+				h[lane] = rotl64(h[lane] ^ (w * k1), 31) * k2;
+			}
+		}
+
+		uint64_t hash = rotl64(h[0], 1) + rotl64(h[1], 7) + rotl64(h[2], 12) + rotl64(h[3], 18);
+
+		// remaining bytes
+		for (; size >= 8; p += 8, size -= 8) {
+			uint64_t w;
+			memcpy(&w, p, 8);
+			hash = rotl64(hash ^ (w * k1), 27) * k2;
+		}
+		uint64_t tail = 0;
+		for (size_t i = 0; i < size; ++i) {
+			tail |= uint64_t(p[i]) << (i * 8);
+		}
+		hash = rotl64(hash ^ (tail * k1), 27) * k2;
+
+		return fmix64(hash ^ total);
+	}
+
+
+	uint64_t tmesh_options_key(const wavefront_options &options) {
+		// the parser and thread count don't change the output, only list options that do
+		uint64_t key = 0;
+		key |= uint64_t(options.weld) << 0;
+		key |= uint64_t(options.optimize) << 1;
+		key |= uint64_t(options.normals) << 2;
+		return key;
+	}
+
+
+	string tmesh_cache_path(const string &obj_filename) {
+		size_t slash = obj_filename.find_last_of("/\\");
+		size_t dot = obj_filename.find_last_of('.');
+		if (dot == string::npos || (slash != string::npos && dot < slash)) {
+			return obj_filename + ".tmesh";
+		}
+		return obj_filename.substr(0, dot) + ".tmesh";
+	}
+
+
+	tmesh::tmesh(const string &filename) : m_file(filename) {
+		const auto fail = [&](const char *reason) {
+			cerr << "Error: " << filename << " is not a valid tmesh (" << reason << ")" << endl;
+			throw runtime_error("Error: invalid tmesh file " + filename);
+		};
+
+		if (m_file.size() < sizeof(tmesh_header)) fail("truncated header");
+
+		tmesh_header header;
+		memcpy(&header, m_file.data(), sizeof(header));
+		if (memcmp(header.magic, tmesh_magic, 4) != 0) fail("bad magic");
+		if (header.version != tmesh_version) fail("old version");
+		if (header.vertex_stride != sizeof(mesh_vertex)) fail("vertex layout mismatch");
+
+		const uint64_t vertex_bytes = uint64_t(header.vertex_count) * sizeof(mesh_vertex);
+		const uint64_t index_bytes = uint64_t(header.index_count) * sizeof(GLuint);
+		if (header.vertex_offset % 16 || header.index_offset % 16) fail("misaligned section");
+		if (header.vertex_offset + vertex_bytes > m_file.size()) fail("truncated vertices");
+		if (header.index_offset + index_bytes > m_file.size()) fail("truncated indices");
+		if (!valid_draw_mode(header.mode)) fail("unknown draw mode");
+
+		m_vertices = reinterpret_cast<const mesh_vertex *>(m_file.data() + header.vertex_offset);
+		m_indices = reinterpret_cast<const GLuint *>(m_file.data() + header.index_offset);
+
+		// the indices go to the gpu as they are, one past the vertices would be read out of bounds
+		GLuint max_index = 0;
+		for (size_t i = 0; i < header.index_count; ++i) {
+			max_index = m_indices[i] > max_index ? m_indices[i] : max_index;
+		}
+		if (header.index_count > 0 && max_index >= header.vertex_count) fail("index out of range");
+		m_vertex_count = header.vertex_count;
+		m_index_count = header.index_count;
+		m_mode = header.mode;
+		m_source_hash = header.source_hash;
+		m_options_key = header.options_key;
+		m_bounds_min = vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+		m_bounds_max = vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+	}
+
+
+	tmesh::tmesh(mesh_builder mb, uint64_t source_hash, uint64_t options_key) : m_fallback(std::move(mb)) {
+		m_vertices = m_fallback.vertices.data();
+		m_indices = m_fallback.indices.data();
+		m_vertex_count = m_fallback.vertices.size();
+		m_index_count = m_fallback.indices.size();
+		m_mode = m_fallback.mode;
+		m_source_hash = source_hash;
+		m_options_key = options_key;
+		if (!m_fallback.vertices.empty()) {
+			m_bounds_min = m_bounds_max = m_fallback.vertices[0].pos;
+			for (const mesh_vertex &v : m_fallback.vertices) {
+				m_bounds_min = glm::min(m_bounds_min, v.pos);
+				m_bounds_max = glm::max(m_bounds_max, v.pos);
+			}
+		}
+	}
+
+
+	mesh_builder tmesh::to_mesh_builder() const {
+		mesh_builder mb(m_mode);
+		mb.vertices.assign(m_vertices, m_vertices + m_vertex_count);
+		mb.indices.assign(m_indices, m_indices + m_index_count);
+		return mb;
+	}
+
+
+	bool write_tmesh(const string &filename, const mesh_builder &mb, uint64_t source_hash, uint64_t options_key) {
+		tmesh_header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, tmesh_magic, 4);
+		header.version = tmesh_version;
+		header.source_hash = source_hash;
+		header.options_key = options_key;
+		header.mode = mb.mode;
+		header.vertex_stride = sizeof(mesh_vertex);
+		header.vertex_count = uint32_t(mb.vertices.size());
+		header.index_count = uint32_t(mb.indices.size());
+		header.vertex_offset = align16(sizeof(tmesh_header));
+		header.index_offset = align16(header.vertex_offset + mb.vertices.size() * sizeof(mesh_vertex));
+
+		vec3 bmin{0}, bmax{0};
+		if (!mb.vertices.empty()) {
+			bmin = bmax = mb.vertices[0].pos;
+			for (const mesh_vertex &v : mb.vertices) {
+				bmin = glm::min(bmin, v.pos);
+				bmax = glm::max(bmax, v.pos);
+			}
+		}
+		for (int i = 0; i < 3; ++i) {
+			header.bounds_min[i] = bmin[i];
+			header.bounds_max[i] = bmax[i];
+		}
+
+		// write to a temporary and then swap it in, so a crash never leaves a half written cache
+		const string temp_filename = filename + ".tmp";
+		{
+			ofstream out(temp_filename, ios::binary | ios::trunc);
+			if (!out) {
+				cerr << "Warning: could not write mesh cache " << filename << endl;
+				return false;
+			}
+
+			const char zeros[16] = {};
+			const auto pad_to = [&](uint64_t offset) {
+				uint64_t pos = uint64_t(out.tellp());
+				if (pos < offset) out.write(zeros, streamsize(offset - pos));
+			};
+
+			out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+			pad_to(header.vertex_offset);
+			out.write(reinterpret_cast<const char *>(mb.vertices.data()), streamsize(mb.vertices.size() * sizeof(mesh_vertex)));
+			pad_to(header.index_offset);
+			out.write(reinterpret_cast<const char *>(mb.indices.data()), streamsize(mb.indices.size() * sizeof(GLuint)));
+
+			if (!out) {
+				cerr << "Warning: could not write mesh cache " << filename << endl;
+				out.close();
+				remove(temp_filename.c_str());
+				return false;
+			}
+		}
+
+		// rename won't replace an existing file on windows
+		remove(filename.c_str());
+		if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+			cerr << "Warning: could not write mesh cache " << filename << endl;
+			remove(temp_filename.c_str());
+			return false;
+		}
+		return true;
+	}
+
+
+	bool bake_tmesh(const string &obj_filename, const wavefront_options &options, wavefront_stats *stats) {
+		uint64_t source_hash;
+		{
+			mapped_file obj(obj_filename);
+			source_hash = hash_bytes(obj.data(), obj.size());
+		}
+		mesh_builder mb = load_wavefront_data(obj_filename, options, stats);
+		return write_tmesh(tmesh_cache_path(obj_filename), mb, source_hash, tmesh_options_key(options));
+	}
+
+
+	tmesh load_wavefront_cached(const string &obj_filename, const wavefront_options &options, wavefront_stats *stats) {
+		using clock = chrono::steady_clock;
+		const auto start_time = clock::now();
+
+		// the cache is only valid for the exact same .obj content
+		uint64_t source_hash;
+		{
+			mapped_file obj(obj_filename);
+			source_hash = hash_bytes(obj.data(), obj.size());
+		}
+		const uint64_t options_key = tmesh_options_key(options);
+		const string cache_filename = tmesh_cache_path(obj_filename);
+
+		if (ifstream(cache_filename).good()) {
+			try {
+				tmesh cached(cache_filename);
+				if (cached.source_hash() == source_hash && cached.options_key() == options_key) {
+					if (stats) {
+						*stats = wavefront_stats();
+						stats->triangles = cached.index_count() / 3;
+						stats->corners = cached.index_count();
+						stats->vertices = cached.vertex_count();
+						stats->parse_ms = chrono::duration<double, milli>(clock::now() - start_time).count();
+						stats->from_cache = true;
+					}
+					return cached;
+				}
+			}
+			catch (runtime_error &) {
+				// fall through and rebuild it
+			}
+		}
+
+		// stale or missing, parse the .obj and rewrite the cache
+		mesh_builder mb = load_wavefront_data(obj_filename, options, stats);
+		if (write_tmesh(cache_filename, mb, source_hash, options_key)) {
+			try {
+				return tmesh(cache_filename);
+			}
+			catch (runtime_error &) { }
+		}
+		return tmesh(std::move(mb), source_hash, options_key);
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_mapped_file.hpp"
+#include "cgra_mesh.hpp"
+#include "cgra_wavefront.hpp"
+
+
+namespace cgra {
+
+	// Binary mesh container (.tmesh) holding the vertex and index arrays exactly as they
+	// are passed to glBufferData, so loading is a memory map and upload. The source hash
+	// is the content hash of the .obj it was baked from and is used for cache invalidation.
+	//
+	// layout (little endian): tmesh_header, vertices, indices
+	// each section starts on a 16 byte boundary
+	struct tmesh_header {
+		char magic[4];          // "TMSH"
+		uint32_t version;
+		uint64_t source_hash;   // hash_bytes of the source .obj
+		uint64_t options_key;   // loader options that affect the output
+		uint32_t mode;          // GLenum draw mode
+		uint32_t vertex_stride; // sizeof(mesh_vertex) when written
+		uint32_t vertex_count;
+		uint32_t index_count;
+		uint64_t vertex_offset; // byte offsets from the start of the file
+		uint64_t index_offset;
+		float bounds_min[3];
+		float bounds_max[3];
+	};
+
+
+	// A loaded .tmesh. The arrays point straight into the mapped file
+	// (or into a mesh_builder if the cache could not be written).
+	class tmesh {
+	private:
+		mapped_file m_file;
+		mesh_builder m_fallback;
+		const mesh_vertex *m_vertices = nullptr;
+		const GLuint *m_indices = nullptr;
+		size_t m_vertex_count = 0;
+		size_t m_index_count = 0;
+		GLenum m_mode = GL_TRIANGLES;
+		uint64_t m_source_hash = 0;
+		uint64_t m_options_key = 0;
+		glm::vec3 m_bounds_min{0};
+		glm::vec3 m_bounds_max{0};
+
+	public:
+		tmesh() { }
+
+		// maps and validates a .tmesh file, throws std::runtime_error if it is missing or malformed
+		explicit tmesh(const std::string &filename);
+
+		// wraps an in memory mesh (nothing is mapped)
+		tmesh(mesh_builder mb, uint64_t source_hash, uint64_t options_key);
+
+		// the arrays point into memory owned by this object, moving keeps them valid
+		tmesh(const tmesh &) = delete;
+		tmesh & operator=(const tmesh &) = delete;
+		tmesh(tmesh &&) = default;
+		tmesh & operator=(tmesh &&) = default;
+
+		const mesh_vertex * vertices() const { return m_vertices; }
+		const GLuint * indices() const { return m_indices; }
+		size_t vertex_count() const { return m_vertex_count; }
+		size_t index_count() const { return m_index_count; }
+		GLenum mode() const { return m_mode; }
+		uint64_t source_hash() const { return m_source_hash; }
+		uint64_t options_key() const { return m_options_key; }
+		glm::vec3 bounds_min() const { return m_bounds_min; }
+		glm::vec3 bounds_max() const { return m_bounds_max; }
+
+		// uploads the arrays directly from the mapped pages (packed first if the format is not full precision)
+		gl_mesh build(const vertex_format &format = {}) const {
+			return build_gl_mesh(m_vertices, m_vertex_count, m_indices, m_index_count, m_mode, format);
+		}
+
+		// copies the arrays into a new mesh builder
+		mesh_builder to_mesh_builder() const;
+	};
+
+
+	// 64 bit content hash (not cryptographic)
+	uint64_t hash_bytes(const void *data, size_t size);
+
+	// a key for the wavefront options that change the loaded mesh
+	uint64_t tmesh_options_key(const wavefront_options &options);
+
+	// the cache file used for an .obj, the same path with a .tmesh extension
+	std::string tmesh_cache_path(const std::string &obj_filename);
+
+	// writes a .tmesh file, returns false (and prints why) if it could not be written
+	bool write_tmesh(const std::string &filename, const mesh_builder &mb, uint64_t source_hash, uint64_t options_key);
+
+	// loads the .obj and writes its .tmesh cache regardless of any existing cache
+	// returns false if the cache could not be written
+	bool bake_tmesh(const std::string &obj_filename, const wavefront_options &options = {}, wavefront_stats *stats = nullptr);
+
+	// Loads an .obj through its .tmesh cache. If the cache is missing, or was baked from
+	// different .obj content or with different options, the .obj is parsed and the cache is
+	// (re)written. stats->from_cache says which happened.
+	tmesh load_wavefront_cached(const std::string &obj_filename, const wavefront_options &options = {}, wavefront_stats *stats = nullptr);
+}
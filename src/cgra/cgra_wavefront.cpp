@@ -0,0 +1,552 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_wavefront.hpp"
+#include "cgra_mapped_file.hpp"
+#include "cgra_normals.hpp"
+#include "cgra_parallel.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+namespace cgra {
+
+	namespace {
+
+		// struct for storing wavefront index data
+		// (zero based, an index of -1 means it was not given)
+		struct wavefront_vertex {
+			unsigned int p = 0, n = 0, t = 0;
+
+			bool operator==(const wavefront_vertex &o) const {
+				return p == o.p && n == o.n && t == o.t;
+			}
+		};
+
+		struct wavefront_vertex_hash {
+			size_t operator()(const wavefront_vertex &v) const {
+				// 64 bit multiplicative mix, the position index carries most of the entropy
+				uint64_t h = (uint64_t(v.p) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(v.t) * 0xC2B2AE3D27D4EB4Full) ^ (uint64_t(v.n) * 0x165667B19E3779F9ull);
+				return size_t(h ^ (h >> 29));
+			}
+		};
+
+		// a face corner that used relative (negative) indices, these are resolved against
+		// the counts seen so far and have to be offset when data is merged after the fact
+		struct relative_corner {
+			size_t corner;
+			unsigned char mask; // bit 0 : p, bit 1 : n, bit 2 : t
+		};
+
+		// raw wavefront data as it appears in the file
+		struct wavefront_data {
+			vector<vec3> positions;
+			vector<vec3> normals;
+			vector<vec2> uvs;
+			vector<wavefront_vertex> wv_vertices;
+			vector<relative_corner> relative;
+		};
+
+
+		void parse_wavefront_stream(const string &filename, wavefront_data &data) {
+
+			// open file
+			ifstream objFile(filename);
+			if (!objFile.is_open()) {
+				cerr << "Error: could not open " << filename << endl;
+				throw runtime_error("Error: could not open file " + filename);
+			}
+
+			// good() means that failbit, badbit and eofbit are all not set
+			while (objFile.good()) {
+
+				// Pull out line from file
+				string line;
+				getline(objFile, line);
+				istringstream objLine(line);
+
+				// Pull out mode from line
+				string mode;
+				objLine >> mode;
+
+				// Reading like this means whitespace at the start of the line is fine
+				// attempting to read from an empty string/line will set the failbit
+				if (objLine.good()) {
+
+
+					if (mode == "v") {
+						vec3 v;
+						objLine >> v.x >> v.y >> v.z;
+						data.positions.push_back(v);
+					}
+					else if (mode == "vn") {
+						vec3 vn;
+						objLine >> vn.x >> vn.y >> vn.z;
+						data.normals.push_back(vn);
+
+					}
+					else if (mode == "vt") {
+						vec2 vt;
+						objLine >> vt.x >> vt.y;
+						data.uvs.push_back(vt);
+
+					}
+					else if (mode == "f") {
+
+						std::vector<wavefront_vertex> face;
+						while (objLine.good()) {
+							wavefront_vertex v;
+
+							// scan in position index
+							objLine >> v.p;
+							if (objLine.fail()) break;
+
+							// look ahead for a match
+							if (objLine.peek() == '/') {
+								// ignore the '/' character
+								objLine.ignore(1);
+
+								// scan in uv (texture coord) index (if it's there)
+								if (objLine.peek() != '/') {
+									objLine >> v.t;
+								}
+
+								// scan in normal index (if it's there)
+								if (objLine.peek() == '/') {
+									objLine.ignore(1);
+									objLine >> v.n;
+								}
+							}
+
+							// subtract one because of wavefront indexing
+							v.p -= 1;
+							v.n -= 1;
+							v.t -= 1;
+
+							face.push_back(v);
+						}
+
+						// IFF we have 3 verticies, construct a triangle
+						if (face.size() == 3) {
+							for (int i = 0; i < 3; ++i) {
+								data.wv_vertices.push_back(face[i]);
+							}
+						}
+					}
+				}
+			}
+		}
+
+
+		// Locale independent tokenizer helpers for the mapped parser.
+		// Each takes an iterator into the current line by reference and advances it
+		// past what was consumed, never reading at or past the end of the line.
+
+		inline bool is_space(char c) {
+			return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+		}
+
+		inline bool is_digit(char c) {
+			return unsigned(c - '0') < 10;
+		}
+
+		inline void skip_space(const char *&it, const char *end) {
+			while (it != end && is_space(*it)) ++it;
+		}
+
+		// parses an optionally signed decimal integer, returns false if there isn't one
+		inline bool parse_int(const char *&it, const char *end, long long &out) {
+			const char *p = it;
+			bool neg = false;
+			if (p != end && (*p == '+' || *p == '-')) neg = *p++ == '-';
+			if (p == end || !is_digit(*p)) return false;
+			long long v = 0;
+			for (; p != end && is_digit(*p); ++p) {
+				v = v * 10 + (*p - '0');
+			}
+			out = neg ? -v : v;
+			it = p;
+			return true;
+		}
+
+		// parses a decimal float (optional sign, fraction and exponent), returns false if there isn't one.
+		// Numbers whose digits fit in a float's 24 bit mantissa, scaled by a power of ten a float
+		// holds exactly, take one correctly rounded multiply or divide, giving the same float as
+		// strtof. That covers the 6-7 digits real exporters write. Anything else falls back to
+		// strtof on a copy of the token.
+		inline bool parse_float(const char *&it, const char *end, float &out) {
+			static const float pow10[] = {
+				1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+			};
+
+			const char *start = it;
+			const char *p = it;
+			bool neg = false;
+			if (p != end && (*p == '+' || *p == '-')) neg = *p++ == '-';
+
+			uint64_t mantissa = 0;
+			int sig_digits = 0;
+			int exp10 = 0;
+			bool any_digits = false;
+			bool truncated = false;
+
+			// integer part
+			for (; p != end && is_digit(*p); ++p) {
+				any_digits = true;
+				if (sig_digits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa) sig_digits++;
+				}
+				else {
+					exp10++;
+					truncated = true;
+				}
+			}
+
+			// fractional part
+			if (p != end && *p == '.') {
+				++p;
+				for (; p != end && is_digit(*p); ++p) {
+					any_digits = true;
+					if (sig_digits < 19) {
+						mantissa = mantissa * 10 + (*p - '0');
+						if (mantissa) sig_digits++;
+						exp10--;
+					}
+					else {
+						truncated = true;
+					}
+				}
+			}
+
+			if (!any_digits) return false;
+
+			// exponent (only consumed if it has digits)
+			if (p != end && (*p == 'e' || *p == 'E')) {
+				const char *e = p + 1;
+				long long ev;
+				if (parse_int(e, end, ev)) {
+					exp10 += int(std::max(-100000ll, std::min(ev, 100000ll)));
+					p = e;
+				}
+			}
+
+			it = p;
+
+			if (!truncated && mantissa <= (uint64_t(1) << 24) && exp10 >= -10 && exp10 <= 10) {
+				float f = float(mantissa);
+				f = (exp10 < 0) ? f / pow10[-exp10] : f * pow10[exp10];
+				out = neg ? -f : f;
+				return true;
+			}
+
+			// slow path, strtof needs a null terminated copy
+			string token(start, p);
+			out = strtof(token.c_str(), nullptr);
+			return true;
+		}
+
+		// converts a wavefront index (1 based, negative is relative to the end)
+		// into a zero based index, -1 if it is invalid
+		inline unsigned int resolve_index(long long i, size_t count) {
+			if (i > 0) return unsigned(i - 1);
+			if (i < 0) return unsigned(static_cast<long long>(count) + i);
+			return unsigned(-1);
+		}
+
+
+		void parse_wavefront_range(const char *begin, const char *end, wavefront_data &data) {
+			const char *line = begin;
+			while (line < end) {
+
+				// find the extent of the line
+				const char *eol = line;
+				while (eol != end && *eol != '\n') ++eol;
+				const char *it = line;
+				line = (eol == end) ? end : eol + 1;
+
+				// pull out mode from line, skipping leading whitespace
+				skip_space(it, eol);
+				const char *mode = it;
+				while (it != eol && !is_space(*it)) ++it;
+				size_t mode_len = it - mode;
+
+				// matches the stream parser, a mode with nothing after it is ignored
+				if (mode_len == 0 || it == eol) continue;
+
+				if (mode_len == 1 && mode[0] == 'v') {
+					vec3 v{0};
+					for (int i = 0; i < 3; ++i) {
+						skip_space(it, eol);
+						if (!parse_float(it, eol, v[i])) break;
+					}
+					data.positions.push_back(v);
+				}
+				else if (mode_len == 2 && mode[0] == 'v' && mode[1] == 'n') {
+					vec3 vn{0};
+					for (int i = 0; i < 3; ++i) {
+						skip_space(it, eol);
+						if (!parse_float(it, eol, vn[i])) break;
+					}
+					data.normals.push_back(vn);
+				}
+				else if (mode_len == 2 && mode[0] == 'v' && mode[1] == 't') {
+					vec2 vt{0};
+					for (int i = 0; i < 2; ++i) {
+						skip_space(it, eol);
+						if (!parse_float(it, eol, vt[i])) break;
+					}
+					data.uvs.push_back(vt);
+				}
+				else if (mode_len == 1 && mode[0] == 'f') {
+
+					// only triangles are kept so we never need more than 3 (+1 to detect polygons)
+					wavefront_vertex face[4];
+					unsigned char face_relative[4];
+					int face_size = 0;
+					while (face_size < 4) {
+						wavefront_vertex v;
+						v.p = v.n = v.t = unsigned(-1);
+						unsigned char rel = 0;
+						long long i;
+
+						// scan in position index
+						skip_space(it, eol);
+						if (!parse_int(it, eol, i)) break;
+						v.p = resolve_index(i, data.positions.size());
+						rel |= (i < 0) << 0;
+
+						if (it != eol && *it == '/') {
+							++it;
+
+							// scan in uv (texture coord) index (if it's there)
+							if (it != eol && *it != '/' && parse_int(it, eol, i)) {
+								v.t = resolve_index(i, data.uvs.size());
+								rel |= (i < 0) << 2;
+							}
+
+							// scan in normal index (if it's there)
+							if (it != eol && *it == '/') {
+								++it;
+								if (parse_int(it, eol, i)) {
+									v.n = resolve_index(i, data.normals.size());
+									rel |= (i < 0) << 1;
+								}
+							}
+						}
+
+						face_relative[face_size] = rel;
+						face[face_size++] = v;
+					}
+
+					// IFF we have 3 verticies, construct a triangle
+					if (face_size == 3) {
+						for (int k = 0; k < 3; ++k) {
+							if (face_relative[k]) data.relative.push_back({ data.wv_vertices.size() + k, face_relative[k] });
+						}
+						data.wv_vertices.insert(data.wv_vertices.end(), face, face + 3);
+					}
+				}
+			}
+		}
+
+
+		void parse_wavefront_mapped(const string &filename, wavefront_data &data) {
+			mapped_file file(filename);
+			parse_wavefront_range(file.begin(), file.end(), data);
+		}
+
+
+		// Splits the mapped file into one chunk per thread (ending on line boundaries) and
+		// parses them concurrently. The chunks are then concatenated in file order, with
+		// per-chunk offsets from a prefix sum fixing up any relative indices, so the result
+		// is identical to parsing the whole file serially.
+		void parse_wavefront_parallel(const string &filename, unsigned threads, wavefront_data &data) {
+			// below this many bytes per chunk thread startup costs more than it saves
+			const size_t min_chunk_size = 1 << 20;
+
+			mapped_file file(filename);
+
+			if (threads == 0) threads = hardware_threads();
+			size_t max_chunks = std::max<size_t>(1, file.size() / min_chunk_size);
+			unsigned chunk_count = unsigned(std::min<size_t>(threads, max_chunks));
+
+			if (chunk_count <= 1) {
+				parse_wavefront_range(file.begin(), file.end(), data);
+				return;
+			}
+
+			// split at roughly equal sizes, then push each split to just past the next newline
+			vector<const char *> bounds(chunk_count + 1);
+			bounds[0] = file.begin();
+			bounds[chunk_count] = file.end();
+			for (unsigned k = 1; k < chunk_count; ++k) {
+				const char *split = std::max(bounds[k - 1], file.begin() + file.size() * k / chunk_count);
+				split = std::find(split, file.end(), '\n');
+				bounds[k] = (split == file.end()) ? split : split + 1;
+			}
+
+			vector<wavefront_data> chunks(chunk_count);
+			parallel_tasks(chunk_count, [&](unsigned k) {
+				parse_wavefront_range(bounds[k], bounds[k + 1], chunks[k]);
+			});
+
+			// exclusive prefix sum of the element counts gives each chunk its offset
+			struct chunk_offsets {
+				size_t p = 0, n = 0, t = 0, corner = 0;
+			};
+			vector<chunk_offsets> offsets(chunk_count + 1);
+			for (unsigned k = 0; k < chunk_count; ++k) {
+				offsets[k + 1].p = offsets[k].p + chunks[k].positions.size();
+				offsets[k + 1].n = offsets[k].n + chunks[k].normals.size();
+				offsets[k + 1].t = offsets[k].t + chunks[k].uvs.size();
+				offsets[k + 1].corner = offsets[k].corner + chunks[k].wv_vertices.size();
+			}
+
+			data.positions.resize(offsets[chunk_count].p);
+			data.normals.resize(offsets[chunk_count].n);
+			data.uvs.resize(offsets[chunk_count].t);
+			data.wv_vertices.resize(offsets[chunk_count].corner);
+
+			// copy each chunk into place and fix up its relative indices
+			parallel_tasks(chunk_count, [&](unsigned k) {
+				wavefront_data &chunk = chunks[k];
+				const chunk_offsets &off = offsets[k];
+
+				std::copy(chunk.positions.begin(), chunk.positions.end(), data.positions.begin() + off.p);
+				std::copy(chunk.normals.begin(), chunk.normals.end(), data.normals.begin() + off.n);
+				std::copy(chunk.uvs.begin(), chunk.uvs.end(), data.uvs.begin() + off.t);
+				std::copy(chunk.wv_vertices.begin(), chunk.wv_vertices.end(), data.wv_vertices.begin() + off.corner);
+
+				for (const relative_corner &rc : chunk.relative) {
+					wavefront_vertex &v = data.wv_vertices[off.corner + rc.corner];
+					if (rc.mask & 1) v.p += unsigned(off.p);
+					if (rc.mask & 2) v.n += unsigned(off.n);
+					if (rc.mask & 4) v.t += unsigned(off.t);
+				}
+
+				// release the chunk early, peak memory is otherwise twice the parsed data
+				chunk = wavefront_data();
+			});
+		}
+
+
+		mesh_builder build_wavefront_mesh(wavefront_data &data, const wavefront_options &options, double *normals_ms) {
+			vector<vec3> &positions = data.positions;
+			vector<vec3> &normals = data.normals;
+			vector<vec2> &uvs = data.uvs;
+			vector<wavefront_vertex> &wv_vertices = data.wv_vertices;
+			const bool weld = options.weld;
+
+			// if we don't have any normals, create them from the faces
+			if (normals.empty()) {
+				const auto start_time = chrono::steady_clock::now();
+
+				// set the normal index to be the same as position index
+				vector<GLuint> position_indices(wv_vertices.size());
+				for (size_t i = 0; i < wv_vertices.size(); i++) {
+					wv_vertices[i].n = wv_vertices[i].p;
+					position_indices[i] = wv_vertices[i].p;
+				}
+
+				generate_normals(positions, position_indices.data(), position_indices.size(), normals, options.normals, options.threads);
+
+				if (normals_ms) *normals_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start_time).count();
+			}
+
+			// todo create spherical UV's if they don't exist
+
+			// create mesh data
+			// missing or out of range attributes are left as zero
+			const auto make_vertex = [&](const wavefront_vertex &wv) {
+				return mesh_vertex{
+					(wv.p < positions.size()) ? positions[wv.p] : vec3(0),
+					(wv.n < normals.size()) ? normals[wv.n] : vec3(0),
+					(wv.t < uvs.size()) ? uvs[wv.t] : vec2(0)
+				};
+			};
+
+			mesh_builder mb;
+			mb.indices.reserve(wv_vertices.size());
+
+			if (weld) {
+				// every unique p/n/t triple becomes one shared vertex, numbered in order of first use
+				unordered_map<wavefront_vertex, GLuint, wavefront_vertex_hash> vertex_ids;
+				vertex_ids.reserve(std::max(positions.size(), uvs.size()) * 2);
+
+				for (const wavefront_vertex &wv : wv_vertices) {
+					auto inserted = vertex_ids.emplace(wv, GLuint(mb.vertices.size()));
+					if (inserted.second) mb.push_vertex(make_vertex(wv));
+					mb.push_index(inserted.first->second);
+				}
+			}
+			else {
+				mb.vertices.reserve(wv_vertices.size());
+				for (unsigned int i = 0; i < wv_vertices.size(); ++i) {
+					mb.push_index(i);
+					mb.push_vertex(make_vertex(wv_vertices[i]));
+				}
+			}
+
+			return mb;
+		}
+	}
+
+
+	mesh_builder load_wavefront_data(const string &filename, const wavefront_options &options, wavefront_stats *stats) {
+		using clock = chrono::steady_clock;
+		const auto start_time = clock::now();
+
+		wavefront_data data;
+
+		switch (options.parser) {
+		case wavefront_parser::stream:
+			parse_wavefront_stream(filename, data);
+			break;
+		case wavefront_parser::mapped:
+			parse_wavefront_mapped(filename, data);
+			break;
+		case wavefront_parser::parallel:
+		default:
+			parse_wavefront_parallel(filename, options.threads, data);
+			break;
+		}
+
+		const auto parse_time = clock::now();
+		double normals_ms = 0;
+		mesh_builder mb = build_wavefront_mesh(data, options, &normals_ms);
+
+		mesh_optimize_stats optimize_stats;
+		if (options.optimize) optimize_stats = optimize_mesh(mb);
+
+		if (stats) {
+			*stats = wavefront_stats();
+			stats->triangles = mb.indices.size() / 3;
+			stats->corners = mb.indices.size();
+			stats->vertices = mb.vertices.size();
+			stats->parse_ms = chrono::duration<double, milli>(parse_time - start_time).count();
+			stats->build_ms = chrono::duration<double, milli>(clock::now() - parse_time).count();
+			stats->normals_ms = normals_ms;
+			stats->optimized = options.optimize;
+			stats->optimize = optimize_stats;
+		}
+
+		return mb;
+	}
+}
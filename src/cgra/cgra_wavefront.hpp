@@ -2,169 +2,63 @@
 #pragma once
 
 // std
-#include <fstream>
 #include <string>
-#include <sstream>
-#include <vector>
 
 // project
 #include "cgra_mesh.hpp"
+#include "cgra_mesh_optimize.hpp"
+#include "cgra_normals.hpp"
 
 
 namespace cgra {
 
-	inline mesh_builder load_wavefront_data(const std::string &filename) {
-		using namespace std;
-		using namespace glm;
-
-		// struct for storing wavefront index data
-		struct wavefront_vertex {
-			unsigned int p, n, t;
-		};
-
-		// create reading buffers
-		vector<vec3> positions;
-		vector<vec3> normals;
-		vector<vec2> uvs;
-		vector<wavefront_vertex> wv_vertices;
-
-		// open file
-		ifstream objFile(filename);
-		if (!objFile.is_open()) {
-			cerr << "Error: could not open " << filename << endl;
-			throw runtime_error("Error: could not open file " + filename);
-		}
-
-		// good() means that failbit, badbit and eofbit are all not set
-		while (objFile.good()) {
-
-			// Pull out line from file
-			string line;
-			getline(objFile, line);
-			istringstream objLine(line);
-
-			// Pull out mode from line
-			string mode;
-			objLine >> mode;
-
-			// Reading like this means whitespace at the start of the line is fine
-			// attempting to read from an empty string/line will set the failbit
-			if (objLine.good()) {
-
-
-				if (mode == "v") {
-					vec3 v;
-					objLine >> v.x >> v.y >> v.z;
-					positions.push_back(v);
-				}
-				else if (mode == "vn") {
-					vec3 vn;
-					objLine >> vn.x >> vn.y >> vn.z;
-					normals.push_back(vn);
-
-				}
-				else if (mode == "vt") {
-					vec2 vt;
-					objLine >> vt.x >> vt.y;
-					uvs.push_back(vt);
-
-				}
-				else if (mode == "f") {
-
-					std::vector<wavefront_vertex> face;
-					while (objLine.good()) {
-						wavefront_vertex v;
-
-						// scan in position index
-						objLine >> v.p;
-						if (objLine.fail()) break;
-
-						// look ahead for a match
-						if (objLine.peek() == '/') {	
-							// ignore the '/' character
-							objLine.ignore(1);			
-
-							// scan in uv (texture coord) index (if it's there)
-							if (objLine.peek() != '/') {
-								objLine >> v.t;
-							}
-
-							// scan in normal index (if it's there)
-							if (objLine.peek() == '/') {
-								objLine.ignore(1);
-								objLine >> v.n;
-							}
-						}
-
-						// subtract one because of wavefront indexing
-						v.p -= 1;
-						v.n -= 1;
-						v.t -= 1;
-
-						face.push_back(v);
-					}
-
-					// IFF we have 3 verticies, construct a triangle
-					if (face.size() == 3) {
-						for (int i = 0; i < 3; ++i) {
-							wv_vertices.push_back(face[i]);
-						}
-					}
-				}
-			}
-		}
-
-		// if we don't have any normals, create them naively
-		if (normals.empty()) {
-			// Create the normals as 3d vectors of 0
-			normals.resize(positions.size(), vec3(0));
-
-			// add the normal for every face to each vertex-normal
-			for (size_t i = 0; i < wv_vertices.size()/3; i++) {
-				wavefront_vertex &a = wv_vertices[i*3];
-				wavefront_vertex &b = wv_vertices[i*3+1];
-				wavefront_vertex &c = wv_vertices[i*3+2];
-
-				// set the normal index to be the same as position index
-				a.n = a.p;
-				b.n = b.p;
-				c.n = c.p;
-
-				// calculate the face normal
-				vec3 ab = positions[b.p] - positions[a.p];
-				vec3 ac = positions[c.p] - positions[a.p];
-				vec3 face_norm = cross(ab, ac);
-
-				// contribute the face norm to each vertex
-				float l = length(face_norm);
-				if (l > 0) {
-					face_norm / l;
-					normals[a.n] += face_norm;
-					normals[b.n] += face_norm;
-					normals[c.n] += face_norm;
-				}
-			}
-
-			// normalize the normals
-			for (size_t i = 0; i < normals.size(); i++) {
-				normals[i] = normalize(normals[i]);
-			}
-		}
-
-		// todo create spherical UV's if they don't exist
-
-		// create mesh data
-		mesh_builder mb;
-
-		for (unsigned int i = 0; i < wv_vertices.size(); ++i) {
-			mb.push_index(i);
-			mb.push_vertex(mesh_vertex{
-				positions[wv_vertices[i].p],
-				normals[wv_vertices[i].n],
-				uvs[wv_vertices[i].t]
-			});
+	// which tokenizer load_wavefront_data uses to read the file
+	// all produce identical mesh_builder output, stream is kept for comparison
+	enum class wavefront_parser {
+		stream,  // std::getline + std::istringstream per line
+		mapped,  // memory mapped file tokenized in place, no per-line allocation
+		parallel // mapped, split at line boundaries and tokenized on several threads
+	};
+
+	struct wavefront_options {
+		wavefront_parser parser = wavefront_parser::parallel;
+
+		// worker threads for the parallel parser and normal generation, 0 uses every
+		// hardware thread. small files are always parsed on the calling thread
+		unsigned threads = 0;
+
+		// how face normals are weighted when the file has no vn records
+		normal_weighting normals = normal_weighting::area;
+
+		// share one vertex between every face corner with the same p/t/n triple
+		// otherwise every corner gets its own vertex (3 per triangle)
+		bool weld = true;
+
+		// run optimize_mesh on the result (vertex cache, overdraw and vertex fetch order)
+		bool optimize = false;
+	};
+
+	// what the loader produced and how long it took
+	struct wavefront_stats {
+		size_t triangles = 0;
+		size_t corners = 0;  // face corners in the file (= indices)
+		size_t vertices = 0; // vertices after welding (= corners if not welded)
+		double parse_ms = 0;
+		double build_ms = 0;
+		double normals_ms = 0;   // part of build_ms, 0 if the file had normals
+		bool from_cache = false; // loaded from a .tmesh cache (see cgra_tmesh.hpp)
+
+		bool optimized = false; // optimize_mesh was run, optimize holds its results
+		mesh_optimize_stats optimize;
+
+		// how many times smaller the vertex buffer is than one vertex per corner
+		double vertex_reduction() const {
+			return vertices ? double(corners) / vertices : 1.0;
 		}
+	};
 
-		return mb;
-	}
-}
\ No newline at end of file
+	// loads a wavefront .obj file into a mesh builder, throws std::runtime_error if the
+	// file can't be opened. only triangle faces are kept, normals are generated if the
+	// file has none. if stats is given it is filled in with load statistics
+	mesh_builder load_wavefront_data(const std::string &filename, const wavefront_options &options = {}, wavefront_stats *stats = nullptr);
+}
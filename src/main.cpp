@@ -7,6 +7,7 @@
 // project
 #include "application.hpp"
 #include "opengl.hpp"
+#include "cgra/cgra_gl_state.hpp"
 #include "cgra/cgra_gui.hpp"
 
 
@@ -123,6 +124,10 @@ int main() {
 		application.renderGUI();
 		cgra::gui::render();
 
+		// the gui sets gl state without the cache, which starts counting the next frame
+		cgra::gl_state().invalidate();
+		cgra::gl_state().end_frame();
+
 		// swap front and back buffers
 		glfwSwapBuffers(window);
 
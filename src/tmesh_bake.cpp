@@ -0,0 +1,70 @@
+// std
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// project
+#include "cgra/cgra_tmesh.hpp"
+#include "cgra/cgra_wavefront.hpp"
+
+
+using namespace std;
+using namespace cgra;
+
+
+// Offline baker for .tmesh caches
+// writes <name>.tmesh next to every .obj given so the application never has to parse them
+//
+// usage: tmesh_bake [--no-weld] [--optimize] [--normals=uniform|area|angle] file.obj ...
+//
+int main(int argc, char **argv) {
+	wavefront_options options;
+	int baked = 0;
+	int failed = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+
+		if (arg == "--no-weld") {
+			options.weld = false;
+			continue;
+		}
+
+		if (arg == "--optimize") {
+			options.optimize = true;
+			continue;
+		}
+
+		// weighting for generated normals (files without vn records)
+		if (arg == "--normals=uniform") { options.normals = normal_weighting::uniform; continue; }
+		if (arg == "--normals=area") { options.normals = normal_weighting::area; continue; }
+		if (arg == "--normals=angle") { options.normals = normal_weighting::angle; continue; }
+
+		try {
+			wavefront_stats stats;
+			if (bake_tmesh(arg, options, &stats)) {
+				cout << tmesh_cache_path(arg) << " : " << stats.triangles << " triangles, "
+					<< stats.vertices << " vertices (" << stats.parse_ms + stats.build_ms << " ms)" << endl;
+				if (stats.optimized) {
+					cout << "    ACMR " << stats.optimize.before.acmr << " -> " << stats.optimize.after.acmr
+						<< ", ATVR " << stats.optimize.before.atvr << " -> " << stats.optimize.after.atvr << endl;
+				}
+				baked++;
+			}
+			else {
+				failed++;
+			}
+		}
+		catch (exception &e) {
+			cerr << e.what() << endl;
+			failed++;
+		}
+	}
+
+	if (baked + failed == 0) {
+		cerr << "usage: " << argv[0] << " [--no-weld] [--optimize] [--normals=uniform|area|angle] file.obj ..." << endl;
+		return 1;
+	}
+
+	return failed ? 1 : 0;
+}